@@ -0,0 +1,373 @@
+#include "workspace.h"
+#include "trace.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+
+// codews-bench: builds synthetic workspaces and times the workspace core on
+// them. The trees are generated from counters alone, so the same options
+// always produce the same tree and the same entry counts; only the timings
+// move between runs.
+
+#define BENCH_FANOUT 10
+#define BENCH_MAX_HITS 100
+
+static const char *const file_suffixes[] = {".c", ".h", ".py", ".asm", ".md"};
+static const char *const queries[] = {"main", "f42c", "d1/f7", "readme", "zzzz"};
+
+static gint opt_dirs = 10000;
+static gint opt_files = 100;
+static gint opt_wide = 100000;
+static gint opt_depth = 200;
+static gint opt_runs = 5;
+static gchar *opt_dir;
+static gchar *opt_trace;
+
+static GOptionEntry options[] = {
+    {"dirs", 0, 0, G_OPTION_ARG_INT, &opt_dirs, "Directories in the tree shape", "N"},
+    {"files", 0, 0, G_OPTION_ARG_INT, &opt_files, "Files per directory in the tree shape", "N"},
+    {"wide", 0, 0, G_OPTION_ARG_INT, &opt_wide, "Files in the single directory of the wide shape", "N"},
+    {"depth", 0, 0, G_OPTION_ARG_INT, &opt_depth, "Nesting depth of the deep shape", "N"},
+    {"runs", 0, 0, G_OPTION_ARG_INT, &opt_runs, "Repetitions of each non-destructive measurement", "N"},
+    {"dir", 0, 0, G_OPTION_ARG_FILENAME, &opt_dir, "Where to generate the workspaces (default: a new temporary directory)", "DIR"},
+    {"trace", 0, 0, G_OPTION_ARG_FILENAME, &opt_trace, "Write a Chrome trace of the core's spans to FILE", "FILE"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+};
+
+typedef struct {
+    const char *name;
+    gchar *root;
+    GPtrArray *dirs;  // every directory of the shape, root first, relative to root
+    guint64 files;
+} Shape;
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    gboolean finished;
+    guint64 dirs;  // reported by a du job so far
+} JobWait;
+
+static void make_files(const char *dir, gint count, guint64 *total) {
+    for (gint i = 0; i < count; i++) {
+        gchar *path = g_strdup_printf("%s/f%d%s", dir, i, file_suffixes[i % G_N_ELEMENTS(file_suffixes)]);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            g_printerr("Failed to create %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        g_free(path);
+        (*total)++;
+    }
+}
+
+static void make_dir(Shape *shape, const char *rel) {
+    gchar *path = rel[0] ? g_build_filename(shape->root, rel, NULL) : g_strdup(shape->root);
+    if (g_mkdir_with_parents(path, 0755) != 0) {
+        g_printerr("Failed to create %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    g_ptr_array_add(shape->dirs, g_strdup(rel));
+    g_free(path);
+}
+
+// "tree": dirs directories in a BENCH_FANOUT-ary tree, files in each.
+// "wide": one directory holding wide files.
+// "deep": a chain of depth directories with BENCH_FANOUT files in each.
+static Shape *shape_generate(const char *base, const char *name) {
+    Shape *shape = g_new0(Shape, 1);
+    shape->name = name;
+    shape->root = g_build_filename(base, name, NULL);
+    shape->dirs = g_ptr_array_new_with_free_func(g_free);
+
+    if (strcmp(name, "tree") == 0) {
+        make_dir(shape, "");
+        for (gint i = 1; i < opt_dirs; i++) {
+            const char *parent = g_ptr_array_index(shape->dirs, (i - 1) / BENCH_FANOUT);
+            gchar *rel = parent[0] ? g_strdup_printf("%s/d%d", parent, i) : g_strdup_printf("d%d", i);
+            make_dir(shape, rel);
+            g_free(rel);
+        }
+        for (guint i = 0; i < shape->dirs->len; i++) {
+            const char *rel = g_ptr_array_index(shape->dirs, i);
+            gchar *path = rel[0] ? g_build_filename(shape->root, rel, NULL) : g_strdup(shape->root);
+            make_files(path, opt_files, &shape->files);
+            g_free(path);
+        }
+    } else if (strcmp(name, "wide") == 0) {
+        make_dir(shape, "");
+        make_files(shape->root, opt_wide, &shape->files);
+    } else {
+        GString *rel = g_string_new(NULL);
+        make_dir(shape, "");
+        make_files(shape->root, BENCH_FANOUT, &shape->files);
+        for (gint i = 1; i < opt_depth; i++) {
+            g_string_append_printf(rel, "%sd%d", rel->len ? "/" : "", i);
+            make_dir(shape, rel->str);
+            gchar *path = g_build_filename(shape->root, rel->str, NULL);
+            make_files(path, BENCH_FANOUT, &shape->files);
+            g_free(path);
+        }
+        g_string_free(rel, TRUE);
+    }
+    return shape;
+}
+
+static void shape_free(Shape *shape) {
+    g_free(shape->root);
+    g_ptr_array_unref(shape->dirs);
+    g_free(shape);
+}
+
+static gint compare_times(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const Shape *shape, const char *op, guint64 count, GArray *times) {
+    g_array_sort(times, compare_times);
+    gint64 min = g_array_index(times, gint64, 0);
+    gint64 median = g_array_index(times, gint64, times->len / 2);
+    printf("%s\t%s\t%" G_GUINT64_FORMAT "\t%.3f\t%.3f\n", shape->name, op, count, min / 1000.0, median / 1000.0);
+    fflush(stdout);
+}
+
+static gboolean count_entry(const char *name __attribute__((unused)), const EntryRecord *record __attribute__((unused)),
+                            gpointer data) {
+    (*(guint64 *)data)++;
+    return TRUE;
+}
+
+// Lists every directory of the shape, as browsing through all of it would.
+static guint64 bench_list(const Shape *shape) {
+    guint64 entries = 0;
+    for (guint i = 0; i < shape->dirs->len; i++) {
+        const char *rel = g_ptr_array_index(shape->dirs, i);
+        gchar *path = rel[0] ? g_build_filename(shape->root, rel, NULL) : g_strdup(shape->root);
+        list_directory(path, NULL, count_entry, &entries);
+        g_free(path);
+    }
+    return entries;
+}
+
+// What the index does when a directory is replaced: drop its subtree and
+// walk it again. The last directory of the shape is the deepest one, never
+// the root.
+static guint64 bench_refresh(const Shape *shape, PathIndex *index) {
+    const char *rel = g_ptr_array_index(shape->dirs, shape->dirs->len - 1);
+    gchar *prefix = g_strconcat(rel, "/", NULL);
+    path_index_remove_tree(index, prefix);
+    path_index_walk(index, shape->root, rel, NULL, -1, 0);
+    g_free(prefix);
+    return index->live;
+}
+
+static guint64 bench_search(PathIndex *index) {
+    FinderHit hits[BENCH_MAX_HITS];
+    guint64 found = 0;
+    for (guint i = 0; i < G_N_ELEMENTS(queries); i++) {
+        GArray *matches = g_array_new(FALSE, FALSE, sizeof(guint32));
+        guint n_hits;
+        path_index_query(index, queries[i], NULL, matches, hits, BENCH_MAX_HITS, &n_hits);
+        found += matches->len;
+        g_array_free(matches, TRUE);
+    }
+    return found;
+}
+
+static void job_wait_finish(JobWait *wait) {
+    g_mutex_lock(&wait->lock);
+    wait->finished = TRUE;
+    g_cond_signal(&wait->cond);
+    g_mutex_unlock(&wait->lock);
+}
+
+static void job_wait(JobWait *wait) {
+    g_mutex_lock(&wait->lock);
+    while (!wait->finished) {
+        g_cond_wait(&wait->cond, &wait->lock);
+    }
+    g_mutex_unlock(&wait->lock);
+}
+
+static void on_du_dir(DuJob *job, const char *path __attribute__((unused)), const struct stat *st __attribute__((unused)),
+                      guint64 own __attribute__((unused)), guint64 total __attribute__((unused)),
+                      gboolean root __attribute__((unused))) {
+    JobWait *wait = job->user_data;
+    __atomic_fetch_add(&wait->dirs, 1, __ATOMIC_RELAXED);
+}
+
+static void on_du_finished(DuJob *job) {
+    job_wait_finish(job->user_data);
+}
+
+// A fresh links table per run, so every run counts the same files.
+static guint64 bench_du(const Shape *shape, GThreadPool *pool) {
+    JobWait wait = {0};
+    DuLinks *links = du_links_new();
+    g_mutex_init(&wait.lock);
+    g_cond_init(&wait.cond);
+
+    DuJob *job = du_job_new(pool, links, on_du_dir, on_du_finished, &wait);
+    du_job_add_path(job, shape->root);
+    if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+        wait.finished = TRUE;
+    }
+    job_wait(&wait);
+
+    du_job_free(job);
+    du_links_free(links);
+    g_cond_clear(&wait.cond);
+    g_mutex_clear(&wait.lock);
+    return wait.dirs;
+}
+
+static void on_delete_finished(DeleteJob *job) {
+    job_wait_finish(job->user_data);
+}
+
+static guint64 bench_delete(const Shape *shape, GThreadPool *pool) {
+    JobWait wait = {0};
+    g_mutex_init(&wait.lock);
+    g_cond_init(&wait.cond);
+
+    DeleteJob *job = delete_job_new(pool, FALSE, on_delete_finished, &wait);
+    delete_job_add_path(job, shape->root);
+    if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+        wait.finished = TRUE;
+    }
+    job_wait(&wait);
+
+    for (guint i = 0; i < job->errors->len; i++) {
+        g_printerr("Failed to delete %s\n", (const char *)g_ptr_array_index(job->errors, i));
+    }
+    guint64 entries = job->entries;
+    delete_job_free(job);
+    g_cond_clear(&wait.cond);
+    g_mutex_clear(&wait.lock);
+    return entries;
+}
+
+static void bench_shape(const char *base, const char *name, GThreadPool *pool, GThreadPool *du_pool) {
+    gint64 start = g_get_monotonic_time();
+    Shape *shape = shape_generate(base, name);
+    GArray *times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    guint64 count = 0;
+    PathIndex *index = NULL;
+
+    g_printerr("%s: %u directories, %" G_GUINT64_FORMAT " files generated in %.1f s\n", name, shape->dirs->len,
+               shape->files, (g_get_monotonic_time() - start) / 1e6);
+
+    for (gint run = 0; run < opt_runs; run++) {
+        start = g_get_monotonic_time();
+        count = bench_list(shape);
+        gint64 elapsed = g_get_monotonic_time() - start;
+        g_array_append_val(times, elapsed);
+    }
+    report(shape, "list", count, times);
+
+    g_array_set_size(times, 0);
+    for (gint run = 0; run < opt_runs; run++) {
+        if (index) {
+            path_index_free(index);
+        }
+        start = g_get_monotonic_time();
+        index = path_index_new();
+        path_index_walk(index, shape->root, "", NULL, -1, 0);
+        gint64 elapsed = g_get_monotonic_time() - start;
+        g_array_append_val(times, elapsed);
+    }
+    report(shape, "index", index->live, times);
+
+    g_array_set_size(times, 0);
+    for (gint run = 0; run < opt_runs; run++) {
+        start = g_get_monotonic_time();
+        count = bench_search(index);
+        gint64 elapsed = g_get_monotonic_time() - start;
+        g_array_append_val(times, elapsed);
+    }
+    report(shape, "search", count, times);
+
+    g_array_set_size(times, 0);
+    if (shape->dirs->len > 1) {
+        for (gint run = 0; run < opt_runs; run++) {
+            start = g_get_monotonic_time();
+            count = bench_refresh(shape, index);
+            gint64 elapsed = g_get_monotonic_time() - start;
+            g_array_append_val(times, elapsed);
+        }
+        report(shape, "refresh", count, times);
+    }
+    path_index_free(index);
+
+    g_array_set_size(times, 0);
+    for (gint run = 0; run < opt_runs; run++) {
+        start = g_get_monotonic_time();
+        count = bench_du(shape, du_pool);
+        gint64 elapsed = g_get_monotonic_time() - start;
+        g_array_append_val(times, elapsed);
+    }
+    report(shape, "du", count, times);
+
+    // Deleting is destructive, so it is measured once.
+    g_array_set_size(times, 0);
+    start = g_get_monotonic_time();
+    count = bench_delete(shape, pool);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_array_append_val(times, elapsed);
+    report(shape, "delete", count, times);
+
+    g_array_free(times, TRUE);
+    shape_free(shape);
+}
+
+int main(int argc, char *argv[]) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- time the codews workspace core on synthetic trees");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+    if (opt_dirs < 1 || opt_files < 0 || opt_wide < 0 || opt_depth < 1 || opt_runs < 1) {
+        g_printerr("Sizes must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opt_trace && !trace_open(opt_trace)) {
+        return EXIT_FAILURE;
+    }
+
+    gchar *base = opt_dir ? g_strdup(opt_dir) : g_dir_make_tmp("codews-bench-XXXXXX", &error);
+    if (base == NULL) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    GThreadPool *pool = g_thread_pool_new(delete_worker, NULL, g_get_num_processors(), FALSE, NULL);
+    g_thread_pool_set_sort_function(pool, delete_compare_depth, NULL);
+    GThreadPool *du_pool = g_thread_pool_new(du_worker, NULL, g_get_num_processors(), FALSE, NULL);
+
+    printf("# codews-bench dirs=%d files=%d wide=%d depth=%d runs=%d threads=%u\n", opt_dirs, opt_files, opt_wide,
+           opt_depth, opt_runs, g_get_num_processors());
+    printf("# shape\top\tcount\tmin_ms\tmedian_ms\n");
+
+    static const char *const shapes[] = {"tree", "wide", "deep"};
+    for (guint i = 0; i < G_N_ELEMENTS(shapes); i++) {
+        bench_shape(base, shapes[i], pool, du_pool);
+    }
+
+    g_thread_pool_free(du_pool, FALSE, TRUE);
+    g_thread_pool_free(pool, FALSE, TRUE);
+    trace_close();
+    if (!opt_dir) {
+        rmdir(base);
+    }
+    g_free(base);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1260 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "workspace.h"
+#include "trace.h"
+#include <glib-unix.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Attribute changes only matter to the listing cache; subscribers get the
+// same events a window's own index watches would have given it.
+#define DAEMON_WATCH_MASK (INDEX_WATCH_MASK | IN_CLOSE_WRITE | IN_ATTRIB)
+#define DAEMON_FIND_MAX_HITS 100
+#define DAEMON_SEARCH_MAX_HITS 1000
+#define DAEMON_SEARCH_MAX_FILE_SIZE (64 << 20)
+#define DAEMON_SEARCH_BINARY_PROBE 8192
+#define DAEMON_SEARCH_MAX_LINE_TEXT 200
+#define DAEMON_JOB_HISTORY_SIZE 256
+#define DAEMON_MAX_REQUEST 65536
+#define DAEMON_CLIENT_THREADS 8
+#define DAEMON_CLIENT_SEND_TIMEOUT_S 10
+#define DAEMON_SUBSCRIBER_MAX_BACKLOG (16 << 20)
+#define DAEMON_BUILD_LOGS_KEPT 32
+
+typedef struct {
+    gchar *prefix;  // NULL for a full walk
+    guint generation;
+    PathIndex *index;
+} WalkJob;
+
+// One connection. It waits in the main loop until a request arrives and is
+// then served on client_pool, so an idle connection holds no thread. The
+// finder's narrowing state is per connection, like it is per window.
+typedef struct {
+    int fd;
+    GString *in;
+    gchar *last_query;
+    GArray *matches;
+    guint serial;
+} DaemonClient;
+
+// A connection that turned into a subscription. It is only touched on the
+// main loop, which is where every broadcast comes from.
+typedef struct {
+    int fd;
+    GString *pending;  // broadcast lines the socket hasn't taken yet
+    guint in_source;
+    guint out_source;
+} DaemonSubscriber;
+
+typedef struct {
+    gchar *dir;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    GString *reply;
+    GList *link;
+} DaemonListing;
+
+typedef struct {
+    gint pid;
+    gint64 start_us;
+    gint64 end_us;
+    gint status;
+    gboolean finished;
+    gchar *kind;
+    gchar *title;
+    gchar *command;
+} DaemonJob;
+
+static const DaemonOptions *options;
+static char *real_root;  // options->root with symlinks resolved
+static GMainLoop *loop;
+static gchar *socket_path;
+
+// The index belongs to the main loop; connection threads read it under the
+// lock, and the main loop holds the lock while changing it.
+static GMutex index_lock;
+static PathIndex *daemon_index;
+static guint index_serial;
+static gboolean index_walking;
+static gboolean index_dirty;
+static guint index_generation;  // main loop only
+static GByteArray *parked_events;
+static int inotify_fd = -1;
+static GThreadPool *walk_pool;
+
+static GMutex subscribers_lock;
+static GPtrArray *subscribers;  // DaemonSubscriber
+static GThreadPool *client_pool;  // client_worker()
+
+// Listings are validated against the directory's timestamps and dropped on
+// any event inside it, which catches writes the timestamps don't show. The
+// epoch keeps a listing that raced such an event out of the cache.
+static GMutex listings_lock;
+static GHashTable *listings;  // directory -> DaemonListing
+static GQueue listings_lru = G_QUEUE_INIT;
+static gsize listings_bytes;
+static guint listings_epoch;
+
+static GMutex jobs_lock;
+static GQueue jobs = G_QUEUE_INIT;
+static gchar *jobs_fifo_path;
+static int jobs_fifo_fd = -1;
+static GString *jobs_buffer;
+
+static void start_walk(const char *prefix);
+static gboolean walk_install(WalkJob *job);
+static void apply_events(const char *buf, gsize len);
+
+gchar *daemon_socket_path(void) {
+    return g_build_filename(g_get_user_runtime_dir(), "codews", DAEMON_SOCKET_NAME, NULL);
+}
+
+static gboolean send_all(int fd, const char *data, gsize length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+static void reply_error(GString *out, int err, const char *message) {
+    g_string_append_printf(out, "error\t%d\t%s\n", err, message);
+}
+
+static void subscriber_drop(DaemonSubscriber *subscriber) {
+    g_mutex_lock(&subscribers_lock);
+    g_ptr_array_remove(subscribers, subscriber);
+    g_mutex_unlock(&subscribers_lock);
+    if (subscriber->in_source) {
+        g_source_remove(subscriber->in_source);
+    }
+    if (subscriber->out_source) {
+        g_source_remove(subscriber->out_source);
+    }
+    close(subscriber->fd);
+    g_string_free(subscriber->pending, TRUE);
+    g_free(subscriber);
+}
+
+// Sends what the socket takes without blocking. Returns FALSE once the
+// subscriber is gone.
+static gboolean subscriber_flush(DaemonSubscriber *subscriber) {
+    while (subscriber->pending->len > 0) {
+        ssize_t n = send(subscriber->fd, subscriber->pending->str, subscriber->pending->len,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return TRUE;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        g_string_erase(subscriber->pending, 0, n);
+    }
+    return TRUE;
+}
+
+static gboolean on_subscriber_writable(gint fd __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data) {
+    DaemonSubscriber *subscriber = data;
+    gboolean open = subscriber_flush(subscriber);
+    if (open && subscriber->pending->len > 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    subscriber->out_source = 0;
+    if (!open) {
+        subscriber_drop(subscriber);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Subscribers send nothing; readable means hung up.
+static gboolean on_subscriber_input(gint fd, GIOCondition condition __attribute__((unused)), gpointer data) {
+    DaemonSubscriber *subscriber = data;
+    char buf[256];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR))) {
+        return G_SOURCE_CONTINUE;
+    }
+    subscriber->in_source = 0;
+    subscriber_drop(subscriber);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean subscriber_start(gpointer data) {
+    DaemonSubscriber *subscriber = data;
+    subscriber->in_source = g_unix_fd_add(subscriber->fd, G_IO_IN | G_IO_HUP | G_IO_ERR, on_subscriber_input,
+                                          subscriber);
+    g_mutex_lock(&subscribers_lock);
+    g_ptr_array_add(subscribers, subscriber);
+    g_mutex_unlock(&subscribers_lock);
+    return G_SOURCE_REMOVE;
+}
+
+// Queues line for every subscriber. One that has fallen
+// DAEMON_SUBSCRIBER_MAX_BACKLOG behind is dropped; its window notices the
+// closed stream and indexes on its own.
+static void broadcast(const char *line) {
+    gsize length = strlen(line);
+    GPtrArray *dropped = g_ptr_array_new();
+
+    g_mutex_lock(&subscribers_lock);
+    for (guint i = 0; i < subscribers->len; i++) {
+        DaemonSubscriber *subscriber = g_ptr_array_index(subscribers, i);
+        if (subscriber->pending->len + length > DAEMON_SUBSCRIBER_MAX_BACKLOG) {
+            g_ptr_array_add(dropped, subscriber);
+            continue;
+        }
+        g_string_append_len(subscriber->pending, line, length);
+        if (subscriber->out_source) {
+            continue;
+        }
+        if (!subscriber_flush(subscriber)) {
+            g_ptr_array_add(dropped, subscriber);
+        } else if (subscriber->pending->len > 0) {
+            subscriber->out_source = g_unix_fd_add(subscriber->fd, G_IO_OUT, on_subscriber_writable, subscriber);
+        }
+    }
+    g_mutex_unlock(&subscribers_lock);
+
+    for (guint i = 0; i < dropped->len; i++) {
+        subscriber_drop(g_ptr_array_index(dropped, i));
+    }
+    g_ptr_array_free(dropped, TRUE);
+}
+
+static void listing_free(DaemonListing *listing) {
+    g_free(listing->dir);
+    g_string_free(listing->reply, TRUE);
+    g_free(listing);
+}
+
+static void listing_remove_locked(DaemonListing *listing) {
+    g_queue_delete_link(&listings_lru, listing->link);
+    listings_bytes -= listing->reply->len;
+    g_hash_table_remove(listings, listing->dir);
+}
+
+static void listing_forget(const char *dir) {
+    g_mutex_lock(&listings_lock);
+    DaemonListing *listing = g_hash_table_lookup(listings, dir);
+    if (listing) {
+        listing_remove_locked(listing);
+    }
+    listings_epoch++;
+    g_mutex_unlock(&listings_lock);
+}
+
+static void walk_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    WalkJob *job = data;
+    job->index = path_index_new();
+    path_index_walk(job->index, options->root, job->prefix ? job->prefix : "", options->ignore_dirs, inotify_fd,
+                    DAEMON_WATCH_MASK);
+    if (job->prefix == NULL) {
+        path_index_save(job->index, options->root, options->index_cache_path);
+    }
+    g_idle_add((GSourceFunc)walk_install, job);
+}
+
+static void walk_job_free(WalkJob *job) {
+    if (job->index) {
+        path_index_free(job->index);
+    }
+    g_free(job->prefix);
+    g_free(job);
+}
+
+static gboolean walk_install(WalkJob *job) {
+    if (job->generation != index_generation) {
+        walk_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_mutex_lock(&index_lock);
+    if (job->prefix && daemon_index) {
+        // A directory appeared after the walk: fold its contents in.
+        for (guint32 i = 0; i < job->index->entries->len; i++) {
+            const IndexEntry *entry = &g_array_index(job->index->entries, IndexEntry, i);
+            path_index_add(daemon_index, job->index->paths->str + entry->offset, entry->length);
+        }
+        GHashTableIter iter;
+        gpointer wd, rel;
+        g_hash_table_iter_init(&iter, job->index->dirs);
+        while (g_hash_table_iter_next(&iter, &wd, &rel)) {
+            g_hash_table_insert(daemon_index->dirs, wd, g_strdup(rel));
+        }
+    } else if (job->prefix == NULL) {
+        if (daemon_index) {
+            path_index_free(daemon_index);
+        }
+        daemon_index = g_steal_pointer(&job->index);
+        index_walking = FALSE;
+        index_dirty = FALSE;
+    }
+    index_serial++;
+    g_mutex_unlock(&index_lock);
+
+    if (job->prefix == NULL) {
+        // Replay what happened to the tree while it was being walked.
+        apply_events((const char *)parked_events->data, parked_events->len);
+        g_byte_array_set_size(parked_events, 0);
+    }
+    walk_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void start_walk(const char *prefix) {
+    WalkJob *job = g_new0(WalkJob, 1);
+    job->prefix = g_strdup(prefix);
+    if (prefix == NULL) {
+        index_generation++;
+        g_mutex_lock(&index_lock);
+        index_walking = TRUE;
+        g_mutex_unlock(&index_lock);
+    }
+    job->generation = index_generation;
+    g_thread_pool_push(walk_pool, job, NULL);
+}
+
+// The same bookkeeping as a window's own index, plus forwarding every named
+// event to the subscribers.
+static void apply_events(const char *buf, gsize len) {
+    gboolean rewalk = FALSE;
+
+    g_mutex_lock(&index_lock);
+    for (const char *ptr = buf; ptr < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *)ptr;
+        ptr += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            rewalk = TRUE;
+            break;
+        }
+        const char *dir = g_hash_table_lookup(daemon_index->dirs, GINT_TO_POINTER(event->wd));
+        if (dir == NULL) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            g_hash_table_remove(daemon_index->dirs, GINT_TO_POINTER(event->wd));
+            continue;
+        }
+        if (event->len == 0) {
+            continue;
+        }
+
+        gchar *abs_dir = dir[0] ? g_build_filename(options->root, dir, NULL) : g_strdup(options->root);
+        listing_forget(abs_dir);
+        g_free(abs_dir);
+        if (event->mask & IN_ATTRIB) {
+            continue;
+        }
+        if (strchr(event->name, '\n') == NULL && strchr(dir, '\n') == NULL) {
+            gchar *line = g_strdup_printf("event\t%u\t%s\t%s\n", event->mask, dir, event->name);
+            broadcast(line);
+            g_free(line);
+        }
+
+        gboolean is_dir = (event->mask & IN_ISDIR) != 0;
+        if (event->mask & IN_CLOSE_WRITE ||
+            (is_dir ? workspace_skip_dir(event->name, options->ignore_dirs) : is_hidden_entry(event->name))) {
+            continue;
+        }
+        gchar *rel = dir[0] ? g_strdup_printf("%s/%s", dir, event->name) : g_strdup(event->name);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (is_dir) {
+                start_walk(rel);
+            } else {
+                path_index_add(daemon_index, rel, strlen(rel));
+            }
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            if (is_dir) {
+                gchar *prefix = g_strconcat(rel, "/", NULL);
+                path_index_remove_tree(daemon_index, prefix);
+                g_free(prefix);
+            } else {
+                path_index_remove(daemon_index, rel);
+            }
+        }
+        g_free(rel);
+        index_dirty = TRUE;
+    }
+    index_serial++;
+    g_mutex_unlock(&index_lock);
+
+    if (rewalk) {
+        broadcast("rescan\n");
+        start_walk(NULL);
+    }
+}
+
+static gboolean on_inotify_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        // Until the walk lands there is no mapping for its watches yet.
+        if (index_walking || daemon_index == NULL) {
+            g_byte_array_append(parked_events, (const guint8 *)buf, len);
+        } else {
+            apply_events(buf, len);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void job_free(DaemonJob *job) {
+    g_free(job->kind);
+    g_free(job->title);
+    g_free(job->command);
+    g_free(job);
+}
+
+// The lines `codews --job` writes, as a window's job history reads them.
+static void jobs_apply(const char *line) {
+    gchar **fields = g_strsplit(line, "\t", -1);
+    guint n = g_strv_length(fields);
+
+    g_mutex_lock(&jobs_lock);
+    if (n == 6 && strcmp(fields[0], "start") == 0) {
+        DaemonJob *job = g_new0(DaemonJob, 1);
+        job->pid = atoi(fields[1]);
+        job->start_us = g_ascii_strtoll(fields[2], NULL, 10);
+        job->kind = g_strdup(fields[3]);
+        job->title = g_strdup(fields[4]);
+        job->command = g_strdup(fields[5]);
+        g_queue_push_tail(&jobs, job);
+        while (jobs.length > DAEMON_JOB_HISTORY_SIZE) {
+            job_free(g_queue_pop_head(&jobs));
+        }
+    } else if (n == 9 && strcmp(fields[0], "end") == 0) {
+        for (GList *link = jobs.tail; link; link = link->prev) {
+            DaemonJob *job = link->data;
+            if (job->pid == atoi(fields[1]) && !job->finished) {
+                job->end_us = g_ascii_strtoll(fields[2], NULL, 10);
+                job->status = atoi(fields[3]);
+                job->finished = TRUE;
+                break;
+            }
+        }
+    }
+    g_mutex_unlock(&jobs_lock);
+    g_strfreev(fields);
+}
+
+static gboolean on_jobs_fifo_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096];
+    ssize_t len;
+
+    while ((len = read(jobs_fifo_fd, buf, sizeof(buf))) > 0) {
+        g_string_append_len(jobs_buffer, buf, len);
+    }
+
+    gchar *start = jobs_buffer->str, *newline;
+    while ((newline = memchr(start, '\n', jobs_buffer->str + jobs_buffer->len - start)) != NULL) {
+        *newline = '\0';
+        jobs_apply(start);
+        gchar *forward = g_strdup_printf("job\t%s\n", start);
+        broadcast(forward);
+        g_free(forward);
+        start = newline + 1;
+    }
+    g_string_erase(jobs_buffer, 0, start - jobs_buffer->str);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean list_entry(const char *name, const EntryRecord *record, gpointer data) {
+    if (strchr(name, '\n') == NULL) {
+        g_string_append_printf(data, "%u\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%u\t%s\n", record->mode,
+                               record->size, record->mtime, record->type, name);
+    }
+    return TRUE;
+}
+
+// A listing is only kept while the index watches dir, since the watch is
+// what drops it when an entry changes: dir has to lie in the root without
+// passing a symlink or a directory the walk skips, and no watch may have
+// failed.
+static gboolean listing_watched(const char *dir) {
+    gsize length = strlen(options->root);
+    if (real_root == NULL || strncmp(dir, options->root, length) != 0 || (dir[length] != '/' && dir[length] != '\0')) {
+        return FALSE;
+    }
+    gchar *real = realpath(dir, NULL);
+    gchar *expected = g_strconcat(real_root, dir + length, NULL);
+    gboolean watched = real && strcmp(real, expected) == 0;
+    g_free(expected);
+    free(real);
+
+    gchar **parts = g_strsplit(dir + length, "/", -1);
+    for (gchar **part = parts + 1; watched && *part; part++) {
+        watched = workspace_skip_dir(*part, options->ignore_dirs) == FALSE;
+    }
+    g_strfreev(parts);
+
+    g_mutex_lock(&index_lock);
+    watched = watched && daemon_index && !daemon_index->watch_failed;
+    g_mutex_unlock(&index_lock);
+    return watched;
+}
+
+static void serve_list(const char *dir, GString *out) {
+    struct stat st;
+    if (stat(dir, &st) != 0) {
+        reply_error(out, errno, strerror(errno));
+        return;
+    }
+
+    g_mutex_lock(&listings_lock);
+    DaemonListing *listing = g_hash_table_lookup(listings, dir);
+    if (listing && listing->dev == st.st_dev && listing->ino == st.st_ino &&
+        listing->mtime.tv_sec == st.st_mtim.tv_sec && listing->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+        listing->ctime.tv_sec == st.st_ctim.tv_sec && listing->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+        g_string_append_len(out, listing->reply->str, listing->reply->len);
+        g_queue_unlink(&listings_lru, listing->link);
+        g_queue_push_head_link(&listings_lru, listing->link);
+        g_mutex_unlock(&listings_lock);
+        return;
+    }
+    guint epoch = listings_epoch;
+    g_mutex_unlock(&listings_lock);
+
+    GString *reply = g_string_new(NULL);
+    int error = list_directory(dir, NULL, list_entry, reply);
+    if (error) {
+        reply_error(out, error, strerror(error));
+        g_string_free(reply, TRUE);
+        return;
+    }
+    g_string_append_len(out, reply->str, reply->len);
+    if (!listing_watched(dir)) {
+        g_string_free(reply, TRUE);
+        return;
+    }
+
+    g_mutex_lock(&listings_lock);
+    if (epoch != listings_epoch || reply->len > options->listing_cache_bytes) {
+        g_string_free(reply, TRUE);
+        g_mutex_unlock(&listings_lock);
+        return;
+    }
+    listing = g_hash_table_lookup(listings, dir);
+    if (listing) {
+        listing_remove_locked(listing);
+    }
+    listing = g_new0(DaemonListing, 1);
+    listing->dir = g_strdup(dir);
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->ctime = st.st_ctim;
+    listing->reply = reply;
+    g_queue_push_head(&listings_lru, listing);
+    listing->link = g_queue_peek_head_link(&listings_lru);
+    g_hash_table_insert(listings, listing->dir, listing);
+    listings_bytes += reply->len;
+    while (listings_bytes > options->listing_cache_bytes) {
+        listing_remove_locked(g_queue_peek_tail(&listings_lru));
+    }
+    g_mutex_unlock(&listings_lock);
+}
+
+static void serve_find(DaemonClient *client, const char *raw_query, GString *out) {
+    // Spaces are only separators; matching ignores case.
+    GString *query = g_string_new(NULL);
+    for (const char *p = raw_query; *p; p++) {
+        if (*p != ' ') {
+            g_string_append_c(query, g_ascii_tolower(*p));
+        }
+    }
+
+    g_mutex_lock(&index_lock);
+    if (daemon_index == NULL) {
+        g_mutex_unlock(&index_lock);
+        reply_error(out, EAGAIN, "workspace is still being indexed");
+        g_string_free(query, TRUE);
+        return;
+    }
+
+    // Typing more characters only narrows the previous matches.
+    gboolean narrowing = client->last_query && client->serial == index_serial &&
+                         g_str_has_prefix(query->str, client->last_query);
+    GArray *matches = g_array_new(FALSE, FALSE, sizeof(guint32));
+    FinderHit hits[DAEMON_FIND_MAX_HITS];
+    guint n_hits;
+    path_index_query(daemon_index, query->str, narrowing ? client->matches : NULL, matches, hits,
+                     DAEMON_FIND_MAX_HITS, &n_hits);
+
+    g_string_append_printf(out, "matched\t%u\t%u\t%d\n", matches->len, daemon_index->live, index_walking);
+    for (guint i = 0; i < n_hits; i++) {
+        const char *path = path_index_path(daemon_index, hits[i].entry);
+        if (strchr(path, '\n') == NULL) {
+            g_string_append_printf(out, "%s\n", path);
+        }
+    }
+    client->serial = index_serial;
+    g_mutex_unlock(&index_lock);
+
+    if (client->matches) {
+        g_array_free(client->matches, TRUE);
+    }
+    client->matches = matches;
+    g_free(client->last_query);
+    client->last_query = g_string_free(query, FALSE);
+}
+
+// The live paths, NUL-separated, copied out so the lock isn't held while
+// they are used.
+static GString *snapshot_paths(void) {
+    g_mutex_lock(&index_lock);
+    if (daemon_index == NULL) {
+        g_mutex_unlock(&index_lock);
+        return NULL;
+    }
+    GString *paths = g_string_sized_new(daemon_index->paths->len);
+    for (guint32 i = 0; i < daemon_index->entries->len; i++) {
+        const IndexEntry *entry = &g_array_index(daemon_index->entries, IndexEntry, i);
+        if (entry->length != 0) {
+            g_string_append_len(paths, daemon_index->paths->str + entry->offset, entry->length + 1);
+        }
+    }
+    g_mutex_unlock(&index_lock);
+    return paths;
+}
+
+static void serve_paths(GString *out) {
+    GString *paths = snapshot_paths();
+    if (paths == NULL) {
+        reply_error(out, EAGAIN, "workspace is still being indexed");
+        return;
+    }
+    for (const char *p = paths->str; p < paths->str + paths->len; p += strlen(p) + 1) {
+        if (strchr(p, '\n') == NULL) {
+            g_string_append_printf(out, "%s\n", p);
+        }
+    }
+    g_string_free(paths, TRUE);
+}
+
+// Literal search over the indexed files, one line per match. The file is
+// read into contents rather than mapped, so one truncated under the search
+// can't fault the daemon.
+static guint search_file(const char *rel, const char *pattern, gboolean match_case, GString *out, guint budget,
+                         GByteArray *contents) {
+    gchar *path = g_build_filename(options->root, rel, NULL);
+    gboolean read_ok = read_regular_file(path, DAEMON_SEARCH_MAX_FILE_SIZE, contents);
+    guint found = 0;
+    g_free(path);
+    if (!read_ok) {
+        return 0;
+    }
+
+    const char *buf = (const char *)contents->data;
+    const char *end = buf + contents->len;
+    gsize len = strlen(pattern);
+    // A NUL byte near the start means binary; don't report matches in it.
+    if (memchr(buf, '\0', MIN(contents->len, DAEMON_SEARCH_BINARY_PROBE)) == NULL) {
+        const char *line_start = buf;
+        gint line = 1;
+        const char *match;
+
+        while (found < budget && (match = match_case ? memmem(line_start, end - line_start, pattern, len)
+                                                     : find_caseless(line_start, end, pattern, len)) != NULL) {
+            for (const char *nl; (nl = memchr(line_start, '\n', match - line_start)) != NULL; line_start = nl + 1) {
+                line++;
+            }
+            const char *line_end = memchr(match, '\n', end - match);
+            if (line_end == NULL) {
+                line_end = end;
+            }
+            gchar *text = g_utf8_make_valid(line_start, MIN(line_end - line_start, DAEMON_SEARCH_MAX_LINE_TEXT));
+            g_strstrip(text);
+            g_string_append_printf(out, "%s\t%d\t%s\n", rel, line, text);
+            g_free(text);
+            found++;
+            if (line_end == end) {
+                break;
+            }
+            line_start = line_end + 1;
+            line++;
+        }
+    }
+    return found;
+}
+
+static void serve_search(const char *flags, const char *pattern, GString *out) {
+    if (pattern[0] == '\0') {
+        return;
+    }
+    GString *paths = snapshot_paths();
+    if (paths == NULL) {
+        reply_error(out, EAGAIN, "workspace is still being indexed");
+        return;
+    }
+    TRACE_START(trace_start);
+    GByteArray *contents = g_byte_array_new();
+    guint hits = 0;
+    for (const char *p = paths->str; p < paths->str + paths->len && hits < DAEMON_SEARCH_MAX_HITS;
+         p += strlen(p) + 1) {
+        if (strchr(p, '\n') == NULL) {
+            hits += search_file(p, pattern, strchr(flags, 'c') != NULL, out, DAEMON_SEARCH_MAX_HITS - hits,
+                                contents);
+        }
+    }
+    TRACE_ENDF(trace_start, "daemon", "search", "%u hits", hits);
+    g_byte_array_free(contents, TRUE);
+    g_string_free(paths, TRUE);
+}
+
+static void build_child_setup(gpointer data) {
+    int log_fd = GPOINTER_TO_INT(data);
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+}
+
+static gint compare_build_logs(gconstpointer a, gconstpointer b) {
+    gint64 x = g_ascii_strtoll(*(const char *const *)a + strlen("build-"), NULL, 10);
+    gint64 y = g_ascii_strtoll(*(const char *const *)b + strlen("build-"), NULL, 10);
+    return x < y ? -1 : x > y;
+}
+
+// Keeps the newest DAEMON_BUILD_LOGS_KEPT logs. A build still writing to an
+// older one keeps its open file.
+static void prune_build_logs(const char *log_dir) {
+    GDir *handle = g_dir_open(log_dir, 0, NULL);
+    if (handle == NULL) {
+        return;
+    }
+    GPtrArray *logs = g_ptr_array_new_with_free_func(g_free);
+    const char *name;
+    while ((name = g_dir_read_name(handle)) != NULL) {
+        if (g_str_has_prefix(name, "build-") && g_str_has_suffix(name, ".log")) {
+            g_ptr_array_add(logs, g_strdup(name));
+        }
+    }
+    g_dir_close(handle);
+
+    g_ptr_array_sort(logs, compare_build_logs);
+    for (guint i = 0; i + DAEMON_BUILD_LOGS_KEPT < logs->len; i++) {
+        gchar *path = g_build_filename(log_dir, g_ptr_array_index(logs, i), NULL);
+        unlink(path);
+        g_free(path);
+    }
+    g_ptr_array_unref(logs);
+}
+
+// Builds go through `codews --job` like a window's do, so they land in the
+// job history and reach every subscriber.
+static void serve_build(const char *dir, const char *command, GString *out) {
+    if (options->self_exe == NULL || jobs_fifo_path == NULL) {
+        reply_error(out, ENOTSUP, "job accounting is unavailable");
+        return;
+    }
+    gchar *log_dir = g_build_filename(g_get_user_runtime_dir(), "codews", NULL);
+    gchar *log_path = g_strdup_printf("%s/build-%" G_GINT64_FORMAT ".log", log_dir, g_get_real_time());
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (log_fd < 0) {
+        reply_error(out, errno, strerror(errno));
+        g_free(log_path);
+        g_free(log_dir);
+        return;
+    }
+    prune_build_logs(log_dir);
+    g_free(log_dir);
+    gchar *title = g_path_get_basename(dir);
+    gchar *argv[] = {(gchar *)options->self_exe, "--job", jobs_fifo_path, "build", title, "/bin/sh",
+                     (gchar *)command, NULL};
+    GError *error = NULL;
+
+    if (g_spawn_async(dir, argv, NULL, G_SPAWN_DEFAULT, build_child_setup, GINT_TO_POINTER(log_fd), NULL, &error)) {
+        g_string_append_printf(out, "started\t%s\n", log_path);
+    } else {
+        reply_error(out, error->code, error->message);
+        g_error_free(error);
+    }
+    close(log_fd);
+    g_free(title);
+    g_free(log_path);
+}
+
+static void serve_jobs(GString *out) {
+    g_mutex_lock(&jobs_lock);
+    for (GList *link = jobs.tail; link; link = link->prev) {
+        DaemonJob *job = link->data;
+        gchar *status = !job->finished                ? g_strdup("running")
+                        : WIFSIGNALED(job->status) ? g_strdup_printf("signal %d", WTERMSIG(job->status))
+                                                      : g_strdup_printf("exit %d", WEXITSTATUS(job->status));
+        gint64 end = job->finished ? job->end_us : g_get_real_time();
+        g_string_append_printf(out, "%d\t%s\t%s\t%.2f\t%s\t%s\n", job->pid, job->kind, status,
+                               (end - job->start_us) / 1e6, job->title, job->command);
+        g_free(status);
+    }
+    g_mutex_unlock(&jobs_lock);
+}
+
+static void serve_status(GString *out) {
+    g_mutex_lock(&index_lock);
+    g_string_append_printf(out, "root\t%s\nfiles\t%u\nwalking\t%d\n", options->root,
+                           daemon_index ? daemon_index->live : 0, index_walking);
+    g_mutex_unlock(&index_lock);
+    g_mutex_lock(&subscribers_lock);
+    g_string_append_printf(out, "subscribers\t%u\n", subscribers->len);
+    g_mutex_unlock(&subscribers_lock);
+    g_mutex_lock(&listings_lock);
+    g_string_append_printf(out, "listings\t%u\t%" G_GSIZE_FORMAT "\n", g_hash_table_size(listings), listings_bytes);
+    g_mutex_unlock(&listings_lock);
+}
+
+// Acknowledges the subscription and hands the connection to the main loop,
+// which streams broadcast lines to it from then on.
+static void serve_subscribe(DaemonClient *client) {
+    gchar *ack = g_strdup_printf("fifo\t%s\n\n", jobs_fifo_path ? jobs_fifo_path : "");
+    gboolean open = send_all(client->fd, ack, strlen(ack));
+    g_free(ack);
+    if (!open) {
+        return;
+    }
+
+    DaemonSubscriber *subscriber = g_new0(DaemonSubscriber, 1);
+    subscriber->fd = client->fd;
+    subscriber->pending = g_string_new(NULL);
+    client->fd = -1;
+    g_idle_add(subscriber_start, subscriber);
+}
+
+// Returns FALSE once the connection has turned into a subscription.
+static gboolean serve_request(DaemonClient *client, const char *line) {
+    gchar **fields = g_strsplit(line, "\t", -1);
+    guint n = g_strv_length(fields);
+    GString *out = g_string_new(NULL);
+    gboolean more = TRUE;
+    TRACE_START(trace_start);
+
+    if ((n == 2 && strcmp(fields[0], "list") == 0) || (n == 3 && strcmp(fields[0], "build") == 0)) {
+        if (!g_path_is_absolute(fields[1])) {
+            reply_error(out, EINVAL, "DIR must be an absolute path");
+        } else if (n == 2) {
+            serve_list(fields[1], out);
+        } else {
+            serve_build(fields[1], fields[2], out);
+        }
+    } else if (n == 2 && strcmp(fields[0], "find") == 0) {
+        serve_find(client, fields[1], out);
+    } else if (n == 1 && strcmp(fields[0], "paths") == 0) {
+        serve_paths(out);
+    } else if (n == 3 && strcmp(fields[0], "search") == 0) {
+        serve_search(fields[1], fields[2], out);
+    } else if (n == 1 && strcmp(fields[0], "jobs") == 0) {
+        serve_jobs(out);
+    } else if (n == 1 && strcmp(fields[0], "status") == 0) {
+        serve_status(out);
+    } else if (n == 1 && strcmp(fields[0], "subscribe") == 0) {
+        more = FALSE;
+    } else {
+        reply_error(out, EINVAL, "unknown request");
+    }
+    TRACE_END(trace_start, "daemon", fields[0], n > 1 ? fields[1] : NULL);
+
+    if (more) {
+        g_string_append_c(out, '\n');
+        more = send_all(client->fd, out->str, out->len);
+    } else {
+        serve_subscribe(client);
+    }
+    g_string_free(out, TRUE);
+    g_strfreev(fields);
+    return more;
+}
+
+static void client_free(DaemonClient *client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    g_string_free(client->in, TRUE);
+    if (client->matches) {
+        g_array_free(client->matches, TRUE);
+    }
+    g_free(client->last_query);
+    g_free(client);
+}
+
+static gboolean on_client_readable(gint fd __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data) {
+    g_thread_pool_push(client_pool, data, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+// Serves the complete requests that have arrived, then hands the connection
+// back to the main loop to wait for more.
+static void client_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    DaemonClient *client = data;
+    char buf[4096];
+    ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    gboolean more = n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR));
+
+    if (n > 0) {
+        g_string_append_len(client->in, buf, n);
+        gchar *newline;
+        while (more && (newline = memchr(client->in->str, '\n', client->in->len)) != NULL) {
+            *newline = '\0';
+            more = serve_request(client, client->in->str);
+            g_string_erase(client->in, 0, newline + 1 - client->in->str);
+        }
+        more = more && client->in->len < DAEMON_MAX_REQUEST;
+    }
+
+    if (more) {
+        g_unix_fd_add(client->fd, G_IO_IN | G_IO_HUP | G_IO_ERR, on_client_readable, client);
+    } else {
+        client_free(client);
+    }
+}
+
+// A client that stops reading its replies holds a pool thread for at most
+// DAEMON_CLIENT_SEND_TIMEOUT_S.
+static gboolean on_accept(GIOChannel *source, GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    int fd = accept4(g_io_channel_unix_get_fd(source), NULL, NULL, SOCK_CLOEXEC);
+    if (fd >= 0) {
+        struct timeval timeout = {.tv_sec = DAEMON_CLIENT_SEND_TIMEOUT_S};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        DaemonClient *client = g_new0(DaemonClient, 1);
+        client->fd = fd;
+        client->in = g_string_new(NULL);
+        g_unix_fd_add(fd, G_IO_IN | G_IO_HUP | G_IO_ERR, on_client_readable, client);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_quit_signal(gpointer data __attribute__((unused))) {
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+static int listen_socket(void) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        g_printerr("Daemon socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+
+    // A socket nobody answers on is left over from a daemon that died.
+    int existing = daemon_connect();
+    if (existing >= 0) {
+        close(existing);
+        g_printerr("A codews daemon is already running on %s\n", socket_path);
+        return -1;
+    }
+    unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        g_printerr("Failed to listen on %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// The FIFO is opened read-write so it never reports EOF between jobs.
+static void jobs_init(void) {
+    gchar *path = g_build_filename(g_get_user_runtime_dir(), "codews", "daemon-jobs.fifo", NULL);
+    unlink(path);
+    if (mkfifo(path, 0600) != 0 || (jobs_fifo_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        g_printerr("Job accounting disabled, cannot create %s: %s\n", path, strerror(errno));
+        unlink(path);
+        g_free(path);
+        return;
+    }
+    jobs_fifo_path = path;
+    jobs_buffer = g_string_new(NULL);
+
+    GIOChannel *channel = g_io_channel_unix_new(jobs_fifo_fd);
+    g_io_add_watch(channel, G_IO_IN, on_jobs_fifo_event, NULL);
+    g_io_channel_unref(channel);
+}
+
+int daemon_main(const DaemonOptions *daemon_options) {
+    options = daemon_options;
+    gchar *runtime_dir = g_build_filename(g_get_user_runtime_dir(), "codews", NULL);
+    g_mkdir_with_parents(runtime_dir, 0700);
+    g_free(runtime_dir);
+
+    socket_path = daemon_socket_path();
+    int listen_fd = listen_socket();
+    if (listen_fd < 0) {
+        return EXIT_FAILURE;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        perror("inotify_init");
+        close(listen_fd);
+        unlink(socket_path);
+        return EXIT_FAILURE;
+    }
+
+    loop = g_main_loop_new(NULL, FALSE);
+    real_root = realpath(options->root, NULL);
+    subscribers = g_ptr_array_new();
+    listings = g_hash_table_new(g_str_hash, g_str_equal);
+    parked_events = g_byte_array_new();
+    walk_pool = g_thread_pool_new(walk_worker, NULL, 1, FALSE, NULL);
+    client_pool = g_thread_pool_new(client_worker, NULL, DAEMON_CLIENT_THREADS, FALSE, NULL);
+    jobs_init();
+
+    GIOChannel *channel = g_io_channel_unix_new(inotify_fd);
+    g_io_add_watch(channel, G_IO_IN, on_inotify_event, NULL);
+    g_io_channel_unref(channel);
+    channel = g_io_channel_unix_new(listen_fd);
+    g_io_add_watch(channel, G_IO_IN, on_accept, NULL);
+    g_io_channel_unref(channel);
+    g_unix_signal_add(SIGTERM, on_quit_signal, NULL);
+    g_unix_signal_add(SIGINT, on_quit_signal, NULL);
+
+    // Serve the previous session's paths while the real walk runs.
+    daemon_index = path_index_load(options->root, options->index_cache_path);
+    start_walk(NULL);
+    g_print("codews daemon serving %s on %s\n", options->root, socket_path);
+    g_main_loop_run(loop);
+
+    close(listen_fd);
+    unlink(socket_path);
+    if (jobs_fifo_path) {
+        unlink(jobs_fifo_path);
+    }
+    g_mutex_lock(&index_lock);
+    if (daemon_index && index_dirty && !index_walking) {
+        path_index_save(daemon_index, options->root, options->index_cache_path);
+    }
+    g_mutex_unlock(&index_lock);
+    return EXIT_SUCCESS;
+}
+
+static void set_timeouts(int fd, int seconds) {
+    struct timeval timeout = {.tv_sec = seconds};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// A daemon that stops answering fails a request after
+// DAEMON_REQUEST_TIMEOUT_S instead of hanging the window that asked.
+int daemon_connect(void) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    gchar *path = daemon_socket_path();
+    gboolean fits = strlen(path) < sizeof(addr.sun_path);
+    g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    g_free(path);
+
+    int fd = fits ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd >= 0) {
+        set_timeouts(fd, DAEMON_REQUEST_TIMEOUT_S);
+    }
+    return fd;
+}
+
+// Sends one request and returns its reply without the closing empty line,
+// or NULL if the connection failed or timed out; the connection can't be
+// used after that. Error replies are returned as they are.
+GString *daemon_request(int fd, const char *const *fields) {
+    GString *request = g_string_new(NULL);
+    for (guint i = 0; fields[i]; i++) {
+        if (strpbrk(fields[i], "\t\n")) {
+            g_string_free(request, TRUE);
+            return NULL;
+        }
+        if (i > 0) {
+            g_string_append_c(request, '\t');
+        }
+        g_string_append(request, fields[i]);
+    }
+    g_string_append_c(request, '\n');
+    gboolean sent = send_all(fd, request->str, request->len);
+    g_string_free(request, TRUE);
+    if (!sent) {
+        return NULL;
+    }
+
+    // Lines are never empty, so the reply ends at the first blank line.
+    GString *reply = g_string_new(NULL);
+    char buf[65536];
+    ssize_t n;
+    while (!(reply->len == 1 && reply->str[0] == '\n') &&
+           !(reply->len >= 2 && reply->str[reply->len - 1] == '\n' && reply->str[reply->len - 2] == '\n')) {
+        n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            g_string_free(reply, TRUE);
+            return NULL;
+        }
+        g_string_append_len(reply, buf, n);
+    }
+    g_string_truncate(reply, reply->len - 1);
+    return reply;
+}
+
+// Opens a subscription and returns its fd, positioned at the first streamed
+// line. The acknowledgement is read a byte at a time so that nothing of the
+// stream behind it is consumed.
+int daemon_subscribe(gchar **fifo_path) {
+    int fd = daemon_connect();
+    if (fd < 0 || !send_all(fd, "subscribe\n", strlen("subscribe\n"))) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    GString *ack = g_string_new(NULL);
+    char byte;
+    while (!(ack->len >= 2 && ack->str[ack->len - 1] == '\n' && ack->str[ack->len - 2] == '\n')) {
+        if (read(fd, &byte, 1) != 1) {
+            g_string_free(ack, TRUE);
+            close(fd);
+            return -1;
+        }
+        g_string_append_c(ack, byte);
+    }
+    g_string_truncate(ack, ack->len - 2);
+    *fifo_path = g_str_has_prefix(ack->str, "fifo\t") && ack->str[5] ? g_strdup(ack->str + 5) : NULL;
+    g_string_free(ack, TRUE);
+    return fd;
+}
+
+static void thread_connection_close(gpointer data) {
+    close(GPOINTER_TO_INT(data) - 1);
+}
+
+// Each thread that asks keeps its connection (fd + 1) for the next request.
+static GPrivate thread_connection = G_PRIVATE_INIT(thread_connection_close);
+
+// daemon_request() on the calling thread's connection. A kept connection may
+// have outlived its daemon, so a failure gets one more try on a fresh one.
+// Returns NULL when the daemon can't be reached.
+GString *daemon_thread_request(const char *const *fields) {
+    GString *reply = NULL;
+    for (gint attempt = 0; attempt < 2 && reply == NULL; attempt++) {
+        int fd = GPOINTER_TO_INT(g_private_get(&thread_connection)) - 1;
+        if (fd < 0) {
+            fd = daemon_connect();
+            if (fd < 0) {
+                return NULL;
+            }
+            g_private_set(&thread_connection, GINT_TO_POINTER(fd + 1));
+        }
+        reply = daemon_request(fd, fields);
+        if (reply == NULL) {
+            g_private_replace(&thread_connection, NULL);
+        }
+    }
+    return reply;
+}
+
+// list_directory() answered by the daemon, from its cache when it can.
+// Returns -1 when there is no daemon to ask.
+int daemon_list_directory(const char *dir, GCancellable *cancellable, EntryFunc func, gpointer user_data) {
+    const char *fields[] = {"list", dir, NULL};
+    GString *reply = daemon_thread_request(fields);
+    if (reply == NULL) {
+        return -1;
+    }
+    if (g_str_has_prefix(reply->str, "error\t")) {
+        int error = atoi(reply->str + strlen("error\t"));
+        g_string_free(reply, TRUE);
+        return error > 0 ? error : EIO;
+    }
+
+    gboolean keep_going = TRUE;
+    for (char *line = reply->str; keep_going && *line && !(cancellable && g_cancellable_is_cancelled(cancellable));) {
+        char *end = strchr(line, '\n');
+        *end = '\0';
+        EntryRecord rec = {0};
+        char *p = line;
+        rec.mode = strtoul(p, &p, 10);
+        rec.size = g_ascii_strtoll(p + 1, &p, 10);
+        rec.mtime = g_ascii_strtoll(p + 1, &p, 10);
+        rec.type = strtoul(p + 1, &p, 10);
+        if (*p == '\t') {
+            keep_going = func(p + 1, &rec, user_data);
+        }
+        line = end + 1;
+    }
+    g_string_free(reply, TRUE);
+    return 0;
+}
+
+// `codews --query REQUEST [FIELD...]` prints the reply, or follows the
+// stream for subscribe.
+int daemon_query_main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s --query list DIR | find QUERY | paths | search FLAGS TEXT |\n"
+                        "       build DIR COMMAND | jobs | status | subscribe\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int fd = daemon_connect();
+    if (fd < 0) {
+        fprintf(stderr, "codews: no daemon is running; start one with codews --daemon\n");
+        return EXIT_FAILURE;
+    }
+    // Whoever runs a query can wait for a search or a stream.
+    set_timeouts(fd, 0);
+
+    if (strcmp(argv[2], "subscribe") == 0) {
+        char buf[4096];
+        ssize_t n;
+        if (!send_all(fd, "subscribe\n", strlen("subscribe\n"))) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, n, stdout);
+            fflush(stdout);
+        }
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    GString *reply = daemon_request(fd, (const char *const *)argv + 2);
+    close(fd);
+    if (reply == NULL) {
+        fprintf(stderr, "codews: the daemon did not answer\n");
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    if (g_str_has_prefix(reply->str, "error\t")) {
+        const char *message = strchr(reply->str + strlen("error\t"), '\t');
+        fprintf(stderr, "codews: %s", message ? message + 1 : reply->str);
+        status = EXIT_FAILURE;
+    } else {
+        fwrite(reply->str, 1, reply->len, stdout);
+    }
+    g_string_free(reply, TRUE);
+    return status;
+}
@@ -0,0 +1,52 @@
+#ifndef CODEWS_DAEMON_H
+#define CODEWS_DAEMON_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "workspace.h"
+
+// `codews --daemon` keeps one warm file index, its inotify watches, a listing
+// cache and the job history for every window and for `codews --query`.
+//
+// It speaks a line protocol on $XDG_RUNTIME_DIR/codews/daemon.sock. A request
+// is one line of tab-separated fields. A reply is zero or more non-empty lines
+// closed by an empty one; a failure is the single line "error\tERRNO\tTEXT".
+//
+//   list DIR             MODE SIZE MTIME TYPE NAME per entry
+//   find QUERY           "matched\tN\tFILES\tWALKING", then the best paths
+//   paths                every indexed path
+//   search FLAGS TEXT    PATH LINE TEXT per match; FLAGS "c" matches case
+//   build DIR COMMAND    runs COMMAND in DIR as a job, "started\tLOG"
+//   jobs                 PID KIND STATUS SECONDS TITLE COMMAND, newest first
+//   status               a few "key\tvalue" lines
+//   subscribe            "fifo\tPATH", then a stream of "event\tMASK\tDIR\tNAME",
+//                        "job\tLINE" and "rescan" lines for as long as the
+//                        connection stays open
+//
+// DIR in list and build is an absolute path, and a relative one is refused
+// with EINVAL. Every other path, in requests and replies, is relative to the
+// workspace root. Names holding a newline can't be framed and are left out.
+// build writes COMMAND's output to LOG; only the newest few logs are kept.
+
+#define DAEMON_SOCKET_NAME "daemon.sock"
+#define DAEMON_REQUEST_TIMEOUT_S 5
+
+typedef struct {
+    const char *root;
+    gchar **ignore_dirs;
+    const char *index_cache_path;
+    const char *self_exe;  // runs builds through `--job`
+    gsize listing_cache_bytes;
+} DaemonOptions;
+
+int daemon_main(const DaemonOptions *options);
+int daemon_query_main(int argc, char *argv[]);
+
+gchar *daemon_socket_path(void);
+int daemon_connect(void);
+GString *daemon_request(int fd, const char *const *fields);
+GString *daemon_thread_request(const char *const *fields);
+int daemon_subscribe(gchar **fifo_path);
+int daemon_list_directory(const char *dir, GCancellable *cancellable, EntryFunc func, gpointer user_data);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <gtk/gtk.h>
 #include <vte/vte.h>
 #include <sys/inotify.h>
@@ -9,42 +10,1303 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <math.h>
 #include <glib.h>
+#include "workspace.h"
+#include "trace.h"
+#include "daemon.h"
 
 #define FILE_PATH_COLUMN 0
 
-static GtkListStore *store;
+// Directory scans run on a worker and stream rows back in batches. The first
+// batch is kept small so something is on screen within a frame.
+#define SCAN_FIRST_BATCH 64
+#define SCAN_BATCH_SIZE 2048
+#define SCAN_BATCH_INTERVAL_US 30000
+
+// inotify events for the current directory are collected and applied to the
+// store at most once per frame.
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO)
+#define WATCH_FLUSH_INTERVAL_MS 16
+
+#define DELETE_PROGRESS_INTERVAL_MS 100
+
+// Trashed entries are renamed into TRASH_DIR_NAME on the same filesystem and
+// purged by a low-priority thread once they can no longer be undone.
+#define TRASH_CHECK_INTERVAL_S 30
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+// The Ctrl+P finder searches an index of every file under base_dir. Paths are
+// packed into one string arena and each carries a bitmask of the characters
+// it contains, so most entries are rejected with a single AND per keystroke.
+#define FINDER_MAX_RESULTS 100
+
+// Content search runs over the finder's file list in chunks on a thread pool
+// and streams hits back to the results panel as they are found.
+#define SEARCH_CHUNK_FILES 64
+#define SEARCH_BATCH_HITS 256
+#define SEARCH_MAX_HITS 10000
+#define SEARCH_MAX_FILE_SIZE (64 << 20)
+#define SEARCH_BINARY_PROBE 8192
+#define SEARCH_MAX_LINE_TEXT 200
+
+// With the editor server enabled, the first text file starts nvim with
+// --listen and later opens are sent to it as msgpack-rpc requests.
+#define EDITOR_RPC_TIMEOUT_MS 1000
+
+// Opt-in background builds: a save to a C or assembly source starts a quiet,
+// low-priority build into the cache once the saves settle.
+#define SPECULATIVE_DEBOUNCE_MS 750
+
+// Build All runs every project's build on a pool sized to the core count,
+// with a make jobserver shared between them so nested -j builds don't
+// oversubscribe the machine.
+enum {
+    BUILD_ALL_COL_PROJECT,
+    BUILD_ALL_COL_STATUS,
+    BUILD_ALL_COL_DURATION,
+    BUILD_ALL_COL_LOG,
+    BUILD_ALL_COL_FAILED,
+    BUILD_ALL_N_COLUMNS
+};
+
+#define BENCH_DEFAULT_RUNS 10
+#define BENCH_DEFAULT_WARMUP 2
+#define BENCH_HISTORY_SHOWN 5
+
+// Profile builds add these so perf record can walk stacks and name symbols.
+#define PROFILE_C_FLAGS "-g -fno-omit-frame-pointer"
+#define PROFILE_TOP_SYMBOLS 25
+
+// Commands run in terminal tabs go through `codews --job`, which reports
+// their rusage over a FIFO into a ring buffer of the last JOB_HISTORY_SIZE.
+#define JOB_HISTORY_SIZE 256
+#define JOB_COMMAND_MAX 1024
+enum {
+    JOB_COL_TITLE,
+    JOB_COL_KIND,
+    JOB_COL_PID,
+    JOB_COL_STARTED,
+    JOB_COL_DURATION,
+    JOB_COL_STATUS,
+    JOB_COL_CPU,
+    JOB_COL_RSS,
+    JOB_COL_IO,
+    JOB_COL_COMMAND,  // markup-escaped, for the row tooltip
+    JOB_N_COLUMNS
+};
+
+// The workspace tree lists a directory only once its row is expanded. A
+// subtree that stays collapsed for WORKSPACE_TREE_RELEASE_S is dropped back
+// to its placeholder row.
+#define WORKSPACE_TREE_RELEASE_S 60
+#define WORKSPACE_TREE_RELEASE_CHECK_S 15
+#define WORKSPACE_TREE_RELOAD_MS 200
+enum {
+    WORKSPACE_TREE_COL_NAME,
+    WORKSPACE_TREE_COL_REL,
+    WORKSPACE_TREE_COL_STATE,
+    WORKSPACE_TREE_COL_COLLAPSED_AT,
+    WORKSPACE_TREE_N_COLUMNS
+};
+
+typedef enum {
+    WORKSPACE_TREE_FILE,
+    WORKSPACE_TREE_PLACEHOLDER,
+    WORKSPACE_TREE_UNLOADED,  // directory holding only the placeholder
+    WORKSPACE_TREE_LOADING,
+    WORKSPACE_TREE_LOADED
+} WorkspaceTreeState;
+
+// Directory sizes come from a parallel du walk and are then kept current by
+// rescanning just the directories the index's watches report as changed.
+#define DIR_SIZE_RESCAN_MS 500
+
+// Git status runs per repository on a worker thread. After the first full run
+// only the paths the index's watches report are rechecked, unless there are
+// more of them than fit on one command line.
+#define GIT_STATUS_REFRESH_MS 200
+#define GIT_STATUS_MAX_PATHSPECS 256
+
+#define SESSION_MAGIC "CWSSES01"
+
+// User settings, read once from $XDG_CONFIG_HOME/codews/codews.conf.
+typedef struct {
+    gint listing_cache_mb;
+    gint trash_grace_seconds;
+    gchar **ignore_dirs;
+    gboolean editor_server;
+    gint terminal_pool_size;
+    gboolean terminal_reuse;
+    gboolean build_cache;
+    gboolean speculative_builds;
+    gboolean profile_builds;
+    gboolean job_cgroup;
+    gchar *job_memory_max;
+    gchar *job_cpu_quota;
+    gint listing_sort;  // DirSortMode
+    gboolean listing_dirs_first;
+    gboolean listing_dir_sizes;
+    gboolean listing_git_status;
+} Settings;
+
+static Settings settings = {
+    .listing_cache_mb = 64,
+    .trash_grace_seconds = 300,
+    .editor_server = TRUE,
+    .terminal_pool_size = 2,
+    .terminal_reuse = TRUE,
+    .build_cache = TRUE,
+    .listing_dirs_first = TRUE,
+    .listing_git_status = TRUE,
+};
+
+typedef struct {
+    guint generation;
+    GArray *records;
+    GString *names;
+    gboolean done;
+    gboolean from_cache;
+    int error;
+} EntryBatch;
+
+typedef struct {
+    guint generation;
+    gchar *dir;
+    GCancellable *cancellable;
+    EntryBatch *batch;  // being filled by the worker
+    guint batch_limit;
+    gint64 last_flush;
+} ScanJob;
+
+// A parsed listing kept after leaving a directory. The key is the directory's
+// (dev, inode); the timestamps tell whether the listing is still current.
+// They miss a chmod or rewrite of an entry, so the directory is also watched
+// for as long as it is cached.
+typedef struct {
+    guint64 dev;
+    guint64 ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    int wd;
+    GArray *records;
+    GString *names;
+    gsize bytes;
+    GList *link;
+} ListingCacheEntry;
+
+// The session file is read in place through mmap. The header is followed by
+// the listed directory's records, its name arena, and then NUL-terminated
+// strings: the directory, the name of the top visible row, the selected names,
+// and kind, title and working directory for every terminal tab.
+typedef struct {
+    char magic[8];
+    guint64 dev;  // of the listed directory when it was scanned; 0 if unfinished
+    guint64 ino;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+    gint64 ctime_sec;
+    gint64 ctime_nsec;
+    guint32 record_count;
+    guint32 names_length;
+    guint32 selected_count;
+    guint32 tab_count;
+    guint32 strings_length;
+    guint32 reserved;
+} SessionHeader;
+
+G_STATIC_ASSERT(sizeof(SessionHeader) % 8 == 0);
+
+typedef struct {
+    const SessionHeader *header;
+    gsize length;
+    const EntryRecord *records;
+    const char *names;
+    const char *dir;
+    const char *top;
+    const char *selected;  // selected_count strings
+    const char *tabs;      // tab_count (kind, title, cwd) triples
+} Session;
+
+// Checks the painted snapshot against the directory once the window is up.
+typedef struct {
+    guint generation;
+    gchar *dir;
+    SessionHeader header;
+    struct stat st;
+    gboolean ok;
+    gint64 trace_started;
+} SessionCheck;
+
+typedef struct {
+    gchar *original_path;
+    gchar *trash_path;
+    gint64 trashed_at;
+} TrashItem;
+
+// A terminal tab. kind groups tabs for reuse ("build", "run", "editor"...)
+// and is NULL while the terminal is still waiting in the pool.
+typedef struct {
+    VteTerminal *terminal;
+    GtkWidget *label;
+    GPid shell_pid;
+    gchar *kind;
+    gint64 spawn_started;  // for the trace
+} TerminalTab;
+
+typedef enum {
+    INDEX_JOB_FULL,
+    INDEX_JOB_SUBTREE,
+    INDEX_JOB_CACHED,
+} IndexJobKind;
+
+typedef struct {
+    IndexJobKind kind;
+    guint generation;
+    gchar *root;
+    gchar *prefix;
+    gboolean load_cache;
+    PathIndex *index;
+} IndexJob;
+
+typedef struct {
+    gchar *key;
+    gchar *target_id;
+    gchar *record;     // toolchain, command and input digests, one per line
+} BuildKey;
+
+typedef struct {
+    gchar *target;  // project directory, or source file for assembly
+    gchar *dir;
+    gchar *build;
+    gchar *run;     // NULL when building is all there is to do
+    gchar *input;   // the source of an assembly build; C collects the project's
+    const char *const *tools;
+    BuildKey *key;  // NULL until build_plan_compute_key(), or with the cache off
+} BuildPlan;
+
+// A build waiting for its cache key and, for Ctrl+R, a possible restore.
+// Both read every input, so they run on build_plan_pool.
+typedef struct {
+    BuildPlan *plan;
+    gboolean speculative;
+    gchar *title;
+    gchar *command;  // NULL when a speculative build is already cached
+} BuildPlanJob;
+
+typedef struct {
+    gint refs;
+    GCancellable *cancellable;
+    int jobserver[2];
+    gint64 started;
+    guint total;
+    guint finished;
+    guint failed;
+} BuildAllRun;
+
+typedef struct {
+    BuildAllRun *run;
+    guint row;
+    gchar *path;
+    const char *language;
+    gchar *status;
+    gchar *log;
+    gint64 duration_us;
+    gboolean ok;
+    gboolean cancelled;
+} BuildAllProject;
+
+typedef struct {
+    gdouble wall;
+    gdouble user;
+    gdouble sys;
+    glong max_rss_kb;
+} BenchSample;
+
+typedef struct {
+    gchar *path;
+    gchar **argv;       // the executable followed by its arguments
+    gchar *stdin_path;  // NULL for /dev/null
+    gint runs;
+    gint warmup;
+    GArray *samples;    // BenchSample, warmup runs excluded
+    int last_status;
+    gchar *error;
+} BenchJob;
+
+typedef struct {
+    gchar *path;
+    gboolean record;  // perf record instead of perf stat
+    gboolean ok;
+    gchar *report;
+} ProfileJob;
+
+typedef struct {
+    pid_t pid;
+    gchar *kind;
+    gchar *title;
+    gchar *command;
+    gint64 start_us;   // wall clock
+    gint64 end_us;
+    int status;
+    gint64 user_us;
+    gint64 sys_us;
+    gint64 max_rss_kb;
+    gint64 in_blocks;  // filesystem I/O, 512-byte blocks
+    gint64 out_blocks;
+    gboolean finished;
+} JobRecord;
+
+typedef struct {
+    gchar *rel;        // directory relative to base_dir, "" for the root
+    GArray *records;   // EntryRecord, sorted, names in the arena below
+    GString *names;
+    int error;
+} WorkspaceTreeLoad;
+
+// Directory totals for the listing's size column, keyed by path relative to
+// base_dir. The identity fields tell whether the directory is still the one
+// that was measured.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    guint64 own;    // the directory itself and the files directly inside
+    guint64 total;  // own plus every subdirectory's total
+    gboolean unwatched;  // the subtree holds a directory the index doesn't watch
+} DirSize;
+
+typedef struct {
+    gchar *rel;
+    struct stat st;
+    guint64 own;
+    guint64 total;
+    gboolean root;
+} DirSizeResult;
+
+typedef struct {
+    gchar *rel;
+    struct stat st;
+    guint64 own;
+    GPtrArray *subdirs;  // DuSubdir
+    int error;
+    gboolean revisit;  // the listing asked for it, rather than a change
+} DirSizeScan;
+
+// Ordered so that a directory can show the strongest state found below it.
+typedef enum {
+    GIT_STATUS_CLEAN,
+    GIT_STATUS_IGNORED,
+    GIT_STATUS_UNTRACKED,
+    GIT_STATUS_MODIFIED
+} GitStatus;
+
+typedef struct {
+    gchar *root;          // the work tree
+    GHashTable *paths;    // repo-relative path -> GitStatus; collapsed directories end in '/'
+    GHashTable *dirs;     // repo-relative directory -> strongest GitStatus below it
+    GHashTable *changed;  // repo-relative paths to recheck
+    gboolean loaded;
+    gboolean running;
+    gboolean full_pending;
+    gboolean failed;      // git can't be run here; stop asking
+} GitRepo;
+
+typedef struct {
+    GitRepo *repo;
+    GPtrArray *pathspecs;  // NULL for the whole work tree
+    gchar *output;
+    gboolean ok;
+} GitStatusJob;
+
+typedef struct {
+    gint refs;
+    gchar *root;
+    gchar *pattern;
+    gboolean match_case;
+    GRegex *regex;  // NULL for a literal search
+    GCancellable *cancellable;
+    GString *paths;       // NULL until a daemon search has fetched its file list
+    GArray *offsets;
+    gint chunks_pending;
+    gint hit_count;
+    gboolean unindexed;   // the daemon had no file list to give
+} SearchJob;
+
+typedef struct {
+    SearchJob *job;
+    guint first;
+    guint last;
+} SearchChunk;
+
+typedef struct {
+    gint generation;
+    gchar *query;
+    GString *reply;    // NULL when the daemon didn't answer
+    gboolean lost;     // nor could it be reached again
+    gint64 elapsed;
+} FinderRequest;
+
+typedef struct {
+    gchar *path;
+    gint line;
+    gchar *text;
+} SearchHit;
+
+typedef struct {
+    SearchJob *job;
+    GPtrArray *hits;
+    gboolean done;
+} SearchBatch;
+
+enum {
+    SEARCH_COL_LOCATION,
+    SEARCH_COL_PATH,
+    SEARCH_COL_LINE,
+    SEARCH_N_COLUMNS
+};
+
+// DirModel is a flat GtkTreeModel over the current listing. Entries live in a
+// contiguous record array with their names packed into one string arena, and
+// an open-addressing table maps names to records, so adding or updating a row
+// allocates nothing per entry.
+//
+// Each name in the arena is followed by its filename collation key, computed
+// once when the entry is scanned. The visible rows are a sorted, filtered
+// permutation of the records; sorting compares a 64-bit prefix of the keys
+// first and only falls back to the key bytes on a tie.
+enum {
+    DIR_MODEL_COL_NAME,
+    DIR_MODEL_COL_MODE,
+    DIR_MODEL_COL_SIZE,
+    DIR_MODEL_COL_MTIME,
+    DIR_MODEL_N_COLUMNS
+};
+
+#define DIR_MODEL_FREE_RECORD G_MAXUINT32
+#define DIR_MODEL_REMOVED_ROW G_MAXUINT32
+#define DIR_MODEL_MIN_INDEX 64
+#define DIR_MODEL_COMPACT_BYTES 65536
+
+typedef enum {
+    DIR_SORT_NAME,   // natural order, so file9 comes before file10
+    DIR_SORT_SIZE,   // largest first
+    DIR_SORT_MTIME,  // newest first
+    DIR_SORT_TYPE,   // by extension
+    DIR_SORT_N_MODES
+} DirSortMode;
+
+static const char *const listing_sort_names[DIR_SORT_N_MODES] = {"name", "size", "mtime", "type"};
+static const char *const listing_sort_labels[DIR_SORT_N_MODES] = {"Name", "Size", "Modified", "Type"};
+
+#define DIR_TYPE_MODEL (dir_model_get_type())
+G_DECLARE_FINAL_TYPE(DirModel, dir_model, DIR, MODEL, GObject)
+
+struct _DirModel {
+    GObject parent_instance;
+    gint stamp;
+    GArray *records;       // EntryRecord; freed slots have name_offset == DIR_MODEL_FREE_RECORD
+    GArray *free_records;  // guint32 indices of freed slots
+    GString *names;        // NUL-terminated names, referenced by name_offset
+    gsize dead_bytes;      // arena bytes owned by removed entries
+    GArray *rows;          // guint32 record index for each visible row, or DIR_MODEL_REMOVED_ROW
+    guint removed_rows;    // rows marked removed since the last dir_model_drop_removed()
+    GArray *record_rows;   // guint32 row + 1 per record, 0 when it isn't shown
+    guint sorted_rows;     // rows past this were appended since the last sort
+    GArray *sort_prefixes; // guint64 per record: first key bytes, big-endian
+    DirSortMode sort_mode;
+    gboolean dirs_first;
+    gchar *filter;         // case-insensitive substring, NULL shows everything
+    guint32 *index;        // record index + 1 per slot, 0 when empty
+    guint index_size;
+    guint index_used;
+};
+
+static void dir_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(DirModel, dir_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, dir_model_tree_model_init))
+
+static inline EntryRecord *dir_model_record(DirModel *model, guint32 record) {
+    return &g_array_index(model->records, EntryRecord, record);
+}
+
+static inline const char *dir_model_record_name(DirModel *model, guint32 record) {
+    return model->names->str + dir_model_record(model, record)->name_offset;
+}
+
+static inline guint32 dir_model_row_record(DirModel *model, guint row) {
+    return g_array_index(model->rows, guint32, row);
+}
+
+// Scanned entries are stored as "name\0collation key\0".
+static inline gsize entry_arena_length(const char *name) {
+    gsize name_length = strlen(name) + 1;
+    return name_length + strlen(name + name_length) + 1;
+}
+
+static inline const char *dir_model_record_key(DirModel *model, guint32 record) {
+    const char *name = dir_model_record_name(model, record);
+    return name + strlen(name) + 1;
+}
+
+static guint64 dir_model_key_prefix(const char *key) {
+    guint64 prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (*key) {
+            prefix |= (guchar)*key++;
+        }
+    }
+    return prefix;
+}
+
+static const char *dir_model_extension(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return dot && dot != name ? dot + 1 : "";
+}
+
+// A total order: ties on the sort mode fall back to the name, then to the
+// record, so rows never compare equal.
+static gint dir_model_compare(DirModel *model, guint32 a, guint32 b) {
+    const EntryRecord *ra = dir_model_record(model, a), *rb = dir_model_record(model, b);
+
+    if (model->dirs_first && S_ISDIR(ra->mode) != S_ISDIR(rb->mode)) {
+        return S_ISDIR(ra->mode) ? -1 : 1;
+    }
+    switch (model->sort_mode) {
+    case DIR_SORT_SIZE:
+        if (ra->size != rb->size) {
+            return ra->size > rb->size ? -1 : 1;
+        }
+        break;
+    case DIR_SORT_MTIME:
+        if (ra->mtime != rb->mtime) {
+            return ra->mtime > rb->mtime ? -1 : 1;
+        }
+        break;
+    case DIR_SORT_TYPE: {
+        gint cmp = g_ascii_strcasecmp(dir_model_extension(dir_model_record_name(model, a)),
+                                      dir_model_extension(dir_model_record_name(model, b)));
+        if (cmp != 0) {
+            return cmp;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    guint64 pa = g_array_index(model->sort_prefixes, guint64, a);
+    guint64 pb = g_array_index(model->sort_prefixes, guint64, b);
+    if (pa != pb) {
+        return pa < pb ? -1 : 1;
+    }
+    gint cmp = strcmp(dir_model_record_key(model, a), dir_model_record_key(model, b));
+    if (cmp == 0) {
+        cmp = strcmp(dir_model_record_name(model, a), dir_model_record_name(model, b));
+    }
+    return cmp != 0 ? cmp : (a < b ? -1 : a > b);
+}
+
+static gint dir_model_compare_records(gconstpointer a, gconstpointer b, gpointer data) {
+    return dir_model_compare(data, *(const guint32 *)a, *(const guint32 *)b);
+}
+
+static gint dir_model_compare_rows(gconstpointer a, gconstpointer b, gpointer data) {
+    DirModel *model = data;
+    return dir_model_compare(model, dir_model_row_record(model, *(const gint *)a),
+                             dir_model_row_record(model, *(const gint *)b));
+}
+
+static gboolean dir_model_matches(DirModel *model, guint32 record) {
+    return model->filter == NULL || strcasestr(dir_model_record_name(model, record), model->filter) != NULL;
+}
+
+static guint dir_model_index_probe(DirModel *model, const char *name) {
+    guint mask = model->index_size - 1;
+    for (guint slot = g_str_hash(name) & mask;; slot = (slot + 1) & mask) {
+        guint32 value = model->index[slot];
+        if (value == 0 || strcmp(dir_model_record_name(model, value - 1), name) == 0) {
+            return slot;
+        }
+    }
+}
+
+static void dir_model_index_resize(DirModel *model, guint size) {
+    g_free(model->index);
+    model->index = g_new0(guint32, size);
+    model->index_size = size;
+    for (guint32 i = 0; i < model->records->len; i++) {
+        if (dir_model_record(model, i)->name_offset != DIR_MODEL_FREE_RECORD) {
+            model->index[dir_model_index_probe(model, dir_model_record_name(model, i))] = i + 1;
+        }
+    }
+}
+
+// Linear-probing delete: pull later members of the cluster back into the hole
+// so lookups never need tombstones.
+static void dir_model_index_remove_slot(DirModel *model, guint hole) {
+    guint mask = model->index_size - 1;
+    model->index[hole] = 0;
+    for (guint slot = (hole + 1) & mask; model->index[slot] != 0; slot = (slot + 1) & mask) {
+        guint home = g_str_hash(dir_model_record_name(model, model->index[slot] - 1)) & mask;
+        gboolean stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+        if (!stays) {
+            model->index[hole] = model->index[slot];
+            model->index[slot] = 0;
+            hole = slot;
+        }
+    }
+    model->index_used--;
+}
+
+static void dir_model_compact_names(DirModel *model) {
+    GString *names = g_string_sized_new(model->names->len - model->dead_bytes);
+    for (guint32 i = 0; i < model->records->len; i++) {
+        EntryRecord *rec = dir_model_record(model, i);
+        if (rec->name_offset != DIR_MODEL_FREE_RECORD) {
+            const char *name = model->names->str + rec->name_offset;
+            rec->name_offset = names->len;
+            g_string_append_len(names, name, entry_arena_length(name));
+        }
+    }
+    g_string_free(model->names, TRUE);
+    model->names = names;
+    model->dead_bytes = 0;
+}
+
+static gint dir_model_find_row(DirModel *model, guint32 record) {
+    return (gint)g_array_index(model->record_rows, guint32, record) - 1;
+}
+
+// Brings record_rows up to date for every row from the given one on.
+static void dir_model_renumber(DirModel *model, guint from) {
+    for (guint row = from; row < model->rows->len; row++) {
+        g_array_index(model->record_rows, guint32, dir_model_row_record(model, row)) = row + 1;
+    }
+}
+
+static void dir_model_emit(DirModel *model, guint row, gboolean inserted) {
+    GtkTreeIter iter = { .stamp = model->stamp, .user_data = GUINT_TO_POINTER(row) };
+    GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+    if (inserted) {
+        gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+    } else {
+        gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, &iter);
+    }
+    gtk_tree_path_free(path);
+}
+
+static void dir_model_append_row(DirModel *model, guint32 record) {
+    g_array_append_val(model->rows, record);
+    g_array_index(model->record_rows, guint32, record) = model->rows->len;
+    dir_model_emit(model, model->rows->len - 1, TRUE);
+}
+
+// Only marks the row; dir_model_drop_removed() takes a batch of them out in
+// one pass instead of shifting the rows after each.
+static void dir_model_remove_row(DirModel *model, guint row) {
+    g_array_index(model->record_rows, guint32, dir_model_row_record(model, row)) = 0;
+    g_array_index(model->rows, guint32, row) = DIR_MODEL_REMOVED_ROW;
+    model->removed_rows++;
+}
+
+// Compacts away the marked rows, then tells the view about them from the
+// last one up, so each deleted path still names the row it did before.
+static void dir_model_drop_removed(DirModel *model) {
+    if (model->removed_rows == 0) {
+        return;
+    }
+    guint n = model->rows->len, kept = 0, sorted = 0;
+    GArray *removed = g_array_sized_new(FALSE, FALSE, sizeof(guint), model->removed_rows);
+    for (guint row = 0; row < n; row++) {
+        guint32 record = dir_model_row_record(model, row);
+        if (record == DIR_MODEL_REMOVED_ROW) {
+            g_array_append_val(removed, row);
+            continue;
+        }
+        if (row < model->sorted_rows) {
+            sorted++;
+        }
+        g_array_index(model->rows, guint32, kept) = record;
+        g_array_index(model->record_rows, guint32, record) = ++kept;
+    }
+    g_array_set_size(model->rows, kept);
+    model->sorted_rows = sorted;
+    model->removed_rows = 0;
+
+    for (guint i = removed->len; i-- > 0;) {
+        GtkTreePath *path = gtk_tree_path_new_from_indices(g_array_index(removed, guint, i), -1);
+        gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+        gtk_tree_path_free(path);
+    }
+    g_array_free(removed, TRUE);
+}
+
+// Whether an updated row still sits between its neighbours, skipping rows
+// that are marked removed.
+static gboolean dir_model_row_in_order(DirModel *model, guint row) {
+    if (row >= model->sorted_rows) {
+        return TRUE;
+    }
+    guint32 record = dir_model_row_record(model, row);
+    guint before = row, after = row + 1;
+    while (before > 0 && dir_model_row_record(model, before - 1) == DIR_MODEL_REMOVED_ROW) {
+        before--;
+    }
+    while (after < model->sorted_rows && dir_model_row_record(model, after) == DIR_MODEL_REMOVED_ROW) {
+        after++;
+    }
+    return (before == 0 || dir_model_compare(model, dir_model_row_record(model, before - 1), record) < 0) &&
+           (after >= model->sorted_rows || dir_model_compare(model, record, dir_model_row_record(model, after)) < 0);
+}
+
+// Drops the rows removed since the last call, then sorts the ones appended
+// and merges them into the sorted ones, so a batch costs a sort of the batch
+// plus linear passes, and the view gets a single rows-reordered signal.
+static void dir_model_sort_pending(DirModel *model) {
+    dir_model_drop_removed(model);
+    guint n = model->rows->len, head = model->sorted_rows;
+    if (head == n) {
+        return;
+    }
+
+    gint *tail = g_new(gint, n - head);
+    for (guint i = head; i < n; i++) {
+        tail[i - head] = i;
+    }
+    g_qsort_with_data(tail, n - head, sizeof(gint), dir_model_compare_rows, model);
+
+    gint *new_order = g_new(gint, n);
+    guint32 *records = g_new(guint32, n);
+    gboolean moved = FALSE;
+    for (guint i = 0, j = 0, k = 0; k < n; k++) {
+        gint row;
+        if (j == n - head || (i < head && dir_model_compare(model, dir_model_row_record(model, i),
+                                                            dir_model_row_record(model, tail[j])) < 0)) {
+            row = i++;
+        } else {
+            row = tail[j++];
+        }
+        new_order[k] = row;
+        records[k] = dir_model_row_record(model, row);
+        moved |= (guint)row != k;
+    }
+    memcpy(model->rows->data, records, n * sizeof(guint32));
+    model->sorted_rows = n;
+    if (moved) {
+        dir_model_renumber(model, 0);
+    }
+
+    if (moved) {
+        GtkTreePath *path = gtk_tree_path_new();
+        gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, new_order);
+        gtk_tree_path_free(path);
+    }
+    g_free(records);
+    g_free(new_order);
+    g_free(tail);
+}
+
+static void dir_model_set_sort(DirModel *model, DirSortMode mode, gboolean dirs_first) {
+    model->sort_mode = mode;
+    model->dirs_first = dirs_first;
+    model->sorted_rows = 0;
+    dir_model_sort_pending(model);
+}
+
+// Rebuilds the visible rows without emitting a signal per row, so the model
+// must be detached from its view around the call. A filter that extends the
+// previous one can only drop rows and keeps the current order.
+static void dir_model_set_filter(DirModel *model, const char *filter) {
+    if (filter && *filter == '\0') {
+        filter = NULL;
+    }
+    gboolean narrowing = filter && model->filter && strcasestr(filter, model->filter) &&
+                         model->sorted_rows == model->rows->len;
+    g_free(model->filter);
+    model->filter = g_strdup(filter);
+
+    if (narrowing) {
+        guint kept = 0;
+        for (guint row = 0; row < model->rows->len; row++) {
+            guint32 record = dir_model_row_record(model, row);
+            if (dir_model_matches(model, record)) {
+                g_array_index(model->rows, guint32, kept++) = record;
+            }
+        }
+        g_array_set_size(model->rows, kept);
+    } else {
+        g_array_set_size(model->rows, 0);
+        for (guint32 i = 0; i < model->records->len; i++) {
+            if (dir_model_record(model, i)->name_offset != DIR_MODEL_FREE_RECORD && dir_model_matches(model, i)) {
+                g_array_append_val(model->rows, i);
+            }
+        }
+        g_array_sort_with_data(model->rows, dir_model_compare_records, model);
+    }
+    memset(model->record_rows->data, 0, model->record_rows->len * sizeof(guint32));
+    dir_model_renumber(model, 0);
+    model->sorted_rows = model->rows->len;
+    model->stamp++;
+}
+
+static DirModel *dir_model_new(void) {
+    return g_object_new(DIR_TYPE_MODEL, NULL);
+}
+
+static void dir_model_clear(DirModel *model) {
+    while (model->rows->len > 0) {
+        guint row = model->rows->len - 1;
+        g_array_set_size(model->rows, row);
+        GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+        gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+        gtk_tree_path_free(path);
+    }
+    model->sorted_rows = 0;
+    model->removed_rows = 0;
+    g_array_set_size(model->records, 0);
+    g_array_set_size(model->record_rows, 0);
+    g_array_set_size(model->sort_prefixes, 0);
+    g_array_set_size(model->free_records, 0);
+    g_string_truncate(model->names, 0);
+    model->dead_bytes = 0;
+    memset(model->index, 0, model->index_size * sizeof(guint32));
+    model->index_used = 0;
+    model->stamp++;
+}
+
+// Inserts an entry or refreshes the existing one with the same name. key is
+// the name's collation key, or NULL to compute it here. New rows are
+// appended unsorted; dir_model_sort_pending() moves them into place.
+static void dir_model_upsert(DirModel *model, const char *name, const char *key, const EntryRecord *values) {
+    guint slot = dir_model_index_probe(model, name);
+    if (model->index[slot] != 0) {
+        guint32 record = model->index[slot] - 1;
+        EntryRecord *rec = dir_model_record(model, record);
+        guint32 name_offset = rec->name_offset;
+        *rec = *values;
+        rec->name_offset = name_offset;
+
+        gint row = dir_model_find_row(model, record);
+        if (row >= 0 && dir_model_row_in_order(model, row)) {
+            dir_model_emit(model, row, FALSE);
+        } else if (row >= 0) {
+            dir_model_remove_row(model, row);
+            dir_model_append_row(model, record);
+        }
+        return;
+    }
+
+    gchar *computed_key = key ? NULL : g_utf8_collate_key_for_filename(name, -1);
+    if (computed_key) {
+        key = computed_key;
+    }
+    EntryRecord rec = *values;
+    rec.name_offset = model->names->len;
+    g_string_append_len(model->names, name, strlen(name) + 1);
+    g_string_append_len(model->names, key, strlen(key) + 1);
+    guint64 prefix = dir_model_key_prefix(key);
+    g_free(computed_key);
+
+    guint32 record;
+    if (model->free_records->len > 0) {
+        record = g_array_index(model->free_records, guint32, model->free_records->len - 1);
+        g_array_set_size(model->free_records, model->free_records->len - 1);
+        *dir_model_record(model, record) = rec;
+        g_array_index(model->sort_prefixes, guint64, record) = prefix;
+    } else {
+        record = model->records->len;
+        g_array_append_val(model->records, rec);
+        g_array_append_val(model->sort_prefixes, prefix);
+        g_array_set_size(model->record_rows, model->records->len);
+    }
+
+    model->index[slot] = record + 1;
+    if (++model->index_used * 2 > model->index_size) {
+        dir_model_index_resize(model, model->index_size * 2);
+    }
+
+    if (dir_model_matches(model, record)) {
+        dir_model_append_row(model, record);
+    }
+}
+
+static void dir_model_remove(DirModel *model, const char *name) {
+    guint slot = dir_model_index_probe(model, name);
+    if (model->index[slot] == 0) {
+        return;
+    }
+    guint32 record = model->index[slot] - 1;
+    dir_model_index_remove_slot(model, slot);
+
+    gint row = dir_model_find_row(model, record);
+    if (row >= 0) {
+        dir_model_remove_row(model, row);
+    }
+
+    EntryRecord *rec = dir_model_record(model, record);
+    model->dead_bytes += entry_arena_length(model->names->str + rec->name_offset);
+    rec->name_offset = DIR_MODEL_FREE_RECORD;
+    g_array_append_val(model->free_records, record);
+
+    if (model->dead_bytes > DIR_MODEL_COMPACT_BYTES && model->dead_bytes * 2 > model->names->len) {
+        dir_model_compact_names(model);
+    }
+}
+
+static const EntryRecord *dir_model_lookup(DirModel *model, const char *name) {
+    guint slot = dir_model_index_probe(model, name);
+    return model->index[slot] ? dir_model_record(model, model->index[slot] - 1) : NULL;
+}
+
+static gint dir_model_lookup_row(DirModel *model, const char *name) {
+    guint slot = dir_model_index_probe(model, name);
+    return model->index[slot] ? dir_model_find_row(model, model->index[slot] - 1) : -1;
+}
+
+static const EntryRecord *dir_model_iter_record(DirModel *model, GtkTreeIter *iter) {
+    return dir_model_record(model, dir_model_row_record(model, GPOINTER_TO_UINT(iter->user_data)));
+}
+
+static const char *dir_model_iter_name(DirModel *model, GtkTreeIter *iter) {
+    return dir_model_record_name(model, dir_model_row_record(model, GPOINTER_TO_UINT(iter->user_data)));
+}
+
+static GtkTreeModelFlags dir_model_get_flags(GtkTreeModel *tree_model __attribute__((unused))) {
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint dir_model_get_n_columns(GtkTreeModel *tree_model __attribute__((unused))) {
+    return DIR_MODEL_N_COLUMNS;
+}
+
+static GType dir_model_get_column_type(GtkTreeModel *tree_model __attribute__((unused)), gint column) {
+    switch (column) {
+    case DIR_MODEL_COL_NAME:
+        return G_TYPE_STRING;
+    case DIR_MODEL_COL_MODE:
+        return G_TYPE_UINT;
+    case DIR_MODEL_COL_SIZE:
+    case DIR_MODEL_COL_MTIME:
+        return G_TYPE_INT64;
+    default:
+        return G_TYPE_INVALID;
+    }
+}
+
+static gboolean dir_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path) {
+    DirModel *model = DIR_MODEL(tree_model);
+    if (gtk_tree_path_get_depth(path) != 1) {
+        return FALSE;
+    }
+    gint row = gtk_tree_path_get_indices(path)[0];
+    if (row < 0 || (guint)row >= model->rows->len) {
+        return FALSE;
+    }
+    iter->stamp = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(row);
+    return TRUE;
+}
+
+static GtkTreePath *dir_model_get_path(GtkTreeModel *tree_model __attribute__((unused)), GtkTreeIter *iter) {
+    return gtk_tree_path_new_from_indices(GPOINTER_TO_UINT(iter->user_data), -1);
+}
+
+static void dir_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value) {
+    DirModel *model = DIR_MODEL(tree_model);
+    const EntryRecord *rec = dir_model_iter_record(model, iter);
+
+    g_value_init(value, dir_model_get_column_type(tree_model, column));
+    switch (column) {
+    case DIR_MODEL_COL_NAME:
+        g_value_set_string(value, dir_model_iter_name(model, iter));
+        break;
+    case DIR_MODEL_COL_MODE:
+        g_value_set_uint(value, rec->mode);
+        break;
+    case DIR_MODEL_COL_SIZE:
+        g_value_set_int64(value, rec->size);
+        break;
+    case DIR_MODEL_COL_MTIME:
+        g_value_set_int64(value, rec->mtime);
+        break;
+    }
+}
+
+static gboolean dir_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    guint row = GPOINTER_TO_UINT(iter->user_data) + 1;
+    if (row >= DIR_MODEL(tree_model)->rows->len) {
+        return FALSE;
+    }
+    iter->user_data = GUINT_TO_POINTER(row);
+    return TRUE;
+}
+
+static gboolean dir_model_iter_previous(GtkTreeModel *tree_model __attribute__((unused)), GtkTreeIter *iter) {
+    guint row = GPOINTER_TO_UINT(iter->user_data);
+    if (row == 0) {
+        return FALSE;
+    }
+    iter->user_data = GUINT_TO_POINTER(row - 1);
+    return TRUE;
+}
+
+static gboolean dir_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {
+    DirModel *model = DIR_MODEL(tree_model);
+    if (parent != NULL || n < 0 || (guint)n >= model->rows->len) {
+        return FALSE;
+    }
+    iter->stamp = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(n);
+    return TRUE;
+}
+
+static gboolean dir_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    return dir_model_iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean dir_model_iter_has_child(GtkTreeModel *tree_model __attribute__((unused)), GtkTreeIter *iter __attribute__((unused))) {
+    return FALSE;
+}
+
+static gint dir_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return iter == NULL ? (gint)DIR_MODEL(tree_model)->rows->len : 0;
+}
+
+static gboolean dir_model_iter_parent(GtkTreeModel *tree_model __attribute__((unused)), GtkTreeIter *iter __attribute__((unused)), GtkTreeIter *child __attribute__((unused))) {
+    return FALSE;
+}
+
+static void dir_model_tree_model_init(GtkTreeModelIface *iface) {
+    iface->get_flags = dir_model_get_flags;
+    iface->get_n_columns = dir_model_get_n_columns;
+    iface->get_column_type = dir_model_get_column_type;
+    iface->get_iter = dir_model_get_iter;
+    iface->get_path = dir_model_get_path;
+    iface->get_value = dir_model_get_value;
+    iface->iter_next = dir_model_iter_next;
+    iface->iter_previous = dir_model_iter_previous;
+    iface->iter_children = dir_model_iter_children;
+    iface->iter_has_child = dir_model_iter_has_child;
+    iface->iter_n_children = dir_model_iter_n_children;
+    iface->iter_nth_child = dir_model_iter_nth_child;
+    iface->iter_parent = dir_model_iter_parent;
+}
+
+static void dir_model_finalize(GObject *object) {
+    DirModel *model = DIR_MODEL(object);
+    g_array_free(model->records, TRUE);
+    g_array_free(model->free_records, TRUE);
+    g_string_free(model->names, TRUE);
+    g_array_free(model->rows, TRUE);
+    g_array_free(model->record_rows, TRUE);
+    g_array_free(model->sort_prefixes, TRUE);
+    g_free(model->filter);
+    g_free(model->index);
+    G_OBJECT_CLASS(dir_model_parent_class)->finalize(object);
+}
+
+static void dir_model_class_init(DirModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = dir_model_finalize;
+}
+
+static void dir_model_init(DirModel *model) {
+    model->stamp = g_random_int();
+    model->records = g_array_new(FALSE, FALSE, sizeof(EntryRecord));
+    model->free_records = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->names = g_string_new(NULL);
+    model->rows = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->record_rows = g_array_new(FALSE, TRUE, sizeof(guint32));
+    model->sort_prefixes = g_array_new(FALSE, FALSE, sizeof(guint64));
+    model->dirs_first = TRUE;
+    model->index = g_new0(guint32, DIR_MODEL_MIN_INDEX);
+    model->index_size = DIR_MODEL_MIN_INDEX;
+}
+
+static DirModel *dir_model;
 static GtkWidget *tree_view, *window;
-static VteTerminal *terminal;
+static GtkWidget *listing_filter_entry;
+static GtkWidget *terminal_notebook;
+static GQueue terminal_pool = G_QUEUE_INIT;
+static guint terminal_pool_refill_id;
+static gchar *terminal_shell;
 static int inotify_fd;
 static char *base_dir;
 static char *current_dir;
+static GThreadPool *scan_pool;
+static GCancellable *scan_cancellable;
+static guint scan_generation;
+static gboolean scan_clear_pending;
+static char *scan_readme_path;
+static int current_wd = -1;
+static GHashTable *pending_changes;
+static guint pending_flush_id;
+static GHashTable *listing_cache;
+static GQueue listing_cache_lru = G_QUEUE_INIT;
+static gsize listing_cache_bytes;
+static int listing_cache_inotify_fd = -1;
+static GHashTable *listing_cache_watches;  // wd -> ListingCacheEntry
+static struct stat scan_dir_stat;
+static gboolean scan_dir_stat_valid;
+static gboolean scan_listing_done;  // the last batch of the current listing has been shown
+static GThreadPool *delete_pool;
+static DeleteJob *active_delete;
+static guint delete_progress_id;
+static GtkWidget *delete_progress_box, *delete_progress_bar;
+static GQueue trash_items = G_QUEUE_INIT;
+static GAsyncQueue *purge_queue;
+static mode_t file_umask;
+static GThreadPool *index_pool;
+static int index_inotify_fd;
+static PathIndex *path_index;
+static guint index_generation;
+static guint index_serial;
+static gboolean index_walking;
+static gboolean index_dirty;
+static GByteArray *index_parked_events;
+static gchar *index_cache_path;
+static gboolean daemon_running;    // a `codews --daemon` answers this window's requests
+static int daemon_events_fd = -1;  // its subscription stream
+static guint daemon_events_watch;
+static GString *daemon_events_buffer;
+static GtkWidget *finder_window, *finder_entry, *finder_view, *finder_status;
+static GtkListStore *finder_store;
+static GArray *finder_matches;
+static gchar *finder_last_query;
+static guint finder_serial;
+static GThreadPool *finder_pool;
+static gint finder_generation;  // bumped per query; daemon replies to older ones are dropped
+static GThreadPool *search_pool;
+static SearchJob *active_search;
+static guint search_shown;
+static GtkWidget *search_window, *search_entry, *search_regex_check, *search_case_check, *search_status;
+static GtkListStore *search_store;
+static gchar *editor_socket_path;
+static gchar *self_exe_path;
+static GHashTable *speculative_pending;
+static GHashTable *speculative_builds;
+static guint speculative_timer_id;
+static GThreadPool *build_all_pool;
+static GThreadPool *build_plan_pool;
+static BuildAllRun *active_build_all;
+static GtkWidget *build_all_window, *build_all_status, *build_all_log_view;
+static GtkListStore *build_all_store;
+static GQueue job_history = G_QUEUE_INIT;
+static gchar *job_fifo_path;
+static GMutex job_fifo_lock;  // job_fifo_path is also read by workers wrapping their spawns
+static int job_fifo_fd = -1;
+static GString *job_fifo_buffer;
+static GtkWidget *job_history_window;
+static GtkListStore *job_history_store;
+static gint64 trace_startup_start;  // until the first listing is on screen
+static GtkTreeStore *workspace_tree_store;
+static GtkWidget *workspace_tree_view;
+static GThreadPool *workspace_tree_pool;
+static WorkspaceTreeState workspace_tree_root_state;
+static GHashTable *workspace_tree_rows;     // loading or loaded directory -> GtkTreeRowReference
+static GHashTable *workspace_tree_restore;  // expanded when the workshop last closed
+static GHashTable *workspace_tree_reloads;  // loaded directories whose entries changed
+static guint workspace_tree_reload_id;
+static gchar *workspace_tree_state_path;
+static GtkTreeViewColumn *size_column;
+static GThreadPool *dir_size_pool;       // du_worker()
+static GThreadPool *dir_size_scan_pool;  // rescans of single directories
+static GHashTable *dir_sizes;            // rel -> DirSize
+static GHashTable *dir_size_children;    // rel -> set of the rels cached directly below it
+static GHashTable *dir_size_walking;     // roots of walks still running
+static GHashTable *dir_size_rescans;
+static guint dir_size_rescan_id;
+static DuLinks *dir_size_links;
+static GMutex dir_size_results_lock;
+static GPtrArray *dir_size_results;      // DirSizeResult, filled by the walkers
+static guint dir_size_results_id;
+static GtkTreeViewColumn *git_column;
+static GThreadPool *git_status_pool;
+static GHashTable *git_repos;         // work tree -> GitRepo
+static GHashTable *git_repo_dirs;     // directory -> GitRepo, or NULL outside any repository
+static GHashTable *git_repo_watches;  // watch on a .git directory -> GitRepo
+static int git_inotify_fd = -1;
+static guint git_status_refresh_id;
+static GitRepo *listing_git_repo;
+static gchar *listing_git_prefix;     // the listed directory relative to listing_git_repo, with a '/'
+static GitStatus listing_git_inherited;
+static gchar *session_path;
+static Session session;
 
 // Function declarations
 static void show_new_directory_dialog();
 static void create_new_directory(const char *dir_name);
 static void show_deletion_dialog();
-static void delete_selected_item();
+static void delete_selected_item(gboolean to_trash);
+static void undo_last_trash(void);
+static void show_finder(void);
+static void show_search(void);
+static void open_file_at_line(const char *filepath, gint line);
+static void run_in_tab(const char *kind, const char *title, const char *cwd, const char *command);
+static BuildPlan *build_plan_new(const char *path, const char *language);
+static void build_plan_compute_key(BuildPlan *plan);
+static gchar *build_plan_command(BuildPlan *plan);
+static void build_plan_free(BuildPlan *plan);
+static void schedule_speculative_build(const char *rel);
+static gboolean build_cache_is_input(const char *name);
+static void start_build_all(void);
+static gchar *job_wrap_command(const char *kind, const char *title, const char *command);
+static gchar **job_wrap_argv(const char *kind, const char *title, const char *command);
+static void show_job_history(void);
+static void cancel_speculative_build(const char *target);
+static void workspace_tree_note_change(const char *dir);
+static void workspace_tree_save_state(void);
+static DirSize *dir_size_lookup_child(const char *name);
+static void dir_size_fill(const char *name, EntryRecord *rec);
+static void dir_size_rescan(const char *rel, gboolean revisit);
+static const char *dir_size_rel(const char *path);
+static void dir_size_note_change(const char *dir);
+static void on_listing_sizes_toggled(GtkToggleButton *button, gpointer data __attribute__((unused)));
+static void git_status_show(const char *dir);
+static void git_status_note_change(const char *dir, const char *name);
+static GitStatus git_status_lookup(const char *name, gboolean is_dir);
+static void session_save(void);
+static void daemon_lost(void);
 // static int get_directory_depth(const char *dir);  // Unused function
-static gboolean recursive_delete(const char *path);
-static void make_file_executable(const char *path);
-static void make_file_not_executable(const char *path);
+static void set_files_executable(GPtrArray *names, gboolean executable);
+static GPtrArray *get_selected_names(void);
 static const char *get_language_from_path(const char *path);
 static void compile_and_run(const char *path, const char *language);
 static gboolean show_confirmation_dialog(const char *message);
 static void create_new_file(const char *file_name);
 static void show_new_file_dialog();
 static void display_directory(const char *dir);
+static void scan_worker(gpointer data, gpointer user_data);
+static gboolean on_inotify_event(GIOChannel *source, GIOCondition condition, gpointer data);
 static void open_file_with_appropriate_application(const char *filepath);
 static gboolean on_key_press(GtkWidget *widget __attribute__((unused)), GdkEventKey *event, gpointer userdata __attribute__((unused)));
 static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer userdata __attribute__((unused)));
 static void on_row_activated(GtkTreeView *treeview, GtkTreePath *path, GtkTreeViewColumn *col __attribute__((unused)), gpointer userdata __attribute__((unused)));
 static GtkWidget* create_tree_view();
+static void on_listing_filter_changed(GtkEditable *editable, gpointer data __attribute__((unused)));
 static void on_window_destroy(GtkWidget *widget __attribute__((unused)), gpointer data __attribute__((unused)));
-static char *strip_html_markup(const char *input);
 void run_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
-void make_file_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
-void make_file_not_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
+void benchmark_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
+void profile_stat_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
+void profile_record_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data);
+static void toggle_profile_builds(GtkCheckMenuItem *item, gpointer user_data __attribute__((unused)));
+void make_file_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data __attribute__((unused)));
+void make_file_not_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data __attribute__((unused)));
 
 // static void handle_file_open_error(const char *filepath);  // Unused function
 
@@ -59,689 +1321,6030 @@ static gboolean show_confirmation_dialog(const char *message) {
                                                GTK_MESSAGE_QUESTION,
                                                GTK_BUTTONS_OK_CANCEL,
                                                "%s", message);
+    TRACE_START(trace_start);
     gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    TRACE_END(trace_start, "dialog", "confirmation", message);
     gtk_widget_destroy(dialog);
     return (response == GTK_RESPONSE_OK);
 }
 
-/*
-static void handle_file_open_error(const char *filepath) {
-    gchar *msg = g_strdup_printf("\nFailed to open '%s'\n", filepath);
-    vte_terminal_feed_child(VTE_TERMINAL(terminal), msg, -1);
-    g_free(msg);
+/*
+static void handle_file_open_error(const char *filepath) {
+    gchar *msg = g_strdup_printf("\nFailed to open '%s'\n", filepath);
+    vte_terminal_feed_child(VTE_TERMINAL(terminal), msg, -1);
+    g_free(msg);
+}
+*/
+
+static void terminal_tab_free(gpointer data) {
+    TerminalTab *tab = data;
+    g_free(tab->kind);
+    g_free(tab);
+}
+
+static void on_shell_spawned(VteTerminal *term __attribute__((unused)), GPid pid, GError *error, gpointer data) {
+    TerminalTab *tab = data;
+    TRACE_END(tab->spawn_started, "spawn", "shell", terminal_shell);
+    if (error) {
+        g_printerr("Failed to start %s: %s\n", terminal_shell, error->message);
+        return;
+    }
+    tab->shell_pid = pid;
+}
+
+static void close_terminal_tab(TerminalTab *tab) {
+    gint page = gtk_notebook_page_num(GTK_NOTEBOOK(terminal_notebook), GTK_WIDGET(tab->terminal));
+    if (page >= 0) {
+        gtk_notebook_remove_page(GTK_NOTEBOOK(terminal_notebook), page);
+    }
+}
+
+static void on_terminal_child_exited(VteTerminal *term, gint status __attribute__((unused)), gpointer data) {
+    TerminalTab *tab = data;
+
+    // A shell that dies while still pooled is dropped; the pool refills the
+    // next time a tab is taken.
+    GList *link = g_queue_find(&terminal_pool, tab);
+    if (link) {
+        g_queue_delete_link(&terminal_pool, link);
+        g_object_unref(term);
+        return;
+    }
+    close_terminal_tab(tab);
+}
+
+static void on_terminal_tab_close(GtkButton *button __attribute__((unused)), gpointer data) {
+    close_terminal_tab(data);
+}
+
+// Starts an interactive shell in a terminal that isn't on screen yet, so it
+// has finished reading its rc files by the time a tab needs it.
+static TerminalTab *terminal_tab_new(const char *cwd) {
+    TRACE_START(trace_start);
+    TerminalTab *tab = g_new0(TerminalTab, 1);
+    tab->spawn_started = trace_start;
+    tab->terminal = VTE_TERMINAL(vte_terminal_new());
+    tab->shell_pid = -1;
+    g_object_ref_sink(tab->terminal);
+    g_object_set_data_full(G_OBJECT(tab->terminal), "codews-tab", tab, terminal_tab_free);
+    g_signal_connect(tab->terminal, "child-exited", G_CALLBACK(on_terminal_child_exited), tab);
+
+    char *argv[] = {terminal_shell, NULL};
+    vte_terminal_spawn_async(tab->terminal, VTE_PTY_DEFAULT, cwd ? cwd : base_dir, argv, NULL, G_SPAWN_DEFAULT,
+                             NULL, NULL, NULL, -1, NULL, on_shell_spawned, tab);
+    TRACE_END(trace_start, "startup", "terminal", NULL);
+    return tab;
+}
+
+static gboolean refill_terminal_pool(gpointer data __attribute__((unused))) {
+    while (terminal_pool.length < (guint)settings.terminal_pool_size) {
+        g_queue_push_tail(&terminal_pool, terminal_tab_new(NULL));
+    }
+    terminal_pool_refill_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// A tab is idle when its shell is the terminal's foreground process group,
+// i.e. nothing it started is still running.
+static gboolean terminal_tab_is_idle(TerminalTab *tab) {
+    VtePty *pty = vte_terminal_get_pty(tab->terminal);
+    return pty != NULL && tab->shell_pid > 0 && tcgetpgrp(vte_pty_get_fd(pty)) == tab->shell_pid;
+}
+
+static TerminalTab *find_idle_tab(const char *kind) {
+    gint n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(terminal_notebook));
+    for (gint i = 0; i < n_pages; i++) {
+        GtkWidget *page = gtk_notebook_get_nth_page(GTK_NOTEBOOK(terminal_notebook), i);
+        TerminalTab *tab = g_object_get_data(G_OBJECT(page), "codews-tab");
+        if (tab && g_strcmp0(tab->kind, kind) == 0 && terminal_tab_is_idle(tab)) {
+            return tab;
+        }
+    }
+    return NULL;
+}
+
+// Pooled shells start in base_dir, so a tab wanted elsewhere gets its own.
+static TerminalTab *open_terminal_tab(const char *kind, const char *title, const char *cwd) {
+    TerminalTab *tab = cwd ? NULL : g_queue_pop_head(&terminal_pool);
+    if (tab == NULL) {
+        tab = terminal_tab_new(cwd);
+    }
+    if (terminal_pool_refill_id == 0) {
+        terminal_pool_refill_id = g_idle_add(refill_terminal_pool, NULL);
+    }
+    tab->kind = g_strdup(kind);
+
+    GtkWidget *label_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    tab->label = gtk_label_new(title);
+    gtk_box_pack_start(GTK_BOX(label_box), tab->label, TRUE, TRUE, 0);
+    GtkWidget *close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
+    gtk_button_set_relief(GTK_BUTTON(close_button), GTK_RELIEF_NONE);
+    g_signal_connect(close_button, "clicked", G_CALLBACK(on_terminal_tab_close), tab);
+    gtk_box_pack_start(GTK_BOX(label_box), close_button, FALSE, FALSE, 0);
+    gtk_widget_show_all(label_box);
+
+    gtk_widget_show(GTK_WIDGET(tab->terminal));
+    gtk_notebook_append_page(GTK_NOTEBOOK(terminal_notebook), GTK_WIDGET(tab->terminal), label_box);
+    gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(terminal_notebook), GTK_WIDGET(tab->terminal), TRUE);
+    g_object_unref(tab->terminal);  // the notebook owns it now
+    return tab;
+}
+
+// Runs a shell command in a tab of its own, typed into a pre-started shell.
+// With tab reuse on, an idle tab of the same kind is used instead. A NULL
+// command just opens the tab.
+static void run_in_tab(const char *kind, const char *title, const char *cwd, const char *command) {
+    TRACE_START(trace_start);
+    TerminalTab *tab = settings.terminal_reuse ? find_idle_tab(kind) : NULL;
+    if (tab) {
+        gtk_label_set_text(GTK_LABEL(tab->label), title);
+    } else {
+        tab = open_terminal_tab(kind, title, NULL);
+    }
+    gtk_notebook_set_current_page(GTK_NOTEBOOK(terminal_notebook),
+                                  gtk_notebook_page_num(GTK_NOTEBOOK(terminal_notebook), GTK_WIDGET(tab->terminal)));
+
+    if (command) {
+        GString *line = g_string_new(NULL);
+        if (cwd) {
+            gchar *quoted = g_shell_quote(cwd);
+            g_string_append_printf(line, "cd %s && ", quoted);
+            g_free(quoted);
+        }
+        gchar *wrapped = job_wrap_command(kind, title, command);
+        g_string_append(line, wrapped);
+        g_free(wrapped);
+        g_strchomp(line->str);
+        g_string_set_size(line, strlen(line->str));
+        g_string_append_c(line, '\n');
+        vte_terminal_feed_child(tab->terminal, line->str, line->len);
+        g_string_free(line, TRUE);
+    }
+    TRACE_END(trace_start, "spawn", kind, command);
+}
+
+static VteTerminal *current_terminal(void) {
+    gint page = gtk_notebook_get_current_page(GTK_NOTEBOOK(terminal_notebook));
+    return page < 0 ? NULL : VTE_TERMINAL(gtk_notebook_get_nth_page(GTK_NOTEBOOK(terminal_notebook), page));
+}
+
+static void msgpack_append_str(GByteArray *out, const char *str) {
+    gsize len = strlen(str);
+    guint8 header[5] = {0xdb, len >> 24, len >> 16, len >> 8, len};  // str32
+    g_byte_array_append(out, header, sizeof(header));
+    g_byte_array_append(out, (const guint8 *)str, len);
+}
+
+// Runs an Ex command in the editor server as the request
+// [0, msgid, "nvim_command", [command]] and waits briefly for the reply.
+// Returns FALSE when no server is listening.
+static gboolean editor_send_command(const char *command) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    g_strlcpy(addr.sun_path, editor_socket_path, sizeof(addr.sun_path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return FALSE;
+    }
+
+    static const guint8 request_head[] = {0x94, 0x00, 0x01};
+    GByteArray *request = g_byte_array_new();
+    g_byte_array_append(request, request_head, sizeof(request_head));
+    msgpack_append_str(request, "nvim_command");
+    g_byte_array_append(request, (const guint8 *)"\x91", 1);
+    msgpack_append_str(request, command);
+
+    gboolean sent = TRUE;
+    for (guint pos = 0; pos < request->len;) {
+        ssize_t n = send(fd, request->data + pos, request->len - pos, MSG_NOSIGNAL);
+        if (n <= 0) {
+            sent = FALSE;
+            break;
+        }
+        pos += n;
+    }
+
+    // The reply is [1, msgid, error, result]; a nil error means it ran.
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    guint8 reply[4];
+    if (sent && poll(&pfd, 1, EDITOR_RPC_TIMEOUT_MS) > 0 && read(fd, reply, sizeof(reply)) == sizeof(reply) &&
+        reply[3] != 0xc0) {
+        g_printerr("nvim rejected command: %s\n", command);
+    }
+
+    g_byte_array_free(request, TRUE);
+    close(fd);
+    return sent;
+}
+
+// Opens a file in the running editor server. :drop reuses a window that
+// already shows the file and splits instead of abandoning a modified buffer.
+static gboolean editor_open(const char *filepath, gint line) {
+    if (!settings.editor_server || editor_socket_path == NULL || strchr(filepath, '\n')) {
+        return FALSE;
+    }
+
+    GString *command = g_string_new("execute 'drop' fnameescape('");
+    for (const char *p = filepath; *p; p++) {
+        if (*p == '\'') {
+            g_string_append(command, "''");
+        } else {
+            g_string_append_c(command, *p);
+        }
+    }
+    g_string_append(command, "')");
+    if (line > 0) {
+        g_string_append_printf(command, " | call cursor(%d, 1)", line);
+    }
+
+    TRACE_START(trace_start);
+    gboolean opened = editor_send_command(command->str);
+    TRACE_END(trace_start, "spawn", "editor rpc", filepath);
+    g_string_free(command, TRUE);
+    return opened;
+}
+
+static void open_file_with_appropriate_application(const char *filepath) {
+    open_file_at_line(filepath, 0);
+}
+
+// Like open_file_with_appropriate_application(), but puts the editor on the
+// given line when it is positive.
+static void open_file_at_line(const char *filepath, gint line) {
+    struct stat path_stat;
+    if (stat(filepath, &path_stat) != 0 || S_ISDIR(path_stat.st_mode)) {
+        g_print("Attempted to open a directory or invalid path: %s\n", filepath);
+        return;
+    }
+
+    gchar *command = NULL;
+    const char *kind = "viewer";
+
+    if (has_extension(filepath, "jpg") || has_extension(filepath, "png")) {
+        command = g_strdup_printf("feh \"%s\"", filepath);
+    } else if (has_extension(filepath, "pdf")) {
+        command = g_strdup_printf("zathura \"%s\"", filepath);
+    } else if (editor_open(filepath, line)) {
+        return;
+    } else {
+        // Start a new editor, as the server if enabled. A socket left behind
+        // by an editor that was killed would make --listen fail.
+        GString *nvim = g_string_new("nvim");
+        if (settings.editor_server && editor_socket_path) {
+            unlink(editor_socket_path);
+            g_string_append_printf(nvim, " --listen \"%s\"", editor_socket_path);
+        }
+        if (line > 0) {
+            g_string_append_printf(nvim, " +%d", line);
+        }
+        g_string_append_printf(nvim, " \"%s\"", filepath);
+        command = g_string_free(nvim, FALSE);
+        kind = "editor";
+    }
+
+    gchar *title = g_path_get_basename(filepath);
+    run_in_tab(kind, title, NULL, command);
+    g_free(title);
+    g_free(command);
+}
+
+static EntryBatch *entry_batch_new(guint generation) {
+    EntryBatch *batch = g_new0(EntryBatch, 1);
+    batch->generation = generation;
+    batch->records = g_array_sized_new(FALSE, FALSE, sizeof(EntryRecord), SCAN_FIRST_BATCH);
+    batch->names = g_string_sized_new(SCAN_FIRST_BATCH * 16);
+    return batch;
+}
+
+static void entry_batch_free(EntryBatch *batch) {
+    g_array_free(batch->records, TRUE);
+    g_string_free(batch->names, TRUE);
+    g_free(batch);
+}
+
+static void scan_job_free(ScanJob *job) {
+    g_object_unref(job->cancellable);
+    g_free(job->dir);
+    g_free(job);
+}
+
+static void load_settings(void) {
+    gchar *path = g_build_filename(g_get_user_config_dir(), "codews", "codews.conf", NULL);
+    GKeyFile *key_file = g_key_file_new();
+
+    if (g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL)) {
+        if (g_key_file_has_key(key_file, "cache", "listing_cache_mb", NULL)) {
+            settings.listing_cache_mb = MAX(0, g_key_file_get_integer(key_file, "cache", "listing_cache_mb", NULL));
+        }
+        if (g_key_file_has_key(key_file, "trash", "grace_seconds", NULL)) {
+            settings.trash_grace_seconds = MAX(0, g_key_file_get_integer(key_file, "trash", "grace_seconds", NULL));
+        }
+        settings.ignore_dirs = g_key_file_get_string_list(key_file, "workspace", "ignore", NULL, NULL);
+        if (g_key_file_has_key(key_file, "editor", "server", NULL)) {
+            settings.editor_server = g_key_file_get_boolean(key_file, "editor", "server", NULL);
+        }
+        if (g_key_file_has_key(key_file, "terminal", "pool_size", NULL)) {
+            settings.terminal_pool_size = MAX(0, g_key_file_get_integer(key_file, "terminal", "pool_size", NULL));
+        }
+        if (g_key_file_has_key(key_file, "terminal", "reuse_idle_tabs", NULL)) {
+            settings.terminal_reuse = g_key_file_get_boolean(key_file, "terminal", "reuse_idle_tabs", NULL);
+        }
+        if (g_key_file_has_key(key_file, "build", "cache", NULL)) {
+            settings.build_cache = g_key_file_get_boolean(key_file, "build", "cache", NULL);
+        }
+        settings.speculative_builds = g_key_file_get_boolean(key_file, "build", "speculative", NULL);
+        settings.profile_builds = g_key_file_get_boolean(key_file, "build", "profile", NULL);
+        settings.job_cgroup = g_key_file_get_boolean(key_file, "jobs", "cgroup", NULL);
+        settings.job_memory_max = g_key_file_get_string(key_file, "jobs", "memory_max", NULL);
+        settings.job_cpu_quota = g_key_file_get_string(key_file, "jobs", "cpu_quota", NULL);
+
+        gchar *sort = g_key_file_get_string(key_file, "listing", "sort", NULL);
+        for (gint i = 0; sort && i < DIR_SORT_N_MODES; i++) {
+            if (strcmp(sort, listing_sort_names[i]) == 0) {
+                settings.listing_sort = i;
+            }
+        }
+        g_free(sort);
+        if (g_key_file_has_key(key_file, "listing", "dirs_first", NULL)) {
+            settings.listing_dirs_first = g_key_file_get_boolean(key_file, "listing", "dirs_first", NULL);
+        }
+        settings.listing_dir_sizes = g_key_file_get_boolean(key_file, "listing", "dir_sizes", NULL);
+        if (g_key_file_has_key(key_file, "listing", "git_status", NULL)) {
+            settings.listing_git_status = g_key_file_get_boolean(key_file, "listing", "git_status", NULL);
+        }
+    }
+    if (settings.ignore_dirs == NULL) {
+        settings.ignore_dirs = g_strsplit(".git;node_modules;__pycache__", ";", -1);
+    }
+
+    g_key_file_free(key_file);
+    g_free(path);
+}
+
+static guint listing_cache_hash(gconstpointer key) {
+    const ListingCacheEntry *entry = key;
+    return (guint)(entry->ino ^ (entry->ino >> 32) ^ (entry->dev * 2654435761u));
+}
+
+static gboolean listing_cache_equal(gconstpointer a, gconstpointer b) {
+    const ListingCacheEntry *x = a, *y = b;
+    return x->dev == y->dev && x->ino == y->ino;
+}
+
+static void listing_cache_entry_free(gpointer data) {
+    ListingCacheEntry *entry = data;
+    g_array_free(entry->records, TRUE);
+    g_string_free(entry->names, TRUE);
+    g_free(entry);
+}
+
+static void listing_cache_remove(ListingCacheEntry *entry) {
+    g_hash_table_remove(listing_cache_watches, GINT_TO_POINTER(entry->wd));
+    inotify_rm_watch(listing_cache_inotify_fd, entry->wd);
+    g_queue_delete_link(&listing_cache_lru, entry->link);
+    listing_cache_bytes -= entry->bytes;
+    g_hash_table_remove(listing_cache, entry);
+}
+
+static void listing_cache_invalidate(const struct stat *dir_stat) {
+    ListingCacheEntry key = { .dev = dir_stat->st_dev, .ino = dir_stat->st_ino };
+    ListingCacheEntry *entry = g_hash_table_lookup(listing_cache, &key);
+    if (entry) {
+        listing_cache_remove(entry);
+    }
+}
+
+// Returns the cached listing for a directory if its timestamps still match.
+static ListingCacheEntry *listing_cache_lookup(const struct stat *dir_stat) {
+    ListingCacheEntry key = { .dev = dir_stat->st_dev, .ino = dir_stat->st_ino };
+    ListingCacheEntry *entry = g_hash_table_lookup(listing_cache, &key);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (entry->mtime.tv_sec != dir_stat->st_mtim.tv_sec || entry->mtime.tv_nsec != dir_stat->st_mtim.tv_nsec ||
+        entry->ctime.tv_sec != dir_stat->st_ctim.tv_sec || entry->ctime.tv_nsec != dir_stat->st_ctim.tv_nsec) {
+        listing_cache_remove(entry);
+        return NULL;
+    }
+    g_queue_unlink(&listing_cache_lru, entry->link);
+    g_queue_push_head_link(&listing_cache_lru, entry->link);
+    return entry;
+}
+
+// Copies the model's live records, filtered out or not, into the cache and
+// evicts from the cold end until the cache fits the configured budget again.
+static void listing_cache_store(const char *dir, const struct stat *dir_stat) {
+    gsize budget = (gsize)settings.listing_cache_mb * 1024 * 1024;
+    listing_cache_invalidate(dir_stat);
+    if (listing_cache_inotify_fd < 0) {
+        return;
+    }
+
+    ListingCacheEntry *entry = g_new0(ListingCacheEntry, 1);
+    entry->dev = dir_stat->st_dev;
+    entry->ino = dir_stat->st_ino;
+    entry->mtime = dir_stat->st_mtim;
+    entry->ctime = dir_stat->st_ctim;
+    entry->records = g_array_sized_new(FALSE, FALSE, sizeof(EntryRecord), dir_model->index_used);
+    entry->names = g_string_sized_new(dir_model->names->len - dir_model->dead_bytes);
+
+    for (guint32 record = 0; record < dir_model->records->len; record++) {
+        EntryRecord rec = *dir_model_record(dir_model, record);
+        if (rec.name_offset == DIR_MODEL_FREE_RECORD) {
+            continue;
+        }
+        const char *name = dir_model_record_name(dir_model, record);
+        rec.name_offset = entry->names->len;
+        g_string_append_len(entry->names, name, entry_arena_length(name));
+        g_array_append_val(entry->records, rec);
+    }
+    entry->bytes = sizeof(*entry) + entry->records->len * sizeof(EntryRecord) + entry->names->len;
+
+    // A directory that can't be watched can't be trusted later.
+    entry->wd = entry->bytes > budget ? -1 : inotify_add_watch(listing_cache_inotify_fd, dir, WATCH_MASK);
+    if (entry->wd < 0) {
+        listing_cache_entry_free(entry);
+        return;
+    }
+
+    g_queue_push_head(&listing_cache_lru, entry);
+    entry->link = g_queue_peek_head_link(&listing_cache_lru);
+    g_hash_table_add(listing_cache, entry);
+    g_hash_table_insert(listing_cache_watches, GINT_TO_POINTER(entry->wd), entry);
+    listing_cache_bytes += entry->bytes;
+
+    while (listing_cache_bytes > budget) {
+        listing_cache_remove(g_queue_peek_tail(&listing_cache_lru));
+    }
+}
+
+// Any change inside a cached directory drops its listing.
+static gboolean on_listing_cache_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(listing_cache_inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                while (listing_cache_lru.length > 0) {
+                    listing_cache_remove(g_queue_peek_tail(&listing_cache_lru));
+                }
+                continue;
+            }
+            ListingCacheEntry *entry = g_hash_table_lookup(listing_cache_watches, GINT_TO_POINTER(event->wd));
+            if (entry && !(event->mask & IN_IGNORED)) {
+                listing_cache_remove(entry);
+            } else if (entry) {
+                // The directory itself is gone; its watch went with it.
+                g_hash_table_remove(listing_cache_watches, GINT_TO_POINTER(event->wd));
+                entry->wd = -1;
+                listing_cache_remove(entry);
+            }
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void show_entry_batch(const EntryBatch *batch) {
+    TRACE_START(trace_start);
+    if (batch->error) {
+        fprintf(stderr, "Failed to open directory: %s\n", strerror(batch->error));
+        // Don't leave the previous directory's rows up, and let changes
+        // watched in this one flush into the empty listing.
+        if (scan_clear_pending) {
+            gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), NULL);
+            dir_model_clear(dir_model);
+            gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(dir_model));
+            scan_clear_pending = FALSE;
+        }
+        return;
+    }
+
+    // The old listing stays up until the first batch of the new one is ready.
+    // That batch is loaded while the model is detached so the view doesn't
+    // process one signal per row.
+    gboolean first_batch = scan_clear_pending;
+    if (first_batch) {
+        gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), NULL);
+        dir_model_clear(dir_model);
+        scan_clear_pending = FALSE;
+    }
+
+    for (guint i = 0; i < batch->records->len; i++) {
+        const EntryRecord *rec = &g_array_index(batch->records, EntryRecord, i);
+        const char *name = batch->names->str + rec->name_offset;
+        EntryRecord shown = *rec;
+
+        dir_size_fill(name, &shown);
+        dir_model_upsert(dir_model, name, name + strlen(name) + 1, &shown);
+
+        if (scan_readme_path == NULL && g_ascii_strcasecmp(name, "readme.md") == 0) {
+            scan_readme_path = g_strdup_printf("%s/%s", current_dir, name);
+        }
+    }
+    dir_model_sort_pending(dir_model);
+
+    if (first_batch) {
+        gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(dir_model));
+    }
+
+    if (batch->done && !batch->from_cache && scan_dir_stat_valid) {
+        listing_cache_store(current_dir, &scan_dir_stat);
+    }
+    if (batch->done) {
+        scan_listing_done = TRUE;
+        dir_size_rescan(dir_size_rel(current_dir), TRUE);
+    }
+    TRACE_ENDF(trace_start, "model", "apply listing", "%u entries%s", batch->records->len,
+               batch->from_cache ? " from cache" : "");
+    if (batch->done && trace_startup_start) {
+        TRACE_END(trace_startup_start, "startup", "first listing", current_dir);
+        trace_startup_start = 0;
+    }
+
+    if (batch->done && scan_readme_path) {
+        open_file_with_appropriate_application(scan_readme_path);
+        g_clear_pointer(&scan_readme_path, g_free);
+    }
+}
+
+static gboolean apply_entry_batch(gpointer data) {
+    EntryBatch *batch = data;
+
+    // A newer scan has started since this batch was produced.
+    if (batch->generation == scan_generation) {
+        show_entry_batch(batch);
+    }
+
+    entry_batch_free(batch);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean scan_add_entry(const char *name, const EntryRecord *record, gpointer data) {
+    ScanJob *job = data;
+    EntryBatch *batch = job->batch;
+    EntryRecord rec = *record;
+
+    // The collation key is worked out here, off the main thread, so sorting
+    // the listing never has to look at UTF-8 again.
+    gchar *key = g_utf8_collate_key_for_filename(name, -1);
+    rec.name_offset = batch->names->len;
+    g_string_append_len(batch->names, name, strlen(name) + 1);
+    g_string_append_len(batch->names, key, strlen(key) + 1);
+    g_array_append_val(batch->records, rec);
+    g_free(key);
+
+    if (batch->records->len >= job->batch_limit ||
+        g_get_monotonic_time() - job->last_flush >= SCAN_BATCH_INTERVAL_US) {
+        g_idle_add(apply_entry_batch, batch);
+        job->batch = entry_batch_new(job->generation);
+        job->batch_limit = SCAN_BATCH_SIZE;
+        job->last_flush = g_get_monotonic_time();
+    }
+    return TRUE;
+}
+
+static void scan_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    ScanJob *job = data;
+    job->batch = entry_batch_new(job->generation);
+    job->batch_limit = SCAN_FIRST_BATCH;
+    job->last_flush = g_get_monotonic_time();
+
+    // A running daemon may have the listing cached already.
+    int error = daemon_running ? daemon_list_directory(job->dir, job->cancellable, scan_add_entry, job) : -1;
+    job->batch->error = error >= 0 ? error : list_directory(job->dir, job->cancellable, scan_add_entry, job);
+    job->batch->done = TRUE;
+    g_idle_add(apply_entry_batch, job->batch);
+    scan_job_free(job);
+}
+
+static gboolean flush_pending_changes(gpointer data __attribute__((unused))) {
+    // Names in the pending set belong to the new directory; wait until its
+    // listing has replaced the old one.
+    if (scan_clear_pending) {
+        return G_SOURCE_CONTINUE;
+    }
+    TRACE_START(trace_start);
+    guint changes = g_hash_table_size(pending_changes);
+
+    // The cached copy of this directory no longer matches what is on disk.
+    if (scan_dir_stat_valid) {
+        listing_cache_invalidate(&scan_dir_stat);
+    }
+
+    GHashTableIter hash_iter;
+    gpointer key;
+    g_hash_table_iter_init(&hash_iter, pending_changes);
+    while (g_hash_table_iter_next(&hash_iter, &key, NULL)) {
+        const char *name = key;
+        char *full_path = g_strdup_printf("%s/%s", current_dir, name);
+        struct stat statbuf;
+
+        if (stat(full_path, &statbuf) == 0) {
+            EntryRecord rec = {
+                .mode = statbuf.st_mode,
+                .size = statbuf.st_size,
+                .mtime = statbuf.st_mtime,
+                .type = S_ISDIR(statbuf.st_mode) ? DT_DIR : DT_REG,
+            };
+            dir_size_fill(name, &rec);
+            dir_model_upsert(dir_model, name, NULL, &rec);
+        } else {
+            dir_model_remove(dir_model, name);
+        }
+        g_free(full_path);
+    }
+    dir_model_sort_pending(dir_model);
+    g_hash_table_remove_all(pending_changes);
+    TRACE_ENDF(trace_start, "model", "apply changes", "%u names", changes);
+
+    pending_flush_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_inotify_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped, so the model can no longer be patched.
+                display_directory(current_dir);
+                continue;
+            }
+            if (event->wd != current_wd || event->len == 0 || is_hidden_entry(event->name)) {
+                continue;
+            }
+            g_hash_table_add(pending_changes, g_strdup(event->name));
+        }
+    }
+
+    if (g_hash_table_size(pending_changes) > 0 && pending_flush_id == 0) {
+        pending_flush_id = g_timeout_add(WATCH_FLUSH_INTERVAL_MS, flush_pending_changes, NULL);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void watch_directory(const char *dir) {
+    if (current_wd >= 0) {
+        inotify_rm_watch(inotify_fd, current_wd);
+    }
+    current_wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+    if (current_wd < 0) {
+        g_printerr("Failed to watch %s: %s\n", dir, strerror(errno));
+    }
+    g_hash_table_remove_all(pending_changes);
+}
+
+static void display_directory(const char *dir) {
+    // Abort whatever scan is still running for the previous directory.
+    if (scan_cancellable) {
+        g_cancellable_cancel(scan_cancellable);
+        g_object_unref(scan_cancellable);
+    }
+    scan_cancellable = g_cancellable_new();
+    scan_generation++;
+    scan_clear_pending = TRUE;
+    scan_listing_done = FALSE;
+
+    // A filter typed for one directory means nothing in the next. The rows
+    // it left are about to be replaced, so the model's filter is dropped
+    // without refiltering them.
+    if (listing_filter_entry && *gtk_entry_get_text(GTK_ENTRY(listing_filter_entry))) {
+        g_signal_handlers_block_by_func(listing_filter_entry, on_listing_filter_changed, NULL);
+        gtk_entry_set_text(GTK_ENTRY(listing_filter_entry), "");
+        g_signal_handlers_unblock_by_func(listing_filter_entry, on_listing_filter_changed, NULL);
+    }
+    g_clear_pointer(&dir_model->filter, g_free);
+    g_clear_pointer(&scan_readme_path, g_free);
+    watch_directory(dir);
+    git_status_show(dir);
+
+    scan_dir_stat_valid = stat(dir, &scan_dir_stat) == 0;
+    ListingCacheEntry *cached = scan_dir_stat_valid ? listing_cache_lookup(&scan_dir_stat) : NULL;
+    if (cached) {
+        // Unchanged since we last listed it: repaint from the cache, no scan.
+        EntryBatch batch = {
+            .generation = scan_generation,
+            .records = cached->records,
+            .names = cached->names,
+            .done = TRUE,
+            .from_cache = TRUE,
+        };
+        show_entry_batch(&batch);
+        return;
+    }
+
+    ScanJob *job = g_new0(ScanJob, 1);
+    job->generation = scan_generation;
+    job->dir = g_strdup(dir);
+    job->cancellable = g_object_ref(scan_cancellable);
+    g_thread_pool_push(scan_pool, job, NULL);
+}
+
+static void navigate_up_directory() {
+    if (strcmp(current_dir, base_dir) == 0) {
+        return;
+    }
+
+    char *last_slash = strrchr(current_dir, '/');
+    if (last_slash != NULL) {
+        *last_slash = '\0';
+        if (strcmp(current_dir, base_dir) >= 0) {
+            display_directory(current_dir);
+        } else {
+            strcpy(current_dir, base_dir);
+            display_directory(current_dir);
+        }
+    }
+}
+
+gboolean is_executable(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        return st.st_mode & S_IXUSR;
+    }
+    return FALSE;
+}
+
+static gboolean on_key_press(GtkWidget *widget __attribute__((unused)), GdkEventKey *event, gpointer userdata __attribute__((unused))) {
+    VteTerminal *term = current_terminal();
+    if (event->keyval == GDK_KEY_BackSpace && !(term && vte_terminal_get_has_selection(term))) {
+        navigate_up_directory();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_n) {
+        show_new_directory_dialog();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_d) {
+        show_deletion_dialog();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_z) {
+        undo_last_trash();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_r) {
+        GPtrArray *names = get_selected_names();
+
+        if (names->len > 0) {
+            char *path = g_strdup_printf("%s/%s", current_dir, (const char *)g_ptr_array_index(names, 0));
+            const char *language = get_language_from_path(path);
+
+            compile_and_run(path, language);
+            g_free(path);
+        }
+        g_ptr_array_unref(names);
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_e) {
+        // Toggle: clear the bit if every selected file already has it.
+        GPtrArray *names = get_selected_names();
+        gboolean all_executable = names->len > 0;
+
+        for (guint i = 0; i < names->len && all_executable; i++) {
+            char *path = g_strdup_printf("%s/%s", current_dir, (const char *)g_ptr_array_index(names, i));
+            all_executable = is_executable(path);
+            g_free(path);
+        }
+        set_files_executable(names, !all_executable);
+        g_ptr_array_unref(names);
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_t) {
+        run_in_tab("shell", "Shell", current_dir, NULL);
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_b) {
+        start_build_all();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_j) {
+        show_job_history();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_p) {
+        show_finder();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_F) {
+        show_search();
+        return TRUE;
+    }
+    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_f) {
+        show_new_file_dialog();
+        return TRUE;
+    }
+
+    // Typing over the listing goes to the filter box.
+    gunichar ch = gdk_keyval_to_unicode(event->keyval);
+    if (ch && g_unichar_isgraph(ch) && !(event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK))) {
+        gtk_entry_grab_focus_without_selecting(GTK_ENTRY(listing_filter_entry));
+        gtk_editable_set_position(GTK_EDITABLE(listing_filter_entry), -1);
+        return gtk_widget_event(listing_filter_entry, (GdkEvent *)event);
+    }
+    return FALSE;
+}
+
+// Frees a menu item's path when its handler is disconnected.
+static void free_menu_path(gpointer data, GClosure *closure __attribute__((unused))) {
+    g_free(data);
+}
+
+static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer userdata __attribute__((unused))) {
+    if (event->type == GDK_BUTTON_PRESS && event->button == 3) {
+        GtkTreePath *path;
+        GtkTreeView *tree_view = GTK_TREE_VIEW(widget);
+
+        if (gtk_tree_view_get_path_at_pos(tree_view, (gint)event->x, (gint)event->y, &path, NULL, NULL, NULL)) {
+            GtkTreeModel *model = gtk_tree_view_get_model(tree_view);
+            GtkTreeSelection *selection = gtk_tree_view_get_selection(tree_view);
+            GtkTreeIter iter;
+
+            // Right-clicking outside the selection acts on the clicked row only.
+            if (!gtk_tree_selection_path_is_selected(selection, path)) {
+                gtk_tree_selection_unselect_all(selection);
+                gtk_tree_selection_select_path(selection, path);
+            }
+            gboolean several = gtk_tree_selection_count_selected_rows(selection) > 1;
+
+            if (gtk_tree_model_get_iter(model, &iter, path)) {
+                // Construct the full path
+                gchar *file_path = g_strdup_printf("%s/%s", current_dir, dir_model_iter_name(dir_model, &iter));
+
+                struct stat path_stat;
+                if (stat(file_path, &path_stat) == 0 && !S_ISDIR(path_stat.st_mode)) {  // Check if not a directory
+                    GtkWidget *menu = gtk_menu_new();
+
+                    // Create and add "Make File Executable" item
+                    GtkWidget *make_exec_item = gtk_menu_item_new_with_label(several ? "Make Selected Files Executable" : "Make File Executable");
+                    g_signal_connect(make_exec_item, "activate", G_CALLBACK(make_file_executable_menu), NULL);
+                    gtk_menu_shell_append(GTK_MENU_SHELL(menu), make_exec_item);
+
+                    // Create and add "Make File Not Executable" item
+                    GtkWidget *make_not_exec_item = gtk_menu_item_new_with_label(several ? "Make Selected Files Not Executable" : "Make File Not Executable");
+                    g_signal_connect(make_not_exec_item, "activate", G_CALLBACK(make_file_not_executable_menu), NULL);
+                    gtk_menu_shell_append(GTK_MENU_SHELL(menu), make_not_exec_item);
+
+                    // Create and add "Run" item if the file is executable
+                    if (is_executable(file_path)) {
+                        GtkWidget *run_item = gtk_menu_item_new_with_label("Run");
+                        g_signal_connect(run_item, "activate", G_CALLBACK(run_executable), g_strdup(file_path));
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), run_item);
+
+                        GtkWidget *bench_item = gtk_menu_item_new_with_label("Benchmark...");
+                        g_signal_connect_data(bench_item, "activate", G_CALLBACK(benchmark_executable),
+                                              g_strdup(file_path), free_menu_path, 0);
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), bench_item);
+
+                        GtkWidget *stat_item = gtk_menu_item_new_with_label("Profile (perf stat)");
+                        g_signal_connect_data(stat_item, "activate", G_CALLBACK(profile_stat_executable),
+                                              g_strdup(file_path), free_menu_path, 0);
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), stat_item);
+
+                        GtkWidget *record_item = gtk_menu_item_new_with_label("Profile (perf record)");
+                        g_signal_connect_data(record_item, "activate", G_CALLBACK(profile_record_executable),
+                                              g_strdup(file_path), free_menu_path, 0);
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), record_item);
+                    }
+
+                    // Builds from Ctrl+R keep frame pointers and debug info while this is on,
+                    // so it's only offered on files Ctrl+R builds.
+                    const char *language = language_for_path(base_dir, file_path);
+                    if (language && (strcmp(language, "C") == 0 || strcmp(language, "Assembly") == 0)) {
+                        GtkWidget *profile_builds_item = gtk_check_menu_item_new_with_label("Build for Profiling");
+                        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(profile_builds_item), settings.profile_builds);
+                        g_signal_connect(profile_builds_item, "toggled", G_CALLBACK(toggle_profile_builds), NULL);
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
+                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), profile_builds_item);
+                    }
+
+                    // The items' paths are freed with the menu, once it has closed.
+                    g_signal_connect(menu, "selection-done", G_CALLBACK(gtk_widget_destroy), NULL);
+                    gtk_widget_show_all(menu);
+                    gtk_menu_popup_at_pointer(GTK_MENU(menu), (GdkEvent *)event);
+                } else {
+                    g_print("Right-clicked on a directory or invalid path: %s\n", file_path);
+                }
+
+                g_free(file_path);
+            }
+            gtk_tree_path_free(path);
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void run_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
+    const char *file_path = (const char *)user_data;
+    gchar *clean_path = g_strdup(file_path); // Duplicate the file path
+    gchar *command = g_strdup_printf("clear && '%s'", clean_path); // Use single quotes to handle spaces in paths
+    gchar *title = g_path_get_basename(clean_path);
+
+    g_print("Running executable: %s\n", clean_path); // Debug print
+    g_print("Command: %s\n", command); // Print the command for debugging
+
+    run_in_tab("run", title, current_dir, command);
+
+    g_free(title);
+    g_free(command);
+    g_free(clean_path);
+    g_free((char *)file_path);  // Free the strdup-ed file path
+}
+
+void make_file_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data __attribute__((unused))) {
+    GPtrArray *names = get_selected_names();
+    set_files_executable(names, TRUE);
+    g_ptr_array_unref(names);
+}
+
+void make_file_not_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data __attribute__((unused))) {
+    GPtrArray *names = get_selected_names();
+    set_files_executable(names, FALSE);
+    g_ptr_array_unref(names);
+}
+
+static void on_row_activated(GtkTreeView *treeview, GtkTreePath *path, GtkTreeViewColumn *col __attribute__((unused)), gpointer userdata __attribute__((unused))) {
+    GtkTreeModel *model = gtk_tree_view_get_model(treeview);
+    GtkTreeIter iter;
+
+    if (gtk_tree_model_get_iter(model, &iter, path)) {
+        char *new_path = g_strdup_printf("%s/%s", current_dir, dir_model_iter_name(dir_model, &iter));
+        struct stat path_stat;
+        if (stat(new_path, &path_stat) == 0) {
+            if (S_ISDIR(path_stat.st_mode)) {
+                g_free(current_dir);
+                current_dir = new_path;
+                display_directory(current_dir);
+            } else {
+                open_file_with_appropriate_application(new_path);
+                g_free(new_path);
+            }
+        } else {
+            g_printerr("Failed to access %s: %s\n", new_path, strerror(errno));
+            g_free(new_path);
+        }
+    }
+}
+
+// Colours directories blue and executables red straight from the entry record.
+static void render_entry_name(GtkTreeViewColumn *column __attribute__((unused)), GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data __attribute__((unused))) {
+    const EntryRecord *rec = dir_model_iter_record(DIR_MODEL(model), iter);
+    const char *colour = NULL;
+
+    if (S_ISDIR(rec->mode)) {
+        colour = "blue";
+    } else if (rec->mode & S_IXUSR) {
+        colour = "red";
+    }
+    g_object_set(renderer, "text", dir_model_iter_name(DIR_MODEL(model), iter), "foreground", colour, NULL);
+}
+
+// Directories show "..." until their total has been measured.
+static void render_entry_size(GtkTreeViewColumn *column __attribute__((unused)), GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data __attribute__((unused))) {
+    const EntryRecord *rec = dir_model_iter_record(DIR_MODEL(model), iter);
+    gchar *text = S_ISDIR(rec->mode) && dir_size_lookup_child(dir_model_iter_name(DIR_MODEL(model), iter)) == NULL
+                      ? g_strdup("...")
+                      : g_format_size(rec->size);
+    g_object_set(renderer, "text", text, NULL);
+    g_free(text);
+}
+
+static void render_entry_git(GtkTreeViewColumn *column __attribute__((unused)), GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data __attribute__((unused))) {
+    static const char *marks[] = {"", "!", "?", "M"};
+    static const char *colours[] = {NULL, "grey", "green", "orange"};
+    const EntryRecord *rec = dir_model_iter_record(DIR_MODEL(model), iter);
+    GitStatus status = git_status_lookup(dir_model_iter_name(DIR_MODEL(model), iter), S_ISDIR(rec->mode));
+    g_object_set(renderer, "text", marks[status], "foreground", colours[status], NULL);
+}
+
+static GtkWidget* create_tree_view() {
+    tree_view = gtk_tree_view_new();
+    dir_model = dir_model_new();
+    dir_model_set_sort(dir_model, settings.listing_sort, settings.listing_dirs_first);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(dir_model));
+
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_title(column, "Entries");
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(column, renderer, render_entry_name, NULL, NULL);
+
+    // Fixed row heights let the view skip measuring every row on large listings.
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 260);
+    gtk_tree_view_column_set_resizable(column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+    GtkCellRenderer *size_renderer = gtk_cell_renderer_text_new();
+    g_object_set(size_renderer, "xalign", 1.0, NULL);
+    size_column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_title(size_column, "Size");
+    gtk_tree_view_column_pack_start(size_column, size_renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(size_column, size_renderer, render_entry_size, NULL, NULL);
+    gtk_tree_view_column_set_sizing(size_column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(size_column, 80);
+    gtk_tree_view_column_set_visible(size_column, settings.listing_dir_sizes);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), size_column);
+
+    GtkCellRenderer *git_renderer = gtk_cell_renderer_text_new();
+    g_object_set(git_renderer, "xalign", 0.5, "weight", PANGO_WEIGHT_BOLD, NULL);
+    git_column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_title(git_column, "Git");
+    gtk_tree_view_column_pack_start(git_column, git_renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(git_column, git_renderer, render_entry_git, NULL, NULL);
+    gtk_tree_view_column_set_sizing(git_column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(git_column, 36);
+    gtk_tree_view_column_set_visible(git_column, settings.listing_git_status);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), git_column);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(tree_view), TRUE);
+
+    gtk_tree_selection_set_mode(gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view)), GTK_SELECTION_MULTIPLE);
+
+    g_signal_connect(tree_view, "row-activated", G_CALLBACK(on_row_activated), NULL);
+    g_signal_connect(tree_view, "key-press-event", G_CALLBACK(on_key_press), NULL);
+    g_signal_connect(tree_view, "button-press-event", G_CALLBACK(on_button_press), NULL);
+
+    return tree_view;
+}
+
+// Refiltering replaces the visible rows wholesale, so the view is detached
+// for it instead of being sent a signal per row.
+static void on_listing_filter_changed(GtkEditable *editable, gpointer data __attribute__((unused))) {
+    TRACE_START(trace_start);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), NULL);
+    dir_model_set_filter(dir_model, gtk_entry_get_text(GTK_ENTRY(editable)));
+    gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(dir_model));
+    TRACE_ENDF(trace_start, "model", "filter listing", "%u rows", dir_model->rows->len);
+}
+
+static void on_listing_filter_activate(GtkEntry *entry __attribute__((unused)), gpointer data __attribute__((unused))) {
+    if (dir_model->rows->len > 0) {
+        GtkTreePath *path = gtk_tree_path_new_first();
+        gtk_tree_view_row_activated(GTK_TREE_VIEW(tree_view), path, NULL);
+        gtk_tree_path_free(path);
+    }
+}
+
+static gboolean on_listing_filter_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data __attribute__((unused))) {
+    if (event->keyval == GDK_KEY_Escape) {
+        gtk_entry_set_text(GTK_ENTRY(widget), "");
+        gtk_widget_grab_focus(tree_view);
+        return TRUE;
+    }
+    if (event->keyval == GDK_KEY_Down) {
+        gtk_widget_grab_focus(tree_view);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static void on_listing_sort_changed(GtkComboBox *combo, gpointer data __attribute__((unused))) {
+    settings.listing_sort = gtk_combo_box_get_active(combo);
+    dir_model_set_sort(dir_model, settings.listing_sort, settings.listing_dirs_first);
+}
+
+static void on_listing_dirs_first_toggled(GtkToggleButton *button, gpointer data __attribute__((unused))) {
+    settings.listing_dirs_first = gtk_toggle_button_get_active(button);
+    dir_model_set_sort(dir_model, settings.listing_sort, settings.listing_dirs_first);
+}
+
+static GtkWidget *create_listing_controls(void) {
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+
+    listing_filter_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(listing_filter_entry), "Filter");
+    g_signal_connect(listing_filter_entry, "changed", G_CALLBACK(on_listing_filter_changed), NULL);
+    g_signal_connect(listing_filter_entry, "activate", G_CALLBACK(on_listing_filter_activate), NULL);
+    g_signal_connect(listing_filter_entry, "key-press-event", G_CALLBACK(on_listing_filter_key_press), NULL);
+    gtk_box_pack_start(GTK_BOX(box), listing_filter_entry, TRUE, TRUE, 0);
+
+    GtkWidget *sort_combo = gtk_combo_box_text_new();
+    for (gint i = 0; i < DIR_SORT_N_MODES; i++) {
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(sort_combo), listing_sort_labels[i]);
+    }
+    gtk_combo_box_set_active(GTK_COMBO_BOX(sort_combo), settings.listing_sort);
+    g_signal_connect(sort_combo, "changed", G_CALLBACK(on_listing_sort_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(box), sort_combo, FALSE, FALSE, 0);
+
+    GtkWidget *dirs_first = gtk_check_button_new_with_mnemonic("_Dirs first");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dirs_first), settings.listing_dirs_first);
+    g_signal_connect(dirs_first, "toggled", G_CALLBACK(on_listing_dirs_first_toggled), NULL);
+    gtk_box_pack_start(GTK_BOX(box), dirs_first, FALSE, FALSE, 0);
+
+    GtkWidget *sizes = gtk_check_button_new_with_mnemonic("Si_zes");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(sizes), settings.listing_dir_sizes);
+    g_signal_connect(sizes, "toggled", G_CALLBACK(on_listing_sizes_toggled), NULL);
+    gtk_box_pack_start(GTK_BOX(box), sizes, FALSE, FALSE, 0);
+
+    return box;
+}
+
+static void on_window_destroy(GtkWidget *widget __attribute__((unused)), gpointer data __attribute__((unused))) {
+    if (scan_cancellable) {
+        g_cancellable_cancel(scan_cancellable);
+    }
+    close(inotify_fd);
+    if (editor_socket_path) {
+        unlink(editor_socket_path);
+    }
+    if (job_fifo_path && job_fifo_fd >= 0) {
+        unlink(job_fifo_path);
+    }
+    if (path_index && index_dirty && !index_walking) {
+        path_index_save(path_index, base_dir, index_cache_path);
+    }
+    workspace_tree_save_state();
+    session_save();
+    g_free(base_dir);
+    g_free(current_dir);
+    gtk_main_quit();
+}
+
+/*
+static int get_directory_depth(const char *dir) {
+    const char *base = base_dir;
+    const char *tmp = dir;
+
+    while (*base != '\0' && *tmp == *base) {
+        base++;
+        tmp++;
+    }
+
+    int depth = 0;
+    while (*tmp != '\0') {
+        if (*tmp == '/') {
+            depth++;
+        }
+        tmp++;
+    }
+
+    return depth;
+}
+*/
+
+static const char *get_language_from_path(const char *path) {
+    if (!path) {
+        printf("Error: Path is NULL\n");
+        return NULL;
+    }
+
+    const char *language = language_for_path(base_dir, path);
+    if (language) {
+        printf("Detected language: %s\n", language);
+    } else {
+        printf("No recognized language found in the directory name.\n");
+    }
+
+    return language;
+}
+
+static void compile_and_run(const char *path, const char *language) {
+    if (path == NULL) {
+        g_print("Error: Path is NULL\n");
+        return;
+    }
+
+    char *clean_path = g_strdup(path);
+
+    gchar *compile_cmd = NULL;
+    gboolean queued = FALSE;
+    gchar *cmd = g_strdup_printf("Are you sure you want to compile and run this %s program?", language);
+    if (show_confirmation_dialog(cmd)) {
+        gchar *dir_path = g_path_get_dirname(clean_path);
+        if (dir_path == NULL) {
+            g_print("Error: Unable to determine directory from path: %s\n", clean_path);
+            g_free(cmd);
+            g_free(clean_path);
+            return;
+        }
+
+        if (strcasecmp(language, "C") == 0 || strcasecmp(language, "Assembly") == 0) {
+            BuildPlanJob *job = g_new0(BuildPlanJob, 1);
+            job->plan = build_plan_new(clean_path, language);
+            job->title = g_path_get_basename(clean_path);
+            // A background build still running would race the terminal's.
+            cancel_speculative_build(job->plan->target);
+            g_thread_pool_push(build_plan_pool, job, NULL);
+            queued = TRUE;
+        } else if (strcasecmp(language, "Python3") == 0) {
+            compile_cmd = g_strdup_printf("clear && cd %s && python3 %s\n", dir_path, clean_path);
+        }
+
+        g_free(dir_path);
+
+        if (compile_cmd) {
+            g_print("Compile command: %s\n", compile_cmd);
+            gchar *title = g_path_get_basename(clean_path);
+            run_in_tab("build", title, NULL, compile_cmd);
+            g_free(title);
+            g_free(compile_cmd);
+        } else if (!queued) {
+            g_print("Unsupported language: %s\n", language);
+        }
+    }
+    g_free(cmd);
+    g_free(clean_path);
+}
+
+// Names of the selected rows, in view order.
+static GPtrArray *get_selected_names(void) {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
+    GList *rows = gtk_tree_selection_get_selected_rows(selection, NULL);
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+
+    for (GList *l = rows; l != NULL; l = l->next) {
+        GtkTreeIter iter;
+        if (gtk_tree_model_get_iter(GTK_TREE_MODEL(dir_model), &iter, l->data)) {
+            g_ptr_array_add(names, g_strdup(dir_model_iter_name(dir_model, &iter)));
+        }
+    }
+
+    g_list_free_full(rows, (GDestroyNotify)gtk_tree_path_free);
+    return names;
+}
+
+// Sets or clears the execute bits the way chmod +x / -x would, for entries of
+// the current directory, and refreshes their rows in the same pass.
+static void set_files_executable(GPtrArray *names, gboolean executable) {
+    int dir_fd = open(current_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        g_printerr("Failed to open %s: %s\n", current_dir, strerror(errno));
+        return;
+    }
+
+    for (guint i = 0; i < names->len; i++) {
+        const char *name = g_ptr_array_index(names, i);
+        struct stat statbuf;
+
+        if (fstatat(dir_fd, name, &statbuf, 0) != 0 || S_ISDIR(statbuf.st_mode)) {
+            continue;
+        }
+
+        mode_t mode = statbuf.st_mode & 07777;
+        mode = executable ? (mode | (0111 & ~file_umask)) : (mode & ~0111);
+        if (mode == (statbuf.st_mode & 07777)) {
+            continue;
+        }
+        if (fchmodat(dir_fd, name, mode, 0) != 0) {
+            g_printerr("Failed to change mode of %s: %s\n", name, strerror(errno));
+            continue;
+        }
+
+        EntryRecord rec = {
+            .mode = (statbuf.st_mode & S_IFMT) | mode,
+            .size = statbuf.st_size,
+            .mtime = statbuf.st_mtime,
+            .type = DT_REG,
+        };
+        dir_model_upsert(dir_model, name, NULL, &rec);
+    }
+    dir_model_sort_pending(dir_model);
+
+    close(dir_fd);
+    if (scan_dir_stat_valid) {
+        listing_cache_invalidate(&scan_dir_stat);
+    }
+}
+
+static void create_new_file(const char *file_name) {
+    if (file_name == NULL) return;
+
+    gchar *full_path = g_strdup_printf("%s/%s", current_dir, file_name);
+    FILE *file = fopen(full_path, "w");
+    if (file) {
+        fclose(file);
+    } else {
+        g_print("Error creating file: %s\n", strerror(errno));
+    }
+    g_free(full_path);
+}
+
+static void show_new_file_dialog() {
+    GtkWidget *dialog, *content_area, *entry;
+    dialog = gtk_dialog_new_with_buttons("New File", GTK_WINDOW(window),
+                                         GTK_DIALOG_MODAL,
+                                         "_OK", GTK_RESPONSE_OK,
+                                         "_Cancel", GTK_RESPONSE_CANCEL,
+                                         NULL);
+    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    entry = gtk_entry_new();
+    gtk_container_add(GTK_CONTAINER(content_area), entry);
+    gtk_widget_show_all(dialog);
+
+    TRACE_START(trace_start);
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    TRACE_END(trace_start, "dialog", "new file", NULL);
+    if (response == GTK_RESPONSE_OK) {
+        const char *file_name = gtk_entry_get_text(GTK_ENTRY(entry));
+        create_new_file(file_name);
+    }
+    gtk_widget_destroy(dialog);
+}
+
+static void show_new_directory_dialog() {
+    GtkWidget *dialog, *content_area, *entry;
+    dialog = gtk_dialog_new_with_buttons("New Directory", GTK_WINDOW(window),
+                                         GTK_DIALOG_MODAL,
+                                         "_OK", GTK_RESPONSE_OK,
+                                         "_Cancel", GTK_RESPONSE_CANCEL,
+                                         NULL);
+    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    entry = gtk_entry_new();
+    gtk_container_add(GTK_CONTAINER(content_area), entry);
+    gtk_widget_show_all(dialog);
+
+    TRACE_START(trace_start);
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    TRACE_END(trace_start, "dialog", "new directory", NULL);
+    if (response == GTK_RESPONSE_OK) {
+        const char *dir_name = gtk_entry_get_text(GTK_ENTRY(entry));
+        create_new_directory(dir_name);
+    }
+    gtk_widget_destroy(dialog);
+}
+
+static void create_new_directory(const char *dir_name) {
+    if (dir_name == NULL) return;
+
+    gchar *full_path = g_strdup_printf("%s/%s", current_dir, dir_name);
+    if (mkdir(full_path, 0755) == -1) {
+        g_print("Error creating directory: %s\n", strerror(errno));
+    }
+    g_free(full_path);
+}
+
+/*
+static int get_directory_depth(const char *dir) {
+    const char *base = base_dir;
+    const char *tmp = dir;
+
+    while (*base != '\0' && *tmp == *base) {
+        base++;
+        tmp++;
+    }
+
+    int depth = 0;
+    while (*tmp != '\0') {
+        if (*tmp == '/') {
+            depth++;
+        }
+        tmp++;
+    }
+
+    return depth;
+}
+*/
+
+static gboolean delete_job_done(gpointer data);
+
+static void on_delete_job_finished(DeleteJob *job) {
+    g_idle_add(delete_job_done, job);
+}
+
+static gboolean update_delete_progress(gpointer data __attribute__((unused))) {
+    if (active_delete == NULL) {
+        delete_progress_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    guint64 entries = __atomic_load_n(&active_delete->entries, __ATOMIC_RELAXED);
+    guint64 bytes = __atomic_load_n(&active_delete->bytes, __ATOMIC_RELAXED);
+    gchar *size = g_format_size(bytes);
+    gchar *text = g_strdup_printf("Deleting: %" G_GUINT64_FORMAT " entries, %s", entries, size);
+
+    gtk_progress_bar_pulse(GTK_PROGRESS_BAR(delete_progress_bar));
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(delete_progress_bar), text);
+
+    g_free(text);
+    g_free(size);
+    return G_SOURCE_CONTINUE;
+}
+
+static void show_delete_errors(GPtrArray *errors) {
+    GString *message = g_string_new(NULL);
+    guint shown = MIN(errors->len, 20);
+
+    for (guint i = 0; i < shown; i++) {
+        g_string_append_printf(message, "%s\n", (const char *)g_ptr_array_index(errors, i));
+    }
+    if (errors->len > shown) {
+        g_string_append_printf(message, "... and %u more\n", errors->len - shown);
+    }
+
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window),
+                                               GTK_DIALOG_DESTROY_WITH_PARENT,
+                                               GTK_MESSAGE_ERROR,
+                                               GTK_BUTTONS_CLOSE,
+                                               "Some entries could not be deleted");
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog), "%s", message->str);
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show_all(dialog);
+
+    g_string_free(message, TRUE);
+}
+
+static gboolean delete_job_done(gpointer data) {
+    DeleteJob *job = data;
+
+    if (job == active_delete) {
+        active_delete = NULL;
+        gtk_widget_hide(delete_progress_box);
+    }
+
+    for (guint i = 0; i < job->errors->len; i++) {
+        g_printerr("Failed to delete %s\n", (const char *)g_ptr_array_index(job->errors, i));
+    }
+    if (job->errors->len > 0 && !job->background) {
+        show_delete_errors(job->errors);
+    }
+
+    delete_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_delete_cancel(GtkButton *button __attribute__((unused)), gpointer data __attribute__((unused))) {
+    if (active_delete) {
+        g_cancellable_cancel(active_delete->cancellable);
+    }
+}
+
+// Starts deleting the given paths in the background. Files are unlinked right
+// away; directories are handed to the pool and reported on through the
+// progress bar under the listing.
+static void delete_paths(GPtrArray *paths) {
+    if (active_delete) {
+        g_print("A deletion is already running\n");
+        return;
+    }
+
+    DeleteJob *job = delete_job_new(delete_pool, FALSE, on_delete_job_finished, NULL);
+    for (guint i = 0; i < paths->len; i++) {
+        delete_job_add_path(job, g_ptr_array_index(paths, i));
+    }
+
+    active_delete = job;
+    if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+        delete_job_done(job);
+        return;
+    }
+
+    gtk_widget_show(delete_progress_box);
+    update_delete_progress(NULL);
+    if (delete_progress_id == 0) {
+        delete_progress_id = g_timeout_add(DELETE_PROGRESS_INTERVAL_MS, update_delete_progress, NULL);
+    }
+}
+
+// Purging runs on its own thread at idle CPU and I/O priority so it never
+// competes with builds or the UI.
+static gpointer purge_thread(gpointer data __attribute__((unused))) {
+    pid_t tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    for (;;) {
+        gchar *path = g_async_queue_pop(purge_queue);
+        DeleteJob *job = delete_job_new(NULL, TRUE, on_delete_job_finished, NULL);
+        delete_job_add_path(job, path);
+        if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+            g_idle_add(delete_job_done, job);
+        }
+        g_free(path);
+    }
+    return NULL;
+}
+
+// The trash for path lives at the top of the workspace, or at the topmost
+// ancestor on path's filesystem when path sits on a different mount, so the
+// move into it is always a same-filesystem rename.
+static gchar *trash_dir_for(const char *path) {
+    struct stat target, ancestor;
+    if (lstat(path, &target) != 0) {
+        return NULL;
+    }
+
+    gchar *top = g_path_get_dirname(path);
+    while (strlen(top) > strlen(base_dir)) {
+        gchar *up = g_path_get_dirname(top);
+        if (stat(up, &ancestor) != 0 || ancestor.st_dev != target.st_dev) {
+            g_free(up);
+            break;
+        }
+        g_free(top);
+        top = up;
+    }
+
+    gchar *trash = g_build_filename(top, TRASH_DIR_NAME, NULL);
+    g_free(top);
+    if (mkdir(trash, 0700) != 0 && errno != EEXIST) {
+        g_printerr("Failed to create trash directory %s: %s\n", trash, strerror(errno));
+        g_clear_pointer(&trash, g_free);
+    }
+    return trash;
+}
+
+static void trash_item_free(TrashItem *item) {
+    g_free(item->original_path);
+    g_free(item->trash_path);
+    g_free(item);
+}
+
+static void trash_paths(GPtrArray *paths) {
+    for (guint i = 0; i < paths->len; i++) {
+        const char *path = g_ptr_array_index(paths, i);
+        gchar *trash = trash_dir_for(path);
+        if (trash == NULL) {
+            continue;
+        }
+
+        gchar *name = g_path_get_basename(path);
+        TrashItem *item = g_new0(TrashItem, 1);
+        item->original_path = g_strdup(path);
+        item->trashed_at = g_get_real_time();
+        item->trash_path = g_strdup_printf("%s/%s.%" G_GINT64_FORMAT, trash, name, item->trashed_at);
+
+        if (rename(path, item->trash_path) == 0) {
+            g_queue_push_tail(&trash_items, item);
+        } else {
+            g_printerr("Failed to move %s to the trash: %s\n", path, strerror(errno));
+            trash_item_free(item);
+        }
+
+        g_free(name);
+        g_free(trash);
+    }
+}
+
+// Puts the most recently trashed entry back where it was.
+static void undo_last_trash(void) {
+    TrashItem *item = g_queue_pop_tail(&trash_items);
+    if (item == NULL) {
+        g_print("Nothing to undo\n");
+        return;
+    }
+
+    struct stat statbuf;
+    if (lstat(item->original_path, &statbuf) == 0) {
+        g_printerr("Cannot restore %s: something else is there now\n", item->original_path);
+        g_queue_push_tail(&trash_items, item);
+        return;
+    }
+    if (rename(item->trash_path, item->original_path) != 0) {
+        g_printerr("Failed to restore %s: %s\n", item->original_path, strerror(errno));
+    }
+    trash_item_free(item);
+}
+
+static gboolean purge_expired_trash(gpointer data __attribute__((unused))) {
+    gint64 cutoff = g_get_real_time() - (gint64)settings.trash_grace_seconds * G_USEC_PER_SEC;
+    TrashItem *item;
+
+    while ((item = g_queue_peek_head(&trash_items)) && item->trashed_at <= cutoff) {
+        g_queue_pop_head(&trash_items);
+        g_async_queue_push(purge_queue, g_steal_pointer(&item->trash_path));
+        trash_item_free(item);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Anything left in the workspace trash from an earlier session can't be
+// undone any more.
+static void purge_leftover_trash(void) {
+    gchar *trash = g_build_filename(base_dir, TRASH_DIR_NAME, NULL);
+    DIR *d = opendir(trash);
+    struct dirent *entry;
+
+    if (d) {
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                g_async_queue_push(purge_queue, g_build_filename(trash, entry->d_name, NULL));
+            }
+        }
+        closedir(d);
+    }
+    g_free(trash);
+}
+
+static GtkWidget *create_delete_progress_box(void) {
+    delete_progress_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    delete_progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(delete_progress_bar), TRUE);
+    gtk_box_pack_start(GTK_BOX(delete_progress_box), delete_progress_bar, TRUE, TRUE, 0);
+
+    GtkWidget *cancel = gtk_button_new_with_label("Cancel");
+    g_signal_connect(cancel, "clicked", G_CALLBACK(on_delete_cancel), NULL);
+    gtk_box_pack_start(GTK_BOX(delete_progress_box), cancel, FALSE, FALSE, 0);
+
+    // Only shown while a deletion is running.
+    gtk_widget_show(delete_progress_bar);
+    gtk_widget_show(cancel);
+    gtk_widget_set_no_show_all(delete_progress_box, TRUE);
+    return delete_progress_box;
+}
+
+static void show_deletion_dialog() {
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window),
+                                               GTK_DIALOG_MODAL,
+                                               GTK_MESSAGE_WARNING,
+                                               GTK_BUTTONS_NONE,
+                                               "Are you sure you want to delete the selected items?");
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+                                             "Moving to the trash is instant and can be undone with Ctrl+Z.");
+    gtk_dialog_add_button(GTK_DIALOG(dialog), "_Cancel", GTK_RESPONSE_CANCEL);
+    gtk_dialog_add_button(GTK_DIALOG(dialog), "Delete _Permanently", GTK_RESPONSE_REJECT);
+    gtk_dialog_add_button(GTK_DIALOG(dialog), "Move to _Trash", GTK_RESPONSE_OK);
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_OK);
+    TRACE_START(trace_start);
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    TRACE_END(trace_start, "dialog", "delete", NULL);
+    gtk_widget_destroy(dialog);
+
+    if (response == GTK_RESPONSE_OK) {
+        delete_selected_item(TRUE);
+    } else if (response == GTK_RESPONSE_REJECT) {
+        delete_selected_item(FALSE);
+    }
+}
+
+static void delete_selected_item(gboolean to_trash) {
+    GPtrArray *names = get_selected_names();
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+
+    for (guint i = 0; i < names->len; i++) {
+        g_ptr_array_add(paths, g_strdup_printf("%s/%s", current_dir, (const char *)g_ptr_array_index(names, i)));
+    }
+    if (paths->len > 0) {
+        if (to_trash) {
+            trash_paths(paths);
+        } else {
+            delete_paths(paths);
+        }
+    }
+
+    g_ptr_array_unref(paths);
+    g_ptr_array_unref(names);
+}
+
+static gboolean index_skip_dir(const char *name) {
+    return workspace_skip_dir(name, settings.ignore_dirs);
+}
+
+static void index_job_free(IndexJob *job) {
+    if (job->index) {
+        path_index_free(job->index);
+    }
+    g_free(job->root);
+    g_free(job->prefix);
+    g_free(job);
+}
+
+static gboolean index_install(gpointer data);
+
+static void index_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    IndexJob *job = data;
+
+    // Serve the previous session's paths while the real walk runs.
+    if (job->load_cache) {
+        PathIndex *cached = path_index_load(job->root, index_cache_path);
+        if (cached) {
+            IndexJob *cache_job = g_new0(IndexJob, 1);
+            cache_job->kind = INDEX_JOB_CACHED;
+            cache_job->generation = job->generation;
+            cache_job->index = cached;
+            g_idle_add(index_install, cache_job);
+        }
+    }
+
+    job->index = path_index_new();
+    path_index_walk(job->index, job->root, job->prefix, settings.ignore_dirs, index_inotify_fd,
+                    INDEX_WATCH_MASK | (settings.speculative_builds || settings.listing_dir_sizes ? IN_CLOSE_WRITE : 0));
+    if (job->kind == INDEX_JOB_FULL) {
+        path_index_save(job->index, job->root, index_cache_path);
+    }
+    g_idle_add(index_install, job);
+}
+
+static void index_start_walk(const char *prefix, gboolean load_cache) {
+    IndexJob *job = g_new0(IndexJob, 1);
+    job->kind = prefix ? INDEX_JOB_SUBTREE : INDEX_JOB_FULL;
+    job->root = g_strdup(base_dir);
+    job->prefix = g_strdup(prefix ? prefix : "");
+    job->load_cache = load_cache;
+
+    if (job->kind == INDEX_JOB_FULL) {
+        index_generation++;
+        index_walking = TRUE;
+    }
+    job->generation = index_generation;
+    g_thread_pool_push(index_pool, job, NULL);
+}
+
+static void finder_refresh(void);
+static void index_apply_events(const char *buf, gsize len);
+
+static gboolean index_install(gpointer data) {
+    IndexJob *job = data;
+    TRACE_START(trace_start);
+
+    if (job->generation != index_generation) {
+        index_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (job->kind == INDEX_JOB_SUBTREE) {
+        // A directory appeared after the walk: fold its contents in.
+        if (path_index) {
+            for (guint32 i = 0; i < job->index->entries->len; i++) {
+                const IndexEntry *entry = &g_array_index(job->index->entries, IndexEntry, i);
+                path_index_add(path_index, job->index->paths->str + entry->offset, entry->length);
+            }
+            GHashTableIter iter;
+            gpointer wd, rel;
+            g_hash_table_iter_init(&iter, job->index->dirs);
+            while (g_hash_table_iter_next(&iter, &wd, &rel)) {
+                g_hash_table_insert(path_index->dirs, wd, g_strdup(rel));
+            }
+            path_index->watch_failed |= job->index->watch_failed;
+        }
+    } else if (job->kind == INDEX_JOB_CACHED) {
+        // The walk may already have finished; never replace a fresher index.
+        if (path_index == NULL) {
+            path_index = g_steal_pointer(&job->index);
+        }
+    } else {
+        if (path_index) {
+            path_index_free(path_index);
+        }
+        path_index = g_steal_pointer(&job->index);
+        index_walking = FALSE;
+        index_dirty = FALSE;
+
+        // Replay what happened to the tree while it was being walked.
+        index_apply_events((const char *)index_parked_events->data, index_parked_events->len);
+        g_byte_array_set_size(index_parked_events, 0);
+    }
+
+    index_serial++;
+    finder_refresh();
+    TRACE_ENDF(trace_start, "model", "install index", "%u paths", path_index ? path_index->live : 0);
+    index_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+// What a change in the tree means for everything but the path index. Called
+// for the window's own index watches and for the events a daemon forwards.
+static void index_note_event(const char *dir, const char *name, guint32 mask) {
+    git_status_note_change(dir, name);
+    if (is_hidden_entry(name)) {
+        return;
+    }
+    if (!(mask & IN_CLOSE_WRITE)) {
+        workspace_tree_note_change(dir);
+    }
+    dir_size_note_change(dir);
+
+    // Contents changed, the set of paths didn't.
+    if (mask & IN_CLOSE_WRITE && !(mask & IN_ISDIR) && settings.speculative_builds && build_cache_is_input(name)) {
+        gchar *rel = dir[0] ? g_strdup_printf("%s/%s", dir, name) : g_strdup(name);
+        schedule_speculative_build(rel);
+        g_free(rel);
+    }
+}
+
+static void index_apply_events(const char *buf, gsize len) {
+    for (const char *ptr = buf; ptr < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *)ptr;
+        ptr += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            index_start_walk(NULL, FALSE);
+            return;
+        }
+
+        const char *dir = g_hash_table_lookup(path_index->dirs, GINT_TO_POINTER(event->wd));
+        if (dir == NULL) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            g_hash_table_remove(path_index->dirs, GINT_TO_POINTER(event->wd));
+            continue;
+        }
+        if (event->len == 0) {
+            continue;
+        }
+        index_note_event(dir, event->name, event->mask);
+
+        gboolean is_dir = (event->mask & IN_ISDIR) != 0;
+        if (event->mask & IN_CLOSE_WRITE || (is_dir ? index_skip_dir(event->name) : is_hidden_entry(event->name))) {
+            continue;
+        }
+
+        gchar *rel = dir[0] ? g_strdup_printf("%s/%s", dir, event->name) : g_strdup(event->name);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (is_dir) {
+                index_start_walk(rel, FALSE);
+            } else {
+                path_index_add(path_index, rel, strlen(rel));
+            }
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            if (is_dir) {
+                gchar *prefix = g_strconcat(rel, "/", NULL);
+                path_index_remove_tree(path_index, prefix);
+                g_free(prefix);
+            } else {
+                path_index_remove(path_index, rel);
+            }
+        }
+        g_free(rel);
+        index_dirty = TRUE;
+    }
+    index_serial++;
+}
+
+static gboolean on_index_inotify_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(index_inotify_fd, buf, sizeof(buf))) > 0) {
+        // Until the walk lands there is no mapping for its watches yet.
+        if (index_walking || path_index == NULL) {
+            g_byte_array_append(index_parked_events, (const guint8 *)buf, len);
+        } else {
+            index_apply_events(buf, len);
+        }
+    }
+
+    if (!index_walking) {
+        finder_refresh();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// The file index has its own inotify instance: it watches the whole tree,
+// and sharing watch descriptors with the listing would let one side drop
+// the other's watch.
+static void index_init(void) {
+    index_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (index_inotify_fd < 0) {
+        perror("inotify_init");
+        return;
+    }
+    GIOChannel *index_channel = g_io_channel_unix_new(index_inotify_fd);
+    g_io_add_watch(index_channel, G_IO_IN, on_index_inotify_event, NULL);
+    g_io_channel_unref(index_channel);
+
+    index_parked_events = g_byte_array_new();
+    index_cache_path = g_build_filename(g_get_user_cache_dir(), "codews", "index.bin", NULL);
+    index_pool = g_thread_pool_new(index_worker, NULL, 1, FALSE, NULL);
+    index_start_walk(NULL, TRUE);
+}
+
+static void finder_query(const char *query, FinderHit *hits, guint *n_hits) {
+    // Typing more characters only narrows the previous matches.
+    gboolean narrowing = finder_last_query && finder_serial == index_serial &&
+                         g_str_has_prefix(query, finder_last_query);
+    GArray *matches = g_array_new(FALSE, FALSE, sizeof(guint32));
+    path_index_query(path_index, query, narrowing ? finder_matches : NULL, matches, hits, FINDER_MAX_RESULTS, n_hits);
+
+    if (finder_matches) {
+        g_array_free(finder_matches, TRUE);
+    }
+    finder_matches = matches;
+    g_free(finder_last_query);
+    finder_last_query = g_strdup(query);
+    finder_serial = index_serial;
+}
+
+static void finder_select_first(void) {
+    GtkTreePath *first = gtk_tree_path_new_first();
+    gtk_tree_view_set_cursor(GTK_TREE_VIEW(finder_view), first, NULL, FALSE);
+    gtk_tree_path_free(first);
+}
+
+static void finder_show_status(guint matched, guint files, gboolean walking, gint64 elapsed) {
+    gchar *status = g_strdup_printf("%u of %u files%s (%.1f ms)", matched, files,
+                                    walking ? ", still indexing" : "", elapsed / 1000.0);
+    gtk_label_set_text(GTK_LABEL(finder_status), status);
+    g_free(status);
+}
+
+static void finder_request_free(FinderRequest *request) {
+    if (request->reply) {
+        g_string_free(request->reply, TRUE);
+    }
+    g_free(request->query);
+    g_free(request);
+}
+
+static gboolean finder_deliver(gpointer data);
+
+// The pool has a single thread, so queries reach the daemon in order on one
+// connection and the daemon's narrowing state for it holds. A query that
+// has been typed over before its turn isn't sent at all.
+static void finder_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    FinderRequest *request = data;
+    if (request->generation != g_atomic_int_get(&finder_generation)) {
+        finder_request_free(request);
+        return;
+    }
+
+    const char *fields[] = {"find", request->query, NULL};
+    gint64 start = g_get_monotonic_time();
+    request->reply = daemon_thread_request(fields);
+    request->elapsed = g_get_monotonic_time() - start;
+    if (request->reply == NULL) {
+        // A daemon that is only slow still takes connections.
+        int fd = daemon_connect();
+        request->lost = fd < 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    g_idle_add(finder_deliver, request);
+}
+
+static gboolean finder_deliver(gpointer data) {
+    FinderRequest *request = data;
+    if (request->generation != g_atomic_int_get(&finder_generation) || !daemon_running) {
+        finder_request_free(request);
+        return G_SOURCE_REMOVE;
+    }
+    if (request->lost) {
+        daemon_lost();
+        finder_refresh();
+        finder_request_free(request);
+        return G_SOURCE_REMOVE;
+    }
+
+    gtk_list_store_clear(finder_store);
+    if (request->reply == NULL) {
+        gtk_label_set_text(GTK_LABEL(finder_status), "The codews daemon did not answer");
+        finder_request_free(request);
+        return G_SOURCE_REMOVE;
+    }
+    gchar **lines = g_strsplit(request->reply->str, "\n", -1);
+    guint matched, files;
+    gint walking;
+    if (sscanf(lines[0], "matched\t%u\t%u\t%d", &matched, &files, &walking) == 3) {
+        for (guint i = 1; lines[i] && lines[i][0]; i++) {
+            gtk_list_store_insert_with_values(finder_store, NULL, -1, 0, lines[i], -1);
+        }
+        if (lines[1] && lines[1][0]) {
+            finder_select_first();
+        }
+        finder_show_status(matched, files, walking, request->elapsed);
+    } else {
+        gtk_label_set_text(GTK_LABEL(finder_status), "Indexing workspace...");
+    }
+    g_strfreev(lines);
+    finder_request_free(request);
+    return G_SOURCE_REMOVE;
+}
+
+static void finder_refresh(void) {
+    if (finder_window == NULL || !gtk_widget_get_visible(finder_window)) {
+        return;
+    }
+
+    // Spaces are only separators; matching ignores case.
+    GString *query = g_string_new(NULL);
+    for (const char *p = gtk_entry_get_text(GTK_ENTRY(finder_entry)); *p; p++) {
+        if (*p != ' ') {
+            g_string_append_c(query, g_ascii_tolower(*p));
+        }
+    }
+
+    gint generation = g_atomic_int_add(&finder_generation, 1) + 1;
+    if (daemon_running) {
+        // The old results stay up until the daemon's answer replaces them.
+        FinderRequest *request = g_new0(FinderRequest, 1);
+        request->generation = generation;
+        request->query = g_string_free(query, FALSE);
+        g_thread_pool_push(finder_pool, request, NULL);
+        return;
+    }
+    gtk_list_store_clear(finder_store);
+    if (path_index == NULL) {
+        gtk_label_set_text(GTK_LABEL(finder_status), "Indexing workspace...");
+        g_string_free(query, TRUE);
+        return;
+    }
+
+    FinderHit hits[FINDER_MAX_RESULTS];
+    guint n_hits;
+    gint64 start = g_get_monotonic_time();
+    finder_query(query->str, hits, &n_hits);
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    for (guint i = 0; i < n_hits; i++) {
+        gtk_list_store_insert_with_values(finder_store, NULL, -1, 0, path_index_path(path_index, hits[i].entry), -1);
+    }
+    if (n_hits > 0) {
+        finder_select_first();
+    }
+    finder_show_status(finder_matches->len, path_index->live, index_walking, elapsed);
+    g_string_free(query, TRUE);
+}
+
+static void finder_open_selected(void) {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(finder_view));
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+
+    if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
+        gchar *rel;
+        gtk_tree_model_get(model, &iter, 0, &rel, -1);
+        gchar *path = g_build_filename(base_dir, rel, NULL);
+        gtk_widget_hide(finder_window);
+        open_file_with_appropriate_application(path);
+        g_free(path);
+        g_free(rel);
+    }
+}
+
+static void on_finder_changed(GtkEditable *editable __attribute__((unused)), gpointer data __attribute__((unused))) {
+    finder_refresh();
+}
+
+static void on_finder_activate(GtkEntry *entry __attribute__((unused)), gpointer data __attribute__((unused))) {
+    finder_open_selected();
+}
+
+static void on_finder_row_activated(GtkTreeView *view __attribute__((unused)), GtkTreePath *path __attribute__((unused)), GtkTreeViewColumn *col __attribute__((unused)), gpointer data __attribute__((unused))) {
+    finder_open_selected();
+}
+
+// Escape closes the finder; the arrow keys move through the results without
+// leaving the entry.
+static gboolean on_finder_key_press(GtkWidget *widget __attribute__((unused)), GdkEventKey *event, gpointer data __attribute__((unused))) {
+    if (event->keyval == GDK_KEY_Escape) {
+        gtk_widget_hide(finder_window);
+        return TRUE;
+    }
+    if (event->keyval == GDK_KEY_Up || event->keyval == GDK_KEY_Down) {
+        GtkTreePath *path;
+        gtk_tree_view_get_cursor(GTK_TREE_VIEW(finder_view), &path, NULL);
+        if (path == NULL) {
+            return TRUE;
+        }
+        if (event->keyval == GDK_KEY_Up) {
+            gtk_tree_path_prev(path);
+        } else {
+            gtk_tree_path_next(path);
+        }
+        GtkTreeIter iter;
+        if (gtk_tree_model_get_iter(GTK_TREE_MODEL(finder_store), &iter, path)) {
+            gtk_tree_view_set_cursor(GTK_TREE_VIEW(finder_view), path, NULL, FALSE);
+        }
+        gtk_tree_path_free(path);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static void show_finder(void) {
+    if (finder_window == NULL) {
+        finder_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(finder_window), "Find File");
+        gtk_window_set_transient_for(GTK_WINDOW(finder_window), GTK_WINDOW(window));
+        gtk_window_set_modal(GTK_WINDOW(finder_window), TRUE);
+        gtk_window_set_position(GTK_WINDOW(finder_window), GTK_WIN_POS_CENTER_ON_PARENT);
+        gtk_window_set_default_size(GTK_WINDOW(finder_window), 600, 400);
+        g_signal_connect(finder_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+        g_signal_connect(finder_window, "key-press-event", G_CALLBACK(on_finder_key_press), NULL);
+
+        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+        gtk_container_set_border_width(GTK_CONTAINER(box), 5);
+        gtk_container_add(GTK_CONTAINER(finder_window), box);
+
+        finder_entry = gtk_entry_new();
+        g_signal_connect(finder_entry, "changed", G_CALLBACK(on_finder_changed), NULL);
+        g_signal_connect(finder_entry, "activate", G_CALLBACK(on_finder_activate), NULL);
+        gtk_box_pack_start(GTK_BOX(box), finder_entry, FALSE, FALSE, 0);
+
+        finder_store = gtk_list_store_new(1, G_TYPE_STRING);
+        finder_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(finder_store));
+        gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(finder_view), FALSE);
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(finder_view), -1, "Path",
+                                                    gtk_cell_renderer_text_new(), "text", 0, NULL);
+        g_signal_connect(finder_view, "row-activated", G_CALLBACK(on_finder_row_activated), NULL);
+
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_container_add(GTK_CONTAINER(scrolled), finder_view);
+        gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
+
+        finder_status = gtk_label_new(NULL);
+        gtk_widget_set_halign(finder_status, GTK_ALIGN_START);
+        gtk_box_pack_start(GTK_BOX(box), finder_status, FALSE, FALSE, 0);
+    }
+
+    gtk_widget_show_all(finder_window);
+    gtk_window_present(GTK_WINDOW(finder_window));
+    gtk_widget_grab_focus(finder_entry);
+    gtk_editable_select_region(GTK_EDITABLE(finder_entry), 0, -1);
+    finder_refresh();
+}
+
+static void search_hit_free(SearchHit *hit) {
+    g_free(hit->path);
+    g_free(hit->text);
+    g_free(hit);
+}
+
+static SearchBatch *search_batch_new(SearchJob *job) {
+    SearchBatch *batch = g_new0(SearchBatch, 1);
+    batch->job = job;
+    batch->hits = g_ptr_array_new_with_free_func((GDestroyNotify)search_hit_free);
+    g_atomic_int_inc(&job->refs);
+    return batch;
+}
+
+static void search_batch_free(SearchBatch *batch) {
+    g_ptr_array_unref(batch->hits);
+    g_free(batch);
+}
+
+static void search_job_unref(SearchJob *job) {
+    if (g_atomic_int_dec_and_test(&job->refs)) {
+        if (job->regex) {
+            g_regex_unref(job->regex);
+        }
+        g_object_unref(job->cancellable);
+        g_free(job->pattern);
+        g_free(job->root);
+        if (job->paths) {
+            g_string_free(job->paths, TRUE);
+            g_array_free(job->offsets, TRUE);
+        }
+        g_free(job);
+    }
+}
+
+
+static gboolean search_deliver(gpointer data);
+
+static void search_flush(SearchJob *job, SearchBatch **batch) {
+    g_idle_add(search_deliver, *batch);
+    *batch = search_batch_new(job);
+}
+
+// Finds the first match at or after start and returns where it begins.
+static const char *search_find(SearchJob *job, const char *buf, const char *start, const char *end) {
+    if (job->regex) {
+        GMatchInfo *match_info;
+        const char *found = NULL;
+        if (g_regex_match_full(job->regex, buf, end - buf, start - buf, 0, &match_info, NULL)) {
+            gint match_start;
+            g_match_info_fetch_pos(match_info, 0, &match_start, NULL);
+            found = buf + match_start;
+        }
+        g_match_info_free(match_info);
+        return found;
+    }
+    gsize len = strlen(job->pattern);
+    if (job->match_case) {
+        return memmem(start, end - start, job->pattern, len);
+    }
+    return find_caseless(start, end, job->pattern, len);
+}
+
+// contents is the worker's read buffer, reused from file to file.
+static void search_file(SearchJob *job, const char *rel, SearchBatch **batch, GByteArray *contents) {
+    gchar *path = g_build_filename(job->root, rel, NULL);
+    gboolean readable = read_regular_file(path, SEARCH_MAX_FILE_SIZE, contents);
+    g_free(path);
+    if (!readable) {
+        return;
+    }
+
+    const char *buf = (const char *)contents->data;
+    const char *end = buf + contents->len;
+    // A NUL byte near the start means binary; don't report matches in it.
+    if (memchr(buf, '\0', MIN(contents->len, SEARCH_BINARY_PROBE)) == NULL) {
+        const char *line_start = buf;
+        gint line = 1;
+        const char *match;
+
+        while ((match = search_find(job, buf, line_start, end)) != NULL) {
+            // Count lines only up to the match instead of splitting the file.
+            for (const char *nl; (nl = memchr(line_start, '\n', match - line_start)) != NULL; line_start = nl + 1) {
+                line++;
+            }
+            const char *line_end = memchr(match, '\n', end - match);
+            if (line_end == NULL) {
+                line_end = end;
+            }
+
+            SearchHit *hit = g_new0(SearchHit, 1);
+            hit->path = g_strdup(rel);
+            hit->line = line;
+            hit->text = g_utf8_make_valid(line_start, MIN(line_end - line_start, SEARCH_MAX_LINE_TEXT));
+            g_strstrip(hit->text);
+            g_ptr_array_add((*batch)->hits, hit);
+
+            if ((*batch)->hits->len >= SEARCH_BATCH_HITS) {
+                search_flush(job, batch);
+            }
+            if (line_end == end || g_atomic_int_add(&job->hit_count, 1) >= SEARCH_MAX_HITS) {
+                break;
+            }
+            line_start = line_end + 1;
+            line++;
+        }
+    }
+}
+
+static gboolean search_snapshot_daemon(SearchJob *job);
+static void search_push_chunk(SearchJob *job, guint first, guint last);
+
+static void search_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    SearchChunk *chunk = data;
+    SearchJob *job = chunk->job;
+
+    // A daemon search starts with one empty chunk, which fetches the file
+    // list here rather than on the GTK thread and queues the real chunks.
+    if (job->paths == NULL && !g_cancellable_is_cancelled(job->cancellable)) {
+        if (search_snapshot_daemon(job)) {
+            for (guint first = 0; first < job->offsets->len; first += SEARCH_CHUNK_FILES) {
+                search_push_chunk(job, first, MIN(first + SEARCH_CHUNK_FILES, job->offsets->len));
+            }
+        } else {
+            job->unindexed = TRUE;
+        }
+    }
+
+    SearchBatch *batch = search_batch_new(job);
+    GByteArray *contents = g_byte_array_new();
+
+    for (guint i = chunk->first; i < chunk->last; i++) {
+        if (g_cancellable_is_cancelled(job->cancellable) || g_atomic_int_get(&job->hit_count) >= SEARCH_MAX_HITS) {
+            break;
+        }
+        search_file(job, job->paths->str + g_array_index(job->offsets, guint32, i), &batch, contents);
+    }
+    g_byte_array_free(contents, TRUE);
+
+    // The last chunk to finish tells the panel the search is over.
+    batch->done = g_atomic_int_dec_and_test(&job->chunks_pending);
+    if (batch->done || batch->hits->len > 0) {
+        g_idle_add(search_deliver, batch);
+    } else {
+        search_batch_free(batch);
+        search_job_unref(job);
+    }
+    search_job_unref(job);  // the chunk's reference
+    g_free(chunk);
+}
+
+static gboolean search_deliver(gpointer data) {
+    SearchBatch *batch = data;
+    SearchJob *job = batch->job;
+
+    if (job == active_search) {
+        for (guint i = 0; i < batch->hits->len; i++) {
+            SearchHit *hit = g_ptr_array_index(batch->hits, i);
+            gchar *location = g_strdup_printf("%s:%d: %s", hit->path, hit->line, hit->text);
+            gtk_list_store_insert_with_values(search_store, NULL, -1, SEARCH_COL_LOCATION, location,
+                                              SEARCH_COL_PATH, hit->path, SEARCH_COL_LINE, hit->line, -1);
+            g_free(location);
+        }
+        search_shown += batch->hits->len;
+
+        gchar *status = job->unindexed ? g_strdup("Workspace is still being indexed")
+                                       : g_strdup_printf("%u matches%s", search_shown,
+                                                         !batch->done ? "..." : search_shown >= SEARCH_MAX_HITS ? " (stopped at limit)" : "");
+        gtk_label_set_text(GTK_LABEL(search_status), status);
+        g_free(status);
+
+        if (batch->done) {
+            active_search = NULL;
+            search_job_unref(job);
+        }
+    }
+
+    search_job_unref(job);
+    search_batch_free(batch);
+    return G_SOURCE_REMOVE;
+}
+
+static void cancel_search(void) {
+    if (active_search) {
+        g_cancellable_cancel(active_search->cancellable);
+        search_job_unref(active_search);
+        active_search = NULL;
+    }
+}
+
+// The daemon's path list, one per line, turned into the NUL-separated
+// snapshot the local index gives. Runs on a search worker.
+static gboolean search_snapshot_daemon(SearchJob *job) {
+    const char *fields[] = {"paths", NULL};
+    GString *reply = daemon_thread_request(fields);
+    if (reply == NULL || g_str_has_prefix(reply->str, "error\t")) {
+        if (reply) {
+            g_string_free(reply, TRUE);
+        }
+        return FALSE;
+    }
+
+    job->offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (gsize pos = 0; pos < reply->len;) {
+        guint32 offset = pos;
+        g_array_append_val(job->offsets, offset);
+        char *end = memchr(reply->str + pos, '\n', reply->len - pos);
+        *end = '\0';
+        pos = end + 1 - reply->str;
+    }
+    job->paths = reply;
+    return TRUE;
+}
+
+// Each queued chunk holds a reference and counts as pending until it has run.
+static void search_push_chunk(SearchJob *job, guint first, guint last) {
+    SearchChunk *chunk = g_new0(SearchChunk, 1);
+    chunk->job = job;
+    chunk->first = first;
+    chunk->last = last;
+    g_atomic_int_inc(&job->chunks_pending);
+    g_atomic_int_inc(&job->refs);
+    g_thread_pool_push(search_pool, chunk, NULL);
+}
+
+// Splits the indexed file list into chunks for the pool. The panel, every
+// queued chunk and every batch on its way back hold a reference on the job.
+static void start_search(const char *pattern) {
+    cancel_search();
+    gtk_list_store_clear(search_store);
+    search_shown = 0;
+
+    if (pattern[0] == '\0') {
+        gtk_label_set_text(GTK_LABEL(search_status), "");
+        return;
+    }
+    if (path_index == NULL && !daemon_running) {
+        gtk_label_set_text(GTK_LABEL(search_status), "Workspace is still being indexed");
+        return;
+    }
+
+    SearchJob *job = g_new0(SearchJob, 1);
+    job->refs = 1;
+    job->root = g_strdup(base_dir);
+    job->pattern = g_strdup(pattern);
+    job->match_case = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search_case_check));
+    job->cancellable = g_cancellable_new();
+
+    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search_regex_check))) {
+        GError *error = NULL;
+        GRegexCompileFlags flags = G_REGEX_RAW | G_REGEX_MULTILINE | G_REGEX_OPTIMIZE |
+                                   (job->match_case ? 0 : G_REGEX_CASELESS);
+        job->regex = g_regex_new(pattern, flags, 0, &error);
+        if (job->regex == NULL) {
+            gtk_label_set_text(GTK_LABEL(search_status), error->message);
+            g_error_free(error);
+            search_job_unref(job);
+            return;
+        }
+    }
+
+    // Snapshot the file list so the index can keep changing underneath. The
+    // daemon's is fetched by the first chunk.
+    if (daemon_running) {
+        active_search = job;
+        search_push_chunk(job, 0, 0);
+        gtk_label_set_text(GTK_LABEL(search_status), "Searching...");
+        return;
+    }
+    job->paths = g_string_sized_new(path_index->paths->len);
+    job->offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint32), path_index->live);
+    for (guint32 i = 0; i < path_index->entries->len; i++) {
+        const IndexEntry *entry = &g_array_index(path_index->entries, IndexEntry, i);
+        if (entry->length != 0) {
+            guint32 offset = job->paths->len;
+            g_array_append_val(job->offsets, offset);
+            g_string_append_len(job->paths, path_index->paths->str + entry->offset, entry->length + 1);
+        }
+    }
+
+    if (job->offsets->len == 0) {
+        gtk_label_set_text(GTK_LABEL(search_status), "0 matches");
+        search_job_unref(job);
+        return;
+    }
+    active_search = job;
+    for (guint first = 0; first < job->offsets->len; first += SEARCH_CHUNK_FILES) {
+        search_push_chunk(job, first, MIN(first + SEARCH_CHUNK_FILES, job->offsets->len));
+    }
+    gtk_label_set_text(GTK_LABEL(search_status), "Searching...");
+}
+
+static void on_search_activate(GtkEntry *entry, gpointer data __attribute__((unused))) {
+    start_search(gtk_entry_get_text(entry));
+}
+
+static void on_search_row_activated(GtkTreeView *view __attribute__((unused)), GtkTreePath *path, GtkTreeViewColumn *col __attribute__((unused)), gpointer data __attribute__((unused))) {
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter(GTK_TREE_MODEL(search_store), &iter, path)) {
+        gchar *rel;
+        gint line;
+        gtk_tree_model_get(GTK_TREE_MODEL(search_store), &iter, SEARCH_COL_PATH, &rel, SEARCH_COL_LINE, &line, -1);
+        gchar *full_path = g_build_filename(base_dir, rel, NULL);
+        open_file_at_line(full_path, line);
+        g_free(full_path);
+        g_free(rel);
+    }
+}
+
+static gboolean on_search_key_press(GtkWidget *widget __attribute__((unused)), GdkEventKey *event, gpointer data __attribute__((unused))) {
+    if (event->keyval == GDK_KEY_Escape) {
+        cancel_search();
+        gtk_widget_hide(search_window);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static void show_search(void) {
+    if (search_window == NULL) {
+        search_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(search_window), "Search Workspace");
+        gtk_window_set_transient_for(GTK_WINDOW(search_window), GTK_WINDOW(window));
+        gtk_window_set_default_size(GTK_WINDOW(search_window), 800, 500);
+        g_signal_connect(search_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+        g_signal_connect(search_window, "key-press-event", G_CALLBACK(on_search_key_press), NULL);
+
+        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+        gtk_container_set_border_width(GTK_CONTAINER(box), 5);
+        gtk_container_add(GTK_CONTAINER(search_window), box);
+
+        GtkWidget *row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+        gtk_box_pack_start(GTK_BOX(box), row, FALSE, FALSE, 0);
+        search_entry = gtk_entry_new();
+        g_signal_connect(search_entry, "activate", G_CALLBACK(on_search_activate), NULL);
+        gtk_box_pack_start(GTK_BOX(row), search_entry, TRUE, TRUE, 0);
+        search_regex_check = gtk_check_button_new_with_mnemonic("_Regex");
+        gtk_box_pack_start(GTK_BOX(row), search_regex_check, FALSE, FALSE, 0);
+        search_case_check = gtk_check_button_new_with_mnemonic("Match _case");
+        gtk_box_pack_start(GTK_BOX(row), search_case_check, FALSE, FALSE, 0);
+
+        search_store = gtk_list_store_new(SEARCH_N_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT);
+        GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(search_store));
+        gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(view), FALSE);
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Match",
+                                                    gtk_cell_renderer_text_new(), "text", SEARCH_COL_LOCATION, NULL);
+        g_signal_connect(view, "row-activated", G_CALLBACK(on_search_row_activated), NULL);
+
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_container_add(GTK_CONTAINER(scrolled), view);
+        gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
+
+        search_status = gtk_label_new(NULL);
+        gtk_widget_set_halign(search_status, GTK_ALIGN_START);
+        gtk_box_pack_start(GTK_BOX(box), search_status, FALSE, FALSE, 0);
+    }
+
+    gtk_widget_show_all(search_window);
+    gtk_window_present(GTK_WINDOW(search_window));
+    gtk_widget_grab_focus(search_entry);
+}
+
+static gboolean build_cache_is_input(const char *name) {
+    static const char *const extensions[] = {".c", ".h", ".cc", ".cpp", ".hpp", ".s", ".S", ".asm", ".inc", ".mk", NULL};
+    if (strcmp(name, "makefile") == 0 || strcmp(name, "Makefile") == 0 || strcmp(name, "GNUmakefile") == 0) {
+        return TRUE;
+    }
+    for (const char *const *ext = extensions; *ext; ext++) {
+        if (g_str_has_suffix(name, *ext)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gchar *build_cache_file_digest(const char *path) {
+    gchar *contents;
+    gsize length;
+    if (!g_file_get_contents(path, &contents, &length, NULL)) {
+        return NULL;
+    }
+    gchar *digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)contents, length);
+    g_free(contents);
+    return digest;
+}
+
+// Source files of a C project: everything build_cache_is_input() accepts
+// below dir, as paths relative to it.
+static void build_cache_collect_inputs(const char *dir, const char *rel, GPtrArray *inputs) {
+    gchar *path = rel ? g_build_filename(dir, rel, NULL) : g_strdup(dir);
+    GDir *handle = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    while (handle && (name = g_dir_read_name(handle)) != NULL) {
+        gchar *child_rel = rel ? g_build_filename(rel, name, NULL) : g_strdup(name);
+        gchar *child = g_build_filename(dir, child_rel, NULL);
+        if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+            if (!index_skip_dir(name) && name[0] != '.') {
+                build_cache_collect_inputs(dir, child_rel, inputs);
+            }
+        } else if (build_cache_is_input(name)) {
+            g_ptr_array_add(inputs, g_strdup(child_rel));
+        }
+        g_free(child);
+        g_free(child_rel);
+    }
+
+    if (handle) {
+        g_dir_close(handle);
+    }
+    g_free(path);
+}
+
+// Identifies the installed tools by where they resolve and their size and
+// mtime, which changes on any upgrade without running them.
+static gchar *build_cache_toolchain(const char *const *tools) {
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    for (const char *const *tool = tools; *tool; tool++) {
+        gchar *path = g_find_program_in_path(*tool);
+        struct stat statbuf;
+        gchar *identity = path && stat(path, &statbuf) == 0
+                              ? g_strdup_printf("%s %lld %lld\n", path, (long long)statbuf.st_size, (long long)statbuf.st_mtime)
+                              : g_strdup_printf("%s missing\n", *tool);
+        g_checksum_update(checksum, (const guchar *)identity, -1);
+        g_free(identity);
+        g_free(path);
+    }
+    gchar *digest = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+    return digest;
+}
+
+static gint build_cache_compare_paths(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void build_key_free(BuildKey *key) {
+    g_free(key->key);
+    g_free(key->target_id);
+    g_free(key->record);
+    g_free(key);
+}
+
+// Hashes the toolchain, the build command and every input into the key the
+// artifacts are stored under. The same facts are kept as a per-target record
+// so a later miss can say what changed.
+static BuildKey *build_key_compute(const char *target_id, const char *dir, GPtrArray *inputs,
+                                   const char *const *tools, const char *command) {
+    GString *record = g_string_new(NULL);
+    gchar *toolchain = build_cache_toolchain(tools);
+    gchar *command_digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, command, -1);
+    g_string_append_printf(record, "toolchain %s\ncommand %s\n", toolchain, command_digest);
+    g_free(toolchain);
+    g_free(command_digest);
+
+    g_ptr_array_sort(inputs, build_cache_compare_paths);
+    for (guint i = 0; i < inputs->len; i++) {
+        const char *rel = g_ptr_array_index(inputs, i);
+        gchar *path = g_build_filename(dir, rel, NULL);
+        gchar *digest = build_cache_file_digest(path);
+        g_string_append_printf(record, "input %s %s\n", digest ? digest : "unreadable", rel);
+        g_free(digest);
+        g_free(path);
+    }
+
+    BuildKey *key = g_new0(BuildKey, 1);
+    key->target_id = g_strdup(target_id);
+    key->key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, record->str, record->len);
+    key->record = g_string_free(record, FALSE);
+    return key;
+}
+
+static void build_plan_free(BuildPlan *plan) {
+    if (plan->key) {
+        build_key_free(plan->key);
+    }
+    g_free(plan->target);
+    g_free(plan->dir);
+    g_free(plan->build);
+    g_free(plan->run);
+    g_free(plan->input);
+    g_free(plan);
+}
+
+// A command-line CFLAGS+= would replace the makefile's CFLAGS rather than
+// extend them, so profile builds read this after the project's makefile.
+static gchar *profile_make_command(const char *dir) {
+    static const char *const names[] = {"GNUmakefile", "makefile", "Makefile", NULL};
+    gchar *makefile = NULL;
+    for (const char *const *name = names; *name && makefile == NULL; name++) {
+        gchar *path = g_build_filename(dir, *name, NULL);
+        if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+            makefile = g_shell_quote(*name);
+        }
+        g_free(path);
+    }
+    if (makefile == NULL) {
+        return g_strdup("make clean && make");
+    }
+
+    gchar *fragment = g_build_filename(base_dir, BUILD_CACHE_DIR_NAME, "profile.mk", NULL);
+    if (!g_file_test(fragment, G_FILE_TEST_EXISTS)) {
+        gchar *fragment_dir = g_path_get_dirname(fragment);
+        g_mkdir_with_parents(fragment_dir, 0755);
+        g_file_set_contents(fragment, "CFLAGS += " PROFILE_C_FLAGS "\n", -1, NULL);
+        g_free(fragment_dir);
+    }
+    gchar *quoted_fragment = g_shell_quote(fragment);
+    gchar *command = g_strdup_printf("make clean && make -f %s -f %s", makefile, quoted_fragment);
+    g_free(quoted_fragment);
+    g_free(fragment);
+    g_free(makefile);
+    return command;
+}
+
+// How Ctrl+R builds path: the whole project directory for C, the single
+// file for assembly. The cache key is left to build_plan_compute_key().
+static BuildPlan *build_plan_new(const char *path, const char *language) {
+    static const char *const c_tools[] = {"make", "cc", "gcc", NULL};
+    static const char *const asm_tools[] = {"nasm", "ld", NULL};
+    BuildPlan *plan = g_new0(BuildPlan, 1);
+    const char *target_id;
+
+    plan->dir = g_path_get_dirname(path);
+    if (strcasecmp(language, "C") == 0) {
+        plan->build = settings.profile_builds ? profile_make_command(plan->dir) : g_strdup("make clean && make");
+        target_id = plan->dir;
+        plan->tools = c_tools;
+    } else {
+        const char *dot = strrchr(path, '.');
+        gchar *stem = dot && dot > strrchr(path, '/') ? g_strndup(path, dot - path) : g_strconcat(path, ".out", NULL);
+        gchar *object = g_strconcat(stem, ".o", NULL);
+        gchar *quoted_source = g_shell_quote(path);
+        gchar *quoted_object = g_shell_quote(object);
+        plan->run = g_shell_quote(stem);
+        plan->build = g_strdup_printf("nasm -f elf64 %s %s -o %s && ld %s -o %s", settings.profile_builds ? "-g -F dwarf" : "",
+                                      quoted_source, quoted_object, quoted_object, plan->run);
+        target_id = path;
+        plan->tools = asm_tools;
+        plan->input = g_path_get_basename(path);
+        g_free(quoted_object);
+        g_free(quoted_source);
+        g_free(object);
+        g_free(stem);
+    }
+
+    plan->target = g_strdup(target_id);
+    return plan;
+}
+
+// Reads every input, so it belongs on a worker. Does nothing with the cache
+// off.
+static void build_plan_compute_key(BuildPlan *plan) {
+    if (!settings.build_cache || self_exe_path == NULL) {
+        return;
+    }
+    GPtrArray *inputs = g_ptr_array_new_with_free_func(g_free);
+    if (plan->input) {
+        g_ptr_array_add(inputs, g_strdup(plan->input));
+    } else {
+        build_cache_collect_inputs(plan->dir, NULL, inputs);
+    }
+    plan->key = build_key_compute(plan->target, plan->dir, inputs, plan->tools, plan->build);
+    g_ptr_array_unref(inputs);
+}
+
+static gchar *build_cache_target_path(const char *root, const char *target_id, const char *suffix) {
+    gchar *id = g_compute_checksum_for_string(G_CHECKSUM_SHA256, target_id, -1);
+    gchar *name = g_strconcat(id, suffix, NULL);
+    gchar *path = g_build_filename(root, "targets", name, NULL);
+    g_free(name);
+    g_free(id);
+    return path;
+}
+
+static gchar *build_cache_object_path(const char *root, const char *digest) {
+    gchar *prefix = g_strndup(digest, 2);
+    gchar *path = g_build_filename(root, "objects", prefix, digest + 2, NULL);
+    g_free(prefix);
+    return path;
+}
+
+static GHashTable *build_cache_parse_record(const char *record) {
+    GHashTable *lines = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar **split = g_strsplit(record, "\n", -1);
+    for (gchar **line = split; *line; line++) {
+        // "input <digest> <path>" is keyed by path, the rest by their label.
+        gchar **fields = g_strsplit(*line, " ", 3);
+        if (fields[0] && fields[1]) {
+            gchar *label = fields[2] ? g_strconcat(fields[0], " ", fields[2], NULL) : g_strdup(fields[0]);
+            g_hash_table_insert(lines, label, g_strdup(fields[1]));
+        }
+        g_strfreev(fields);
+    }
+    g_strfreev(split);
+    return lines;
+}
+
+// Explains a miss by comparing against the last successful build of the
+// same target.
+static gchar *build_cache_miss_reason(const char *root, BuildKey *key) {
+    gchar *path = build_cache_target_path(root, key->target_id, "");
+    gchar *previous;
+    if (!g_file_get_contents(path, &previous, NULL, NULL)) {
+        g_free(path);
+        return g_strdup("no earlier build of this target");
+    }
+    g_free(path);
+
+    GHashTable *old_lines = build_cache_parse_record(previous);
+    GHashTable *new_lines = build_cache_parse_record(key->record);
+    GPtrArray *reasons = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter iter;
+    gpointer label, digest;
+
+    g_hash_table_iter_init(&iter, new_lines);
+    while (g_hash_table_iter_next(&iter, &label, &digest)) {
+        const char *old_digest = g_hash_table_lookup(old_lines, label);
+        const char *what = g_str_has_prefix(label, "input ") ? (const char *)label + 6 : label;
+        if (old_digest == NULL) {
+            g_ptr_array_add(reasons, g_strdup_printf("%s added", what));
+        } else if (strcmp(old_digest, digest) != 0) {
+            g_ptr_array_add(reasons, g_strdup_printf("%s changed", what));
+        }
+        g_hash_table_remove(old_lines, label);
+    }
+    g_hash_table_iter_init(&iter, old_lines);
+    while (g_hash_table_iter_next(&iter, &label, NULL)) {
+        if (g_str_has_prefix(label, "input ")) {
+            g_ptr_array_add(reasons, g_strdup_printf("%s removed", (const char *)label + 6));
+        }
+    }
+
+    GString *reason = g_string_new(NULL);
+    for (guint i = 0; i < reasons->len && i < 3; i++) {
+        g_string_append_printf(reason, "%s%s", i ? ", " : "", (const char *)g_ptr_array_index(reasons, i));
+    }
+    if (reasons->len > 3) {
+        g_string_append_printf(reason, " and %u more", reasons->len - 3);
+    }
+    if (reasons->len == 0) {
+        g_string_append(reason, "cached artifacts are missing");
+    }
+
+    g_ptr_array_unref(reasons);
+    g_hash_table_destroy(old_lines);
+    g_hash_table_destroy(new_lines);
+    g_free(previous);
+    return g_string_free(reason, FALSE);
+}
+
+// Copies the artifacts recorded under key back into dir. Files that already
+// have the right contents are left alone.
+static gboolean build_cache_restore(const char *root, const char *key, const char *dir) {
+    gchar *manifest_path = g_build_filename(root, "manifests", key, NULL);
+    gchar *manifest;
+    gboolean restored = g_file_get_contents(manifest_path, &manifest, NULL, NULL);
+    g_free(manifest_path);
+    if (!restored) {
+        return FALSE;
+    }
+
+    gchar **lines = g_strsplit(manifest, "\n", -1);
+    for (gchar **line = lines; restored && *line && **line; line++) {
+        gchar **fields = g_strsplit(*line, " ", 3);  // mode digest path
+        if (g_strv_length(fields) != 3) {
+            restored = FALSE;
+            g_strfreev(fields);
+            break;
+        }
+
+        gchar *target = g_build_filename(dir, fields[2], NULL);
+        gchar *current = build_cache_file_digest(target);
+        if (g_strcmp0(current, fields[1]) != 0) {
+            gchar *object = build_cache_object_path(root, fields[1]);
+            gchar *contents = NULL;
+            gsize length;
+            restored = g_file_get_contents(object, &contents, &length, NULL) &&
+                       g_file_set_contents(target, contents, length, NULL) &&
+                       chmod(target, strtoul(fields[0], NULL, 8)) == 0;
+            g_free(contents);
+            g_free(object);
+        }
+        g_free(current);
+        g_free(target);
+        g_strfreev(fields);
+    }
+
+    g_strfreev(lines);
+    g_free(manifest);
+    return restored;
+}
+
+// Appends "BUILD && codews --cache-store ..." for a cache miss. The record
+// only becomes the target's last build once the store step has run.
+static void build_cache_append_store_step(GString *command, BuildPlan *plan, const char *root) {
+    gchar *pending = build_cache_target_path(root, plan->key->target_id, ".pending");
+    gchar *targets = g_path_get_dirname(pending);
+    g_mkdir_with_parents(targets, 0755);
+    g_file_set_contents(pending, plan->key->record, -1, NULL);
+
+    gchar *quoted_self = g_shell_quote(self_exe_path);
+    gchar *quoted_root = g_shell_quote(root);
+    gchar *quoted_target = g_shell_quote(plan->key->target_id);
+    gchar *quoted_dir = g_shell_quote(plan->dir);
+    g_string_append_printf(command, "%s && %s --cache-store %s %s %s %s %" G_GINT64_FORMAT,
+                           plan->build, quoted_self, quoted_root, plan->key->key,
+                           quoted_target, quoted_dir, g_get_real_time() / G_USEC_PER_SEC);
+    g_free(quoted_dir);
+    g_free(quoted_target);
+    g_free(quoted_root);
+    g_free(quoted_self);
+    g_free(targets);
+    g_free(pending);
+}
+
+// Builds the terminal command for Ctrl+R: restore and skip straight to
+// running on a cache hit, otherwise build and store the results.
+static gchar *build_plan_command(BuildPlan *plan) {
+    gchar *quoted_dir = g_shell_quote(plan->dir);
+    GString *command = g_string_new(NULL);
+    g_string_append_printf(command, "clear && cd %s && ", quoted_dir);
+    g_free(quoted_dir);
+
+    if (plan->key == NULL) {
+        g_string_append(command, plan->build);
+    } else {
+        gchar *root = g_build_filename(base_dir, BUILD_CACHE_DIR_NAME, NULL);
+        gboolean hit = build_cache_restore(root, plan->key->key, plan->dir);
+        gchar *message;
+
+        if (hit) {
+            message = g_strdup_printf("[build cache] hit %.12s, skipping build", plan->key->key);
+        } else {
+            gchar *reason = build_cache_miss_reason(root, plan->key);
+            message = g_strdup_printf("[build cache] miss %.12s: %s", plan->key->key, reason);
+            g_free(reason);
+        }
+
+        gchar *quoted_message = g_shell_quote(message);
+        g_string_append_printf(command, "echo %s", quoted_message);
+        if (!hit) {
+            g_string_append(command, " && ");
+            build_cache_append_store_step(command, plan, root);
+        }
+        g_free(quoted_message);
+        g_free(message);
+        g_free(root);
+    }
+    if (plan->run) {
+        g_string_append_printf(command, " && %s", plan->run);
+    }
+    return g_string_free(command, FALSE);
+}
+
+static void build_plan_job_free(BuildPlanJob *job) {
+    build_plan_free(job->plan);
+    g_free(job->title);
+    g_free(job->command);
+    g_free(job);
+}
+
+static gboolean build_plan_run(gpointer data) {
+    BuildPlanJob *job = data;
+    // A background build queued ahead of this one may have started since.
+    cancel_speculative_build(job->plan->target);
+    run_in_tab("build", job->title, NULL, job->command);
+    build_plan_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean start_speculative_build(gpointer data);
+
+static void build_plan_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    BuildPlanJob *job = data;
+    build_plan_compute_key(job->plan);
+    if (!job->speculative) {
+        job->command = build_plan_command(job->plan);
+        g_idle_add(build_plan_run, job);
+        return;
+    }
+
+    // Nothing to do if the cache already has this exact build.
+    gchar *root = g_build_filename(base_dir, BUILD_CACHE_DIR_NAME, NULL);
+    gchar *manifest = job->plan->key ? g_build_filename(root, "manifests", job->plan->key->key, NULL) : NULL;
+    if (manifest && !g_file_test(manifest, G_FILE_TEST_EXISTS)) {
+        GString *command = g_string_new(NULL);
+        build_cache_append_store_step(command, job->plan, root);
+        job->command = g_string_free(command, FALSE);
+    }
+    g_free(manifest);
+    g_free(root);
+    g_idle_add(start_speculative_build, job);
+}
+
+static void build_cache_collect_artifacts(const char *dir, const char *rel, gint64 since, GPtrArray *artifacts) {
+    gchar *path = rel ? g_build_filename(dir, rel, NULL) : g_strdup(dir);
+    GDir *handle = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    while (handle && (name = g_dir_read_name(handle)) != NULL) {
+        gchar *child_rel = rel ? g_build_filename(rel, name, NULL) : g_strdup(name);
+        gchar *child = g_build_filename(dir, child_rel, NULL);
+        struct stat statbuf;
+        if (lstat(child, &statbuf) == 0) {
+            if (S_ISDIR(statbuf.st_mode)) {
+                if (!is_hidden_entry(name) && name[0] != '.') {
+                    build_cache_collect_artifacts(dir, child_rel, since, artifacts);
+                }
+            } else if (S_ISREG(statbuf.st_mode) && statbuf.st_mtime >= since && !build_cache_is_input(name)) {
+                g_ptr_array_add(artifacts, g_strdup(child_rel));
+            }
+        }
+        g_free(child);
+        g_free(child_rel);
+    }
+
+    if (handle) {
+        g_dir_close(handle);
+    }
+    g_free(path);
+}
+
+// `codews --cache-store ROOT KEY TARGET DIR SINCE`, run by the terminal after
+// a successful build: stores every non-source file under DIR written since
+// the build started, then records the build as TARGET's latest. A failure
+// here is reported but doesn't stop the program from being run.
+static int build_cache_store_main(int argc, char *argv[]) {
+    if (argc != 7) {
+        fprintf(stderr, "usage: %s --cache-store ROOT KEY TARGET DIR SINCE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *root = argv[2], *key = argv[3], *target_id = argv[4], *dir = argv[5];
+    gint64 since = g_ascii_strtoll(argv[6], NULL, 10);
+
+    GPtrArray *artifacts = g_ptr_array_new_with_free_func(g_free);
+    build_cache_collect_artifacts(dir, NULL, since, artifacts);
+
+    GString *manifest = g_string_new(NULL);
+    for (guint i = 0; i < artifacts->len; i++) {
+        const char *rel = g_ptr_array_index(artifacts, i);
+        gchar *path = g_build_filename(dir, rel, NULL);
+        gchar *contents;
+        gsize length;
+        struct stat statbuf;
+
+        if (stat(path, &statbuf) == 0 && g_file_get_contents(path, &contents, &length, NULL)) {
+            gchar *digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)contents, length);
+            gchar *object = build_cache_object_path(root, digest);
+            if (!g_file_test(object, G_FILE_TEST_EXISTS)) {
+                gchar *object_dir = g_path_get_dirname(object);
+                g_mkdir_with_parents(object_dir, 0755);
+                g_file_set_contents(object, contents, length, NULL);
+                g_free(object_dir);
+            }
+            g_string_append_printf(manifest, "%o %s %s\n", (unsigned)(statbuf.st_mode & 07777), digest, rel);
+            g_free(object);
+            g_free(digest);
+            g_free(contents);
+        }
+        g_free(path);
+    }
+
+    gchar *manifests = g_build_filename(root, "manifests", NULL);
+    gchar *manifest_path = g_build_filename(manifests, key, NULL);
+    gchar *pending = build_cache_target_path(root, target_id, ".pending");
+    gchar *latest = build_cache_target_path(root, target_id, "");
+    g_mkdir_with_parents(manifests, 0755);
+
+    GError *error = NULL;
+    if (!g_file_set_contents(manifest_path, manifest->str, manifest->len, &error)) {
+        fprintf(stderr, "[build cache] failed to store build %.12s: %s\n", key, error->message);
+        g_error_free(error);
+    } else if (rename(pending, latest) != 0) {
+        int err = errno;
+        fprintf(stderr, "[build cache] failed to store build %.12s: %s\n", key, strerror(err));
+    } else {
+        printf("[build cache] stored %u artifact%s under %.12s\n", artifacts->len, artifacts->len == 1 ? "" : "s", key);
+    }
+
+    g_free(latest);
+    g_free(pending);
+    g_free(manifest_path);
+    g_free(manifests);
+    g_string_free(manifest, TRUE);
+    g_ptr_array_unref(artifacts);
+    return EXIT_SUCCESS;
+}
+
+// Runs in the forked build before exec: its own process group so a newer
+// save can cancel the whole build, and the lowest CPU and I/O priority.
+static void speculative_child_setup(gpointer data __attribute__((unused))) {
+    setpgid(0, 0);
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+static void cancel_speculative_build(const char *target) {
+    gpointer pid;
+    if (g_hash_table_lookup_extended(speculative_builds, target, NULL, &pid)) {
+        kill(-GPOINTER_TO_INT(pid), SIGTERM);
+        g_hash_table_remove(speculative_builds, target);
+    }
+}
+
+static void on_speculative_build_exited(GPid pid, gint status, gpointer data) {
+    gchar *target = data;
+    gpointer current;
+
+    // A cancelled build has already been replaced in the table.
+    if (g_hash_table_lookup_extended(speculative_builds, target, NULL, &current) && GPOINTER_TO_INT(current) == pid) {
+        g_hash_table_remove(speculative_builds, target);
+        g_print("Background build of %s %s\n", target,
+                WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "finished" : "failed");
+    }
+    g_spawn_close_pid(pid);
+    g_free(target);
+}
+
+// Builds and stores into the cache without a terminal, so the next Ctrl+R
+// finds the artifacts ready. build_plan_worker() has already worked out
+// whether there is anything to build.
+static gboolean start_speculative_build(gpointer data) {
+    BuildPlanJob *job = data;
+    BuildPlan *plan = job->plan;
+
+    cancel_speculative_build(plan->target);
+    if (job->command) {
+        gchar *title = g_strdup_printf("Background build of %s", plan->target);
+        gchar **argv = job_wrap_argv("build", title, job->command);
+        GPid pid;
+        GError *error = NULL;
+        TRACE_START(trace_start);
+        gboolean spawned = g_spawn_async(plan->dir, argv, NULL,
+                                         G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                                         speculative_child_setup, NULL, &pid, &error);
+        TRACE_END(trace_start, "spawn", "speculative build", plan->target);
+        if (spawned) {
+            g_hash_table_insert(speculative_builds, g_strdup(plan->target), GINT_TO_POINTER(pid));
+            g_child_watch_add(pid, on_speculative_build_exited, g_strdup(plan->target));
+        } else {
+            g_printerr("Failed to start background build of %s: %s\n", plan->target, error->message);
+            g_error_free(error);
+        }
+        g_strfreev(argv);
+        g_free(title);
+    }
+
+    build_plan_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean run_speculative_builds(gpointer data __attribute__((unused))) {
+    GHashTableIter iter;
+    gpointer path, language;
+    g_hash_table_iter_init(&iter, speculative_pending);
+    while (g_hash_table_iter_next(&iter, &path, &language)) {
+        BuildPlanJob *job = g_new0(BuildPlanJob, 1);
+        job->plan = build_plan_new(path, language);
+        job->speculative = TRUE;
+        g_thread_pool_push(build_plan_pool, job, NULL);
+    }
+    g_hash_table_remove_all(speculative_pending);
+    speculative_timer_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// Called for every source file written under base_dir. C saves rebuild the
+// enclosing project (the nearest directory with a makefile), assembly saves
+// rebuild that file. Saves are debounced so an editor writing several
+// files, or saving twice, triggers one build.
+static void schedule_speculative_build(const char *rel) {
+    gchar *path = g_build_filename(base_dir, rel, NULL);
+    const char *language = language_for_path(base_dir, path);
+    gchar *target = NULL;
+
+    if (language && strcmp(language, "C") == 0) {
+        gchar *dir = g_path_get_dirname(path);
+        while (target == NULL && strlen(dir) > strlen(base_dir)) {
+            gchar *makefile = g_build_filename(dir, "makefile", NULL);
+            gchar *Makefile = g_build_filename(dir, "Makefile", NULL);
+            if (g_file_test(makefile, G_FILE_TEST_EXISTS) || g_file_test(Makefile, G_FILE_TEST_EXISTS)) {
+                target = g_steal_pointer(&makefile);
+            } else {
+                gchar *parent = g_path_get_dirname(dir);
+                g_free(dir);
+                dir = parent;
+            }
+            g_free(makefile);
+            g_free(Makefile);
+        }
+        g_free(dir);
+    } else if (language && strcmp(language, "Assembly") == 0 &&
+               (has_extension(path, "asm") || has_extension(path, "s") || has_extension(path, "S"))) {
+        target = g_strdup(path);
+    }
+
+    if (target) {
+        g_hash_table_insert(speculative_pending, target, (gpointer)language);
+        if (speculative_timer_id) {
+            g_source_remove(speculative_timer_id);
+        }
+        speculative_timer_id = g_timeout_add(SPECULATIVE_DEBOUNCE_MS, run_speculative_builds, NULL);
+    }
+    g_free(path);
+}
+
+static void build_all_run_unref(BuildAllRun *run) {
+    if (g_atomic_int_dec_and_test(&run->refs)) {
+        close(run->jobserver[0]);
+        close(run->jobserver[1]);
+        g_object_unref(run->cancellable);
+        g_free(run);
+    }
+}
+
+static void build_all_project_free(BuildAllProject *project) {
+    g_free(project->path);
+    g_free(project->status);
+    g_free(project->log);
+    g_free(project);
+}
+
+static gboolean build_all_has_test_target(const char *dir) {
+    static const char *const names[] = {"makefile", "Makefile", "GNUmakefile", NULL};
+    gboolean found = FALSE;
+    for (const char *const *name = names; *name && !found; name++) {
+        gchar *path = g_build_filename(dir, *name, NULL);
+        gchar *contents;
+        if (g_file_get_contents(path, &contents, NULL, NULL)) {
+            found = g_str_has_prefix(contents, "test:") || strstr(contents, "\ntest:") != NULL;
+            g_free(contents);
+        }
+        g_free(path);
+    }
+    return found;
+}
+
+// The shell command for one project, or NULL when the build cache already
+// holds its outputs and restoring them is all that was needed.
+static gchar *build_all_command(BuildAllProject *project, gboolean *cached) {
+    gchar *root = g_build_filename(base_dir, BUILD_CACHE_DIR_NAME, NULL);
+    GString *command = g_string_new(NULL);
+    *cached = FALSE;
+
+    if (strcmp(project->language, "Python3") == 0) {
+        gchar *quoted = g_shell_quote(project->path);
+        if (g_file_test(project->path, G_FILE_TEST_IS_DIR)) {
+            g_string_append_printf(command, "cd %s && python3 -m compileall -q .", quoted);
+            g_string_append(command, " && if [ -d tests ] || [ -n \"$(ls test_*.py 2>/dev/null)\" ]; then python3 -m unittest discover -q; fi");
+        } else {
+            g_string_append_printf(command, "python3 -m py_compile %s", quoted);
+        }
+        g_free(quoted);
+    } else {
+        BuildPlan *plan = build_plan_new(project->path, project->language);
+        build_plan_compute_key(plan);
+        gchar *quoted_dir = g_shell_quote(plan->dir);
+        g_string_append_printf(command, "cd %s && ", quoted_dir);
+        if (plan->key && build_cache_restore(root, plan->key->key, plan->dir)) {
+            *cached = TRUE;
+            g_string_append(command, "true");
+        } else if (plan->key) {
+            build_cache_append_store_step(command, plan, root);
+        } else {
+            g_string_append(command, plan->build);
+        }
+        if (strcmp(project->language, "C") == 0 && build_all_has_test_target(plan->dir)) {
+            g_string_append(command, " && make test");
+        }
+        g_free(quoted_dir);
+        build_plan_free(plan);
+    }
+
+    g_free(root);
+    return g_string_free(command, FALSE);
+}
+
+static gboolean build_all_deliver(gpointer data);
+
+// The spawn closes every other descriptor before this runs; only the
+// jobserver pipe is let through to make.
+static void build_all_child_setup(gpointer data) {
+    BuildAllRun *run = data;
+    fcntl(run->jobserver[0], F_SETFD, 0);
+    fcntl(run->jobserver[1], F_SETFD, 0);
+}
+
+// Each project holds one jobserver token for as long as it runs; the make it
+// starts takes any further tokens for its own -j from the same pipe, so all
+// builds together stay within the core count.
+static void build_all_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    BuildAllProject *project = data;
+    BuildAllRun *run = project->run;
+    char token;
+
+    if (g_cancellable_is_cancelled(run->cancellable) || read(run->jobserver[0], &token, 1) != 1) {
+        project->cancelled = TRUE;
+        project->status = g_strdup("cancelled");
+        g_idle_add(build_all_deliver, project);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    gboolean cached;
+    gchar *command = build_all_command(project, &cached);
+    gchar *wrapped = g_strdup_printf("( %s ) 2>&1", command);
+    gchar *title = g_strdup_printf("Build All: %s", project->path);
+    gchar **argv = job_wrap_argv("build", title, wrapped);
+    gchar *makeflags = g_strdup_printf(" -j%u --jobserver-auth=%d,%d --jobserver-fds=%d,%d", g_get_num_processors(),
+                                       run->jobserver[0], run->jobserver[1], run->jobserver[0], run->jobserver[1]);
+    gchar **envp = g_environ_setenv(g_get_environ(), "MAKEFLAGS", makeflags, TRUE);
+    gint status = -1;
+    GError *error = NULL;
+
+    TRACE_START(trace_start);
+    if (!g_spawn_sync(NULL, argv, envp, G_SPAWN_DEFAULT, build_all_child_setup, run,
+                      &project->log, NULL, &status, &error)) {
+        project->log = g_strdup(error->message);
+        g_error_free(error);
+    }
+    TRACE_END(trace_start, "spawn", "build all", project->path);
+    if (write(run->jobserver[1], &token, 1) != 1) {
+        g_printerr("Failed to return jobserver token: %s\n", strerror(errno));
+    }
+
+    project->duration_us = g_get_monotonic_time() - start;
+    project->ok = status == 0;
+    project->cancelled = !project->ok && g_cancellable_is_cancelled(run->cancellable);
+    project->status = g_strdup(project->cancelled ? "cancelled"
+                               : !project->ok  ? "failed"
+                               : cached        ? "passed (cached)"
+                                               : "passed");
+
+    g_strfreev(envp);
+    g_strfreev(argv);
+    g_free(title);
+    g_free(makeflags);
+    g_free(wrapped);
+    g_free(command);
+    g_idle_add(build_all_deliver, project);
+}
+
+static void build_all_update_summary(BuildAllRun *run) {
+    gchar *summary = g_strdup_printf("%u of %u done, %u failed, %.1f s%s", run->finished, run->total, run->failed,
+                                     (g_get_monotonic_time() - run->started) / 1e6,
+                                     run->finished < run->total ? "" : " - finished");
+    gtk_label_set_text(GTK_LABEL(build_all_status), summary);
+    g_free(summary);
+}
+
+static gboolean build_all_deliver(gpointer data) {
+    BuildAllProject *project = data;
+    BuildAllRun *run = project->run;
+    GtkTreeIter iter;
+
+    if (run == active_build_all &&
+        gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(build_all_store), &iter, NULL, project->row)) {
+        gchar *duration = g_strdup_printf("%.2f s", project->duration_us / 1e6);
+        gtk_list_store_set(build_all_store, &iter, BUILD_ALL_COL_STATUS, project->status,
+                           BUILD_ALL_COL_DURATION, project->duration_us ? duration : "",
+                           BUILD_ALL_COL_LOG, project->log, BUILD_ALL_COL_FAILED, !project->ok && !project->cancelled, -1);
+        g_free(duration);
+
+        run->finished++;
+        run->failed += !project->ok && !project->cancelled;
+        build_all_update_summary(run);
+    }
+
+    build_all_project_free(project);
+    build_all_run_unref(run);
+    return G_SOURCE_REMOVE;
+}
+
+static void build_all_add_project(GPtrArray *projects, const char *path, const char *language) {
+    BuildAllProject *project = g_new0(BuildAllProject, 1);
+    project->path = g_strdup(path);
+    project->language = language;
+    g_ptr_array_add(projects, project);
+}
+
+// C projects are directories with a makefile (not descended into further),
+// assembly projects are single source files, Python projects are the
+// top-level entries of Python3/.
+static void build_all_discover(const char *dir, const char *language, guint depth, GPtrArray *projects) {
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    const char *name;
+
+    if (handle && strcmp(language, "C") == 0 && depth > 0) {
+        gchar *makefile = g_build_filename(dir, "makefile", NULL);
+        gchar *Makefile = g_build_filename(dir, "Makefile", NULL);
+        gboolean is_project = g_file_test(makefile, G_FILE_TEST_EXISTS) || g_file_test(Makefile, G_FILE_TEST_EXISTS);
+        g_free(makefile);
+        g_free(Makefile);
+        if (is_project) {
+            gchar *project = g_build_filename(dir, "makefile", NULL);
+            build_all_add_project(projects, project, language);
+            g_free(project);
+            g_dir_close(handle);
+            return;
+        }
+    }
+
+    while (handle && (name = g_dir_read_name(handle)) != NULL) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        gboolean is_dir = g_file_test(path, G_FILE_TEST_IS_DIR);
+
+        if (is_dir && index_skip_dir(name)) {
+            // skipped like everywhere else in the workspace
+        } else if (strcmp(language, "Python3") == 0) {
+            if (is_dir || has_extension(name, "py")) {
+                build_all_add_project(projects, path, language);
+            }
+        } else if (is_dir) {
+            build_all_discover(path, language, depth + 1, projects);
+        } else if (strcmp(language, "Assembly") == 0 && (has_extension(name, "asm") || has_extension(name, "s"))) {
+            build_all_add_project(projects, path, language);
+        }
+        g_free(path);
+    }
+
+    if (handle) {
+        g_dir_close(handle);
+    }
+}
+
+static void on_build_all_selection_changed(GtkTreeSelection *selection, gpointer data __attribute__((unused))) {
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+    gchar *log = NULL;
+
+    if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
+        gtk_tree_model_get(model, &iter, BUILD_ALL_COL_LOG, &log, -1);
+    }
+    gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(build_all_log_view)), log ? log : "", -1);
+    g_free(log);
+}
+
+static void render_build_all_status(GtkTreeViewColumn *column __attribute__((unused)), GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data __attribute__((unused))) {
+    gchar *status;
+    gboolean failed;
+    gtk_tree_model_get(model, iter, BUILD_ALL_COL_STATUS, &status, BUILD_ALL_COL_FAILED, &failed, -1);
+    g_object_set(renderer, "text", status, "foreground", failed ? "red" : NULL, NULL);
+    g_free(status);
+}
+
+static void create_build_all_window(void) {
+    build_all_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(build_all_window), "Build All");
+    gtk_window_set_transient_for(GTK_WINDOW(build_all_window), GTK_WINDOW(window));
+    gtk_window_set_default_size(GTK_WINDOW(build_all_window), 900, 600);
+    g_signal_connect(build_all_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 5);
+    gtk_container_add(GTK_CONTAINER(build_all_window), box);
+
+    build_all_store = gtk_list_store_new(BUILD_ALL_N_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+                                         G_TYPE_STRING, G_TYPE_BOOLEAN);
+    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(build_all_store));
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Project", gtk_cell_renderer_text_new(),
+                                                "text", BUILD_ALL_COL_PROJECT, NULL);
+    gtk_tree_view_insert_column_with_data_func(GTK_TREE_VIEW(view), -1, "Result", gtk_cell_renderer_text_new(),
+                                               render_build_all_status, NULL, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Time", gtk_cell_renderer_text_new(),
+                                                "text", BUILD_ALL_COL_DURATION, NULL);
+    g_signal_connect(gtk_tree_view_get_selection(GTK_TREE_VIEW(view)), "changed",
+                     G_CALLBACK(on_build_all_selection_changed), NULL);
+
+    GtkWidget *paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+    gtk_box_pack_start(GTK_BOX(box), paned, TRUE, TRUE, 0);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scrolled), view);
+    gtk_paned_pack1(GTK_PANED(paned), scrolled, TRUE, FALSE);
+
+    build_all_log_view = gtk_text_view_new();
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(build_all_log_view), FALSE);
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(build_all_log_view), TRUE);
+    GtkWidget *log_scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(log_scrolled), build_all_log_view);
+    gtk_paned_pack2(GTK_PANED(paned), log_scrolled, TRUE, FALSE);
+
+    build_all_status = gtk_label_new(NULL);
+    gtk_widget_set_halign(build_all_status, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(box), build_all_status, FALSE, FALSE, 0);
+}
+
+// Discovers every project under the C/, Python3/ and Asm/ roots and queues
+// them all on the build pool. Starting again abandons the previous run; its
+// running builds finish but no new ones start.
+static void start_build_all(void) {
+    if (active_build_all) {
+        g_cancellable_cancel(active_build_all->cancellable);
+        build_all_run_unref(active_build_all);
+        active_build_all = NULL;
+    }
+    if (build_all_window == NULL) {
+        create_build_all_window();
+    }
+    gtk_list_store_clear(build_all_store);
+    gtk_widget_show_all(build_all_window);
+    gtk_window_present(GTK_WINDOW(build_all_window));
+
+    BuildAllRun *run = g_new0(BuildAllRun, 1);
+    if (pipe2(run->jobserver, O_CLOEXEC) != 0) {
+        g_printerr("Failed to create jobserver pipe: %s\n", strerror(errno));
+        g_free(run);
+        return;
+    }
+    // One token per core.
+    for (guint i = 0; i < g_get_num_processors(); i++) {
+        if (write(run->jobserver[1], "+", 1) != 1) {
+            break;
+        }
+    }
+    run->refs = 1;
+    run->cancellable = g_cancellable_new();
+    run->started = g_get_monotonic_time();
+    active_build_all = run;
+
+    static const char *const roots[][2] = {{"C", "C"}, {"Python3", "Python3"}, {"Asm", "Assembly"}};
+    GPtrArray *projects = g_ptr_array_new();
+    for (guint i = 0; i < G_N_ELEMENTS(roots); i++) {
+        gchar *root = g_build_filename(base_dir, roots[i][0], NULL);
+        build_all_discover(root, roots[i][1], 0, projects);
+        g_free(root);
+    }
+
+    for (guint i = 0; i < projects->len; i++) {
+        BuildAllProject *project = g_ptr_array_index(projects, i);
+        // C projects are listed by directory rather than by their makefile.
+        gchar *name = strcmp(project->language, "C") == 0 ? g_path_get_dirname(project->path) : g_strdup(project->path);
+        project->run = run;
+        project->row = i;
+        g_atomic_int_inc(&run->refs);
+        gtk_list_store_insert_with_values(build_all_store, NULL, -1,
+                                          BUILD_ALL_COL_PROJECT, name + strlen(base_dir) + 1,
+                                          BUILD_ALL_COL_STATUS, "queued", -1);
+        g_thread_pool_push(build_all_pool, project, NULL);
+        g_free(name);
+    }
+    run->total = projects->len;
+    build_all_update_summary(run);
+    g_ptr_array_unref(projects);
+}
+
+static void bench_job_free(BenchJob *job) {
+    g_free(job->path);
+    g_strfreev(job->argv);
+    g_free(job->stdin_path);
+    g_free(job->error);
+    g_array_free(job->samples, TRUE);
+    g_free(job);
+}
+
+static gdouble timeval_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// One run under fork/exec with wait4() collecting the child's rusage.
+// Output goes to /dev/null so the terminal doesn't end up in the timing.
+// A child that can't get as far as exec reports its errno through a
+// close-on-exec pipe, so any exit status, 127 included, belongs to the
+// program itself.
+static gboolean bench_run_once(BenchJob *job, const char *dir, BenchSample *sample) {
+    int in_fd = open(job->stdin_path ? job->stdin_path : "/dev/null", O_RDONLY | O_CLOEXEC);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int status_pipe[2] = {-1, -1};
+    if (in_fd < 0 || null_fd < 0 || pipe2(status_pipe, O_CLOEXEC) != 0) {
+        job->error = g_strdup_printf("Failed to open %s: %s", job->stdin_path ? job->stdin_path : "/dev/null", strerror(errno));
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (null_fd >= 0) {
+            close(null_fd);
+        }
+        return FALSE;
+    }
+
+    struct timespec start, end;
+    int exec_error = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(dir) == 0 && dup2(in_fd, 0) >= 0 && dup2(null_fd, 1) >= 0 && dup2(null_fd, 2) >= 0) {
+            execv(job->argv[0], job->argv);
+        }
+        int err = errno;
+        while (write(status_pipe[1], &err, sizeof(err)) < 0 && errno == EINTR) {
+        }
+        _exit(127);
+    }
+    close(in_fd);
+    close(null_fd);
+    close(status_pipe[1]);
+    if (pid < 0) {
+        job->error = g_strdup_printf("fork failed: %s", strerror(errno));
+        close(status_pipe[0]);
+        return FALSE;
+    }
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            job->error = g_strdup_printf("wait4 failed: %s", strerror(errno));
+            return FALSE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    gboolean exec_failed = read(status_pipe[0], &exec_error, sizeof(exec_error)) == sizeof(exec_error);
+    close(status_pipe[0]);
+    if (exec_failed) {
+        job->error = g_strdup_printf("Could not execute %s: %s", job->argv[0], strerror(exec_error));
+        return FALSE;
+    }
+    job->last_status = status;
+    sample->wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    sample->user = timeval_seconds(&usage.ru_utime);
+    sample->sys = timeval_seconds(&usage.ru_stime);
+    sample->max_rss_kb = usage.ru_maxrss;
+    return TRUE;
+}
+
+static gboolean show_bench_results(gpointer data);
+
+static gpointer bench_thread(gpointer data) {
+    BenchJob *job = data;
+    gchar *dir = g_path_get_dirname(job->path);
+    TRACE_START(trace_start);
+
+    for (gint i = 0; i < job->warmup + job->runs; i++) {
+        BenchSample sample;
+        if (!bench_run_once(job, dir, &sample)) {
+            break;
+        }
+        if (i >= job->warmup) {
+            g_array_append_val(job->samples, sample);
+        }
+    }
+
+    TRACE_END(trace_start, "spawn", "benchmark", job->path);
+    g_free(dir);
+    g_idle_add(show_bench_results, job);
+    return NULL;
+}
+
+static gint compare_doubles(gconstpointer a, gconstpointer b) {
+    gdouble x = *(const gdouble *)a, y = *(const gdouble *)b;
+    return (x > y) - (x < y);
+}
+
+static gchar *bench_history_path(const char *path) {
+    gchar *id = g_compute_checksum_for_string(G_CHECKSUM_SHA256, path, -1);
+    gchar *name = g_strconcat(id, ".tsv", NULL);
+    gchar *history = g_build_filename(g_get_user_data_dir(), "codews", "benchmarks", name, NULL);
+    g_free(name);
+    g_free(id);
+    return history;
+}
+
+// History is one tab-separated line per benchmark: time, binary mtime, runs,
+// min, median, mean, stddev, user, sys (seconds), peak RSS (KiB), arguments.
+static void format_bench_history(GString *out, const char *history_path, gdouble median) {
+    gchar *contents;
+    if (!g_file_get_contents(history_path, &contents, NULL, NULL)) {
+        return;
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    guint n_lines = g_strv_length(lines);
+    while (n_lines > 0 && lines[n_lines - 1][0] == '\0') {
+        n_lines--;
+    }
+    if (n_lines > 0) {
+        g_string_append(out, "\nPrevious runs (newest first):\n");
+    }
+    for (guint i = n_lines; i > 0 && i + BENCH_HISTORY_SHOWN > n_lines; i--) {
+        gchar **fields = g_strsplit(lines[i - 1], "\t", 11);
+        if (g_strv_length(fields) >= 10) {
+            GDateTime *when = g_date_time_new_from_unix_local(g_ascii_strtoll(fields[0], NULL, 10));
+            gchar *stamp = g_date_time_format(when, "%Y-%m-%d %H:%M");
+            gdouble old_median = g_ascii_strtod(fields[4], NULL);
+            g_string_append_printf(out, "  %s  median %.3f ms (%+.1f%% now)  rss %s KiB  args: %s\n", stamp,
+                                   old_median * 1e3, old_median > 0 ? (median / old_median - 1) * 100 : 0.0,
+                                   fields[9], fields[10] ? fields[10] : "");
+            g_free(stamp);
+            g_date_time_unref(when);
+        }
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+}
+
+static gboolean show_bench_results(gpointer data) {
+    BenchJob *job = data;
+    GString *report = g_string_new(NULL);
+    guint n = job->samples->len;
+
+    if (n > 0) {
+        GArray *walls = g_array_sized_new(FALSE, FALSE, sizeof(gdouble), n);
+        gdouble mean = 0, user = 0, sys = 0, variance = 0;
+        glong max_rss = 0;
+        for (guint i = 0; i < n; i++) {
+            const BenchSample *s = &g_array_index(job->samples, BenchSample, i);
+            g_array_append_val(walls, s->wall);
+            mean += s->wall / n;
+            user += s->user / n;
+            sys += s->sys / n;
+            max_rss = MAX(max_rss, s->max_rss_kb);
+        }
+        for (guint i = 0; i < n; i++) {
+            gdouble d = g_array_index(walls, gdouble, i) - mean;
+            variance += d * d / (n > 1 ? n - 1 : 1);
+        }
+        g_array_sort(walls, compare_doubles);
+        gdouble min = g_array_index(walls, gdouble, 0);
+        gdouble median = n % 2 ? g_array_index(walls, gdouble, n / 2)
+                               : (g_array_index(walls, gdouble, n / 2 - 1) + g_array_index(walls, gdouble, n / 2)) / 2;
+        gdouble stddev = sqrt(variance);
+        gchar *args = g_strjoinv(" ", job->argv + 1);
+
+        g_string_append_printf(report, "%u runs after %d warmup\n\n", n, job->warmup);
+        g_string_append_printf(report, "wall    min %.3f ms   median %.3f ms   mean %.3f ms   stddev %.3f ms\n",
+                               min * 1e3, median * 1e3, mean * 1e3, stddev * 1e3);
+        g_string_append_printf(report, "cpu     user %.3f ms   sys %.3f ms (mean per run)\n", user * 1e3, sys * 1e3);
+        g_string_append_printf(report, "memory  peak RSS %ld KiB\n", max_rss);
+        if (!WIFEXITED(job->last_status) || WEXITSTATUS(job->last_status) != 0) {
+            g_string_append_printf(report, "note    last run exited abnormally (status %d)\n", job->last_status);
+        }
+
+        gchar *history_path = bench_history_path(job->path);
+        format_bench_history(report, history_path, median);
+
+        struct stat statbuf;
+        gint64 mtime = stat(job->path, &statbuf) == 0 ? statbuf.st_mtime : 0;
+        gchar *line = g_strdup_printf("%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%u\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%ld\t%s\n",
+                                      g_get_real_time() / G_USEC_PER_SEC, mtime, n, min, median, mean, stddev,
+                                      user, sys, max_rss, args);
+        gchar *history_dir = g_path_get_dirname(history_path);
+        g_mkdir_with_parents(history_dir, 0700);
+        FILE *history = fopen(history_path, "a");
+        if (history) {
+            fputs(line, history);
+            fclose(history);
+        } else {
+            g_printerr("Failed to save benchmark history %s: %s\n", history_path, strerror(errno));
+        }
+
+        g_free(history_dir);
+        g_free(line);
+        g_free(history_path);
+        g_free(args);
+        g_array_free(walls, TRUE);
+    }
+    if (job->error) {
+        g_string_append_printf(report, "\n%s\n", job->error);
+    }
+
+    gchar *title = g_path_get_basename(job->path);
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT,
+                                               n > 0 ? GTK_MESSAGE_INFO : GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+                                               "Benchmark of %s", title);
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog), "%s", report->str);
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show(dialog);
+
+    g_free(title);
+    g_string_free(report, TRUE);
+    bench_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+// Asks for the run count, warmup, arguments and an optional stdin file, then
+// benchmarks on a background thread so the window stays responsive.
+void benchmark_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
+    const gchar *file_path = user_data;
+    GtkWidget *dialog = gtk_dialog_new_with_buttons("Benchmark", GTK_WINDOW(window), GTK_DIALOG_MODAL,
+                                                    "_Run", GTK_RESPONSE_OK,
+                                                    "_Cancel", GTK_RESPONSE_CANCEL,
+                                                    NULL);
+    GtkWidget *grid = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 5);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 5);
+    gtk_container_set_border_width(GTK_CONTAINER(grid), 5);
+    gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), grid);
+
+    GtkWidget *runs = gtk_spin_button_new_with_range(1, 10000, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(runs), BENCH_DEFAULT_RUNS);
+    GtkWidget *warmup = gtk_spin_button_new_with_range(0, 1000, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(warmup), BENCH_DEFAULT_WARMUP);
+    GtkWidget *args = gtk_entry_new();
+    GtkWidget *input = gtk_file_chooser_button_new("Standard input", GTK_FILE_CHOOSER_ACTION_OPEN);
+
+    const char *labels[] = {"Runs", "Warmup runs", "Arguments", "Standard input"};
+    GtkWidget *fields[] = {runs, warmup, args, input};
+    for (guint i = 0; i < G_N_ELEMENTS(fields); i++) {
+        GtkWidget *label = gtk_label_new(labels[i]);
+        gtk_widget_set_halign(label, GTK_ALIGN_START);
+        gtk_grid_attach(GTK_GRID(grid), label, 0, i, 1, 1);
+        gtk_grid_attach(GTK_GRID(grid), fields[i], 1, i, 1, 1);
+    }
+    gtk_widget_show_all(dialog);
+
+    TRACE_START(trace_start);
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    TRACE_END(trace_start, "dialog", "benchmark", file_path);
+    if (response == GTK_RESPONSE_OK) {
+        gchar **user_args = NULL;
+        gint n_args = 0;
+        GError *error = NULL;
+        const char *arg_text = gtk_entry_get_text(GTK_ENTRY(args));
+
+        if (arg_text[0] != '\0' && !g_shell_parse_argv(arg_text, &n_args, &user_args, &error)) {
+            g_printerr("Invalid arguments: %s\n", error->message);
+            g_error_free(error);
+        } else {
+            BenchJob *job = g_new0(BenchJob, 1);
+            job->path = g_strdup(file_path);
+            job->argv = g_new0(gchar *, n_args + 2);
+            job->argv[0] = g_strdup(file_path);
+            for (gint i = 0; i < n_args; i++) {
+                job->argv[i + 1] = g_strdup(user_args[i]);
+            }
+            job->stdin_path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(input));
+            job->runs = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(runs));
+            job->warmup = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(warmup));
+            job->samples = g_array_sized_new(FALSE, FALSE, sizeof(BenchSample), job->runs);
+            g_thread_unref(g_thread_new("benchmark", bench_thread, job));
+        }
+        g_strfreev(user_args);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+static void profile_job_free(ProfileJob *job) {
+    g_free(job->path);
+    g_free(job->report);
+    g_free(job);
+}
+
+static void remove_tree_quietly(const char *dir) {
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    if (handle) {
+        const char *name;
+        while ((name = g_dir_read_name(handle)) != NULL) {
+            gchar *path = g_build_filename(dir, name, NULL);
+            unlink(path);
+            g_free(path);
+        }
+        g_dir_close(handle);
+    }
+    rmdir(dir);
+}
+
+// Turns perf's stderr into something actionable; the common failure is the
+// kernel refusing unprivileged counters. The workload shares that stderr, so
+// only perf's own wording of the refusal counts.
+static gchar *profile_failure(const char *perf_stderr) {
+    if (perf_stderr && (strstr(perf_stderr, "perf_event_paranoid") ||
+                        strstr(perf_stderr, "Access to performance monitoring and observability operations is limited") ||
+                        strstr(perf_stderr, "No permission to enable"))) {
+        return g_strdup("perf is not allowed to access performance counters.\n"
+                        "Lower /proc/sys/kernel/perf_event_paranoid (e.g. sysctl kernel.perf_event_paranoid=1) "
+                        "or grant CAP_PERFMON.");
+    }
+    return g_strdup_printf("perf failed:\n%s", perf_stderr && *perf_stderr ? perf_stderr : "no output");
+}
+
+// perf stat -x, writes "value,unit,event,..." lines; unsupported counters
+// show up as "<not supported>" and are reported as such.
+static gchar *profile_parse_stat(const char *csv) {
+    static const char *const events[] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+    gdouble values[G_N_ELEMENTS(events)];
+    gboolean counted[G_N_ELEMENTS(events)] = {FALSE};
+    GString *report = g_string_new(NULL);
+    gchar **lines = g_strsplit(csv, "\n", -1);
+
+    for (gchar **line = lines; *line; line++) {
+        if (**line == '#' || **line == '\0') {
+            continue;
+        }
+        gchar **fields = g_strsplit(*line, ",", 4);
+        if (g_strv_length(fields) >= 3) {
+            for (guint i = 0; i < G_N_ELEMENTS(events); i++) {
+                // Hybrid CPUs report e.g. "cpu_core/cycles/".
+                if (g_str_has_prefix(fields[2], events[i]) || strstr(fields[2], events[i])) {
+                    gchar *end;
+                    gdouble value = g_ascii_strtod(fields[0], &end);
+                    if (end != fields[0]) {
+                        values[i] = counted[i] ? values[i] + value : value;
+                        counted[i] = TRUE;
+                    }
+                    break;
+                }
+            }
+        }
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+
+    for (guint i = 0; i < G_N_ELEMENTS(events); i++) {
+        if (counted[i]) {
+            g_string_append_printf(report, "%-15s %'18.0f\n", events[i], values[i]);
+        } else {
+            g_string_append_printf(report, "%-15s %18s\n", events[i], "not supported");
+        }
+    }
+    if (counted[0] && counted[1] && values[0] > 0) {
+        g_string_append_printf(report, "\n%.2f instructions per cycle\n", values[1] / values[0]);
+    }
+    if (counted[1] && counted[2] && values[1] > 0) {
+        g_string_append_printf(report, "%.2f cache misses per 1000 instructions\n", values[2] * 1000 / values[1]);
+    }
+    if (counted[1] && counted[3] && values[1] > 0) {
+        g_string_append_printf(report, "%.2f branch misses per 1000 instructions\n", values[3] * 1000 / values[1]);
+    }
+    return g_string_free(report, FALSE);
+}
+
+// Keeps the first PROFILE_TOP_SYMBOLS "  12.34%  prog  [.] symbol" rows of
+// perf report --stdio.
+static gchar *profile_parse_report(const char *text) {
+    GString *report = g_string_new("Hottest symbols (self time):\n\n");
+    gchar **lines = g_strsplit(text, "\n", -1);
+    guint shown = 0;
+
+    for (gchar **line = lines; *line && shown < PROFILE_TOP_SYMBOLS; line++) {
+        const char *p = *line;
+        while (*p == ' ') {
+            p++;
+        }
+        if (!g_ascii_isdigit(*p) || !strchr(p, '%')) {
+            continue;
+        }
+        g_string_append_printf(report, "%s\n", p);
+        shown++;
+    }
+    g_strfreev(lines);
+
+    if (shown == 0) {
+        g_string_append(report, "No samples were recorded; the program may have exited too quickly.\n");
+    }
+    return g_string_free(report, FALSE);
+}
+
+// perf exits with the workload's status, so whether it worked is told by
+// the output it leaves at output_path, not by the exit code.
+static gboolean profile_spawn(char **argv, const char *dir, const char *output_path, gchar **perf_stderr) {
+    GString *command = g_string_new(NULL);
+    for (char **arg = argv; *arg; arg++) {
+        gchar *quoted = g_shell_quote(*arg);
+        g_string_append_printf(command, "%s%s", command->len ? " " : "", quoted);
+        g_free(quoted);
+    }
+    gchar *program = g_path_get_basename(argv[g_strv_length(argv) - 1]);
+    gchar *title = g_strdup_printf("perf %s %s", argv[1], program);
+    g_free(program);
+    gchar **wrapped = job_wrap_argv("profile", title, command->str);
+    gint status;
+    GError *error = NULL;
+    struct stat statbuf;
+    gboolean spawned = g_spawn_sync(dir, wrapped, NULL, G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL,
+                                    NULL, perf_stderr, &status, &error);
+    g_strfreev(wrapped);
+    g_free(title);
+    g_string_free(command, TRUE);
+    if (!spawned) {
+        *perf_stderr = g_strdup(error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return stat(output_path, &statbuf) == 0 && statbuf.st_size > 0;
+}
+
+static gboolean show_profile_results(gpointer data);
+
+static gpointer profile_thread(gpointer data) {
+    ProfileJob *job = data;
+    gchar *dir = g_path_get_dirname(job->path);
+    gchar *scratch = g_dir_make_tmp("codews-perf-XXXXXX", NULL);
+    gchar *perf_stderr = NULL;
+    TRACE_START(trace_start);
+
+    if (scratch == NULL) {
+        job->report = g_strdup("Could not create a scratch directory for perf output.");
+    } else if (job->record) {
+        gchar *data_path = g_build_filename(scratch, "perf.data", NULL);
+        char *record_argv[] = {"perf", "record", "-g", "-q", "-o", data_path, "--", job->path, NULL};
+        char *report_argv[] = {"perf", "report", "-i", data_path, "--stdio", "--no-children", "-g", "none",
+                               "--sort", "symbol", "--percent-limit", "0.5", NULL};
+        gchar *report_text = NULL;
+
+        if (!profile_spawn(record_argv, dir, data_path, &perf_stderr)) {
+            job->report = profile_failure(perf_stderr);
+        } else {
+            g_free(perf_stderr);
+            perf_stderr = NULL;
+            GError *error = NULL;
+            gint status;
+            if (g_spawn_sync(dir, report_argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, &report_text, &perf_stderr,
+                             &status, &error) && g_spawn_check_exit_status(status, NULL)) {
+                job->report = profile_parse_report(report_text);
+                job->ok = TRUE;
+            } else {
+                job->report = profile_failure(error ? error->message : perf_stderr);
+                g_clear_error(&error);
+            }
+        }
+        g_free(report_text);
+        g_free(data_path);
+    } else {
+        gchar *stat_path = g_build_filename(scratch, "stat.csv", NULL);
+        char *stat_argv[] = {"perf", "stat", "-x", ",", "-e", "cycles,instructions,cache-misses,branch-misses",
+                             "-o", stat_path, "--", job->path, NULL};
+        gchar *csv = NULL;
+
+        if (profile_spawn(stat_argv, dir, stat_path, &perf_stderr) && g_file_get_contents(stat_path, &csv, NULL, NULL)) {
+            job->report = profile_parse_stat(csv);
+            job->ok = TRUE;
+        } else {
+            job->report = profile_failure(perf_stderr);
+        }
+        g_free(csv);
+        g_free(stat_path);
+    }
+
+    if (scratch) {
+        remove_tree_quietly(scratch);
+    }
+    TRACE_END(trace_start, "spawn", job->record ? "perf record" : "perf stat", job->path);
+    g_free(perf_stderr);
+    g_free(scratch);
+    g_free(dir);
+    g_idle_add(show_profile_results, job);
+    return NULL;
+}
+
+static gboolean show_profile_results(gpointer data) {
+    ProfileJob *job = data;
+    gchar *name = g_path_get_basename(job->path);
+    GtkWidget *dialog = gtk_dialog_new_with_buttons(job->record ? "perf record" : "perf stat", GTK_WINDOW(window),
+                                                    GTK_DIALOG_DESTROY_WITH_PARENT, "_Close", GTK_RESPONSE_CLOSE, NULL);
+    GtkWidget *header = gtk_label_new(name);
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    GtkWidget *text_view = gtk_text_view_new();
+    GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(text_view), FALSE);
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(text_view), TRUE);
+    gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view)), job->report, -1);
+    gtk_container_add(GTK_CONTAINER(scrolled), text_view);
+    gtk_widget_set_vexpand(scrolled, TRUE);
+    gtk_box_pack_start(GTK_BOX(content), header, FALSE, FALSE, 5);
+    gtk_box_pack_start(GTK_BOX(content), scrolled, TRUE, TRUE, 0);
+    gtk_window_set_default_size(GTK_WINDOW(dialog), 640, job->ok ? 420 : 200);
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show_all(dialog);
+
+    g_free(name);
+    profile_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void start_profile(const char *file_path, gboolean record) {
+    gchar *perf = g_find_program_in_path("perf");
+    if (perf == NULL) {
+        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                   GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+                                                   "perf is not installed");
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+                                                 "Install your distribution's perf (linux-tools) package to profile executables.");
+        g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+        gtk_widget_show(dialog);
+        return;
+    }
+    g_free(perf);
+
+    ProfileJob *job = g_new0(ProfileJob, 1);
+    job->path = g_strdup(file_path);
+    job->record = record;
+    g_thread_unref(g_thread_new("profile", profile_thread, job));
+}
+
+void profile_stat_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
+    start_profile(user_data, FALSE);
+}
+
+void profile_record_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
+    start_profile(user_data, TRUE);
+}
+
+static void toggle_profile_builds(GtkCheckMenuItem *item, gpointer user_data __attribute__((unused))) {
+    settings.profile_builds = gtk_check_menu_item_get_active(item);
+}
+
+static void job_record_free(JobRecord *record) {
+    g_free(record->kind);
+    g_free(record->title);
+    g_free(record->command);
+    g_free(record);
+}
+
+// Copies at most max bytes of text with tabs and newlines flattened, so a
+// record stays one line and the whole write fits in PIPE_BUF.
+static gchar *job_field(const char *text, gsize max) {
+    gchar *field = g_strndup(text, max);
+    g_strdelimit(field, "\t\n\r", ' ');
+    return field;
+}
+
+static void job_report(const char *fifo, const char *line) {
+    int fd = open(fifo, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) {
+        if (write(fd, line, strlen(line)) < 0) {
+            // The window went away; the job itself still matters more.
+        }
+        close(fd);
+    }
+}
+
+static volatile pid_t job_child_pid;
+
+// A SIGTERM meant for the job (a cancelled background build signals the
+// whole group, a bare kill only the wrapper) ends the job, not the wrapper,
+// which still has its rusage to report.
+static void job_forward_signal(int signum) {
+    if (job_child_pid > 0) {
+        kill(job_child_pid, signum);
+    }
+}
+
+// `codews --job FIFO KIND TITLE SHELL COMMAND`, run in place of COMMAND:
+// runs it with SHELL -c, waits with wait4() and reports the start and the
+// rusage to the window through FIFO. Terminal tabs pass the tab's own shell,
+// background spawns /bin/sh. With [jobs] cgroup on, the command gets a
+// systemd scope of its own carrying the configured limits.
+static int job_main(int argc, char *argv[]) {
+    if (argc != 7) {
+        fprintf(stderr, "usage: %s --job FIFO KIND TITLE SHELL COMMAND\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *fifo = argv[2], *shell = argv[5], *command = argv[6];
+    load_settings();
+
+    GPtrArray *child_argv = g_ptr_array_new_with_free_func(g_free);
+    gchar *systemd_run = settings.job_cgroup ? g_find_program_in_path("systemd-run") : NULL;
+    if (systemd_run) {
+        g_ptr_array_add(child_argv, systemd_run);
+        g_ptr_array_add(child_argv, g_strdup("--user"));
+        g_ptr_array_add(child_argv, g_strdup("--scope"));
+        g_ptr_array_add(child_argv, g_strdup("--quiet"));
+        g_ptr_array_add(child_argv, g_strdup("--collect"));
+        if (settings.job_memory_max) {
+            g_ptr_array_add(child_argv, g_strdup_printf("--property=MemoryMax=%s", settings.job_memory_max));
+            g_ptr_array_add(child_argv, g_strdup("--property=MemorySwapMax=0"));
+        }
+        if (settings.job_cpu_quota) {
+            g_ptr_array_add(child_argv, g_strdup_printf("--property=CPUQuota=%s", settings.job_cpu_quota));
+        }
+        g_ptr_array_add(child_argv, g_strdup("--"));
+    } else if (settings.job_cgroup) {
+        fprintf(stderr, "codews: systemd-run not found, running without resource limits\n");
+    }
+    g_ptr_array_add(child_argv, g_strdup(shell));
+    g_ptr_array_add(child_argv, g_strdup("-c"));
+    g_ptr_array_add(child_argv, g_strdup(command));
+    g_ptr_array_add(child_argv, NULL);
+
+    // Like system(3): the terminal's Ctrl+C is for the job, and the wrapper
+    // has to survive it to report how the job ended.
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, job_forward_signal);
+
+    gint64 started = g_get_real_time();
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        execvp(g_ptr_array_index(child_argv, 0), (char **)child_argv->pdata);
+        _exit(127);
+    }
+    g_ptr_array_unref(child_argv);
+    if (pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    job_child_pid = pid;
+
+    gchar *kind = job_field(argv[3], 32);
+    gchar *title = job_field(argv[4], 256);
+    gchar *summary = job_field(command, JOB_COMMAND_MAX);
+    gchar *line = g_strdup_printf("start\t%d\t%" G_GINT64_FORMAT "\t%s\t%s\t%s\n", (int)pid, started, kind, title, summary);
+    job_report(fifo, line);
+    g_free(line);
+    g_free(summary);
+    g_free(title);
+    g_free(kind);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return EXIT_FAILURE;
+        }
+    }
+
+    line = g_strdup_printf("end\t%d\t%" G_GINT64_FORMAT "\t%d\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%ld\t%ld\t%ld\n",
+                           (int)pid, g_get_real_time(), status,
+                           (gint64)usage.ru_utime.tv_sec * G_USEC_PER_SEC + usage.ru_utime.tv_usec,
+                           (gint64)usage.ru_stime.tv_sec * G_USEC_PER_SEC + usage.ru_stime.tv_usec,
+                           usage.ru_maxrss, usage.ru_inblock, usage.ru_oublock);
+    job_report(fifo, line);
+    g_free(line);
+
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// Wraps a terminal command so that it reports back through the job FIFO,
+// still run by the tab's shell.
+static gchar *job_wrap_command(const char *kind, const char *title, const char *command) {
+    if (job_fifo_path == NULL || self_exe_path == NULL) {
+        return g_strdup(command);
+    }
+    gchar *quoted[] = {g_shell_quote(self_exe_path), g_shell_quote(job_fifo_path), g_shell_quote(kind),
+                       g_shell_quote(title), g_shell_quote(terminal_shell), g_shell_quote(command)};
+    gchar *wrapped = g_strdup_printf("%s --job %s %s %s %s %s", quoted[0], quoted[1], quoted[2], quoted[3], quoted[4],
+                                     quoted[5]);
+    for (guint i = 0; i < G_N_ELEMENTS(quoted); i++) {
+        g_free(quoted[i]);
+    }
+    return wrapped;
+}
+
+// The argv for a command spawned without a terminal: /bin/sh -c COMMAND,
+// under the job wrapper when there is a FIFO to report to. Safe to call
+// from workers.
+static gchar **job_wrap_argv(const char *kind, const char *title, const char *command) {
+    GPtrArray *argv = g_ptr_array_new();
+    g_mutex_lock(&job_fifo_lock);
+    if (job_fifo_path && self_exe_path) {
+        g_ptr_array_add(argv, g_strdup(self_exe_path));
+        g_ptr_array_add(argv, g_strdup("--job"));
+        g_ptr_array_add(argv, g_strdup(job_fifo_path));
+        g_ptr_array_add(argv, g_strdup(kind));
+        g_ptr_array_add(argv, g_strdup(title));
+        g_ptr_array_add(argv, g_strdup("/bin/sh"));
+    } else {
+        g_ptr_array_add(argv, g_strdup("/bin/sh"));
+        g_ptr_array_add(argv, g_strdup("-c"));
+    }
+    g_mutex_unlock(&job_fifo_lock);
+    g_ptr_array_add(argv, g_strdup(command));
+    g_ptr_array_add(argv, NULL);
+    return (gchar **)g_ptr_array_free(argv, FALSE);
+}
+
+static JobRecord *job_history_find(pid_t pid) {
+    for (GList *link = job_history.tail; link; link = link->prev) {
+        JobRecord *record = link->data;
+        if (record->pid == pid && !record->finished) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+static void job_history_apply(const char *line) {
+    gchar **fields = g_strsplit(line, "\t", -1);
+    guint n = g_strv_length(fields);
+
+    if (n == 6 && strcmp(fields[0], "start") == 0) {
+        JobRecord *record = g_new0(JobRecord, 1);
+        record->pid = atoi(fields[1]);
+        record->start_us = g_ascii_strtoll(fields[2], NULL, 10);
+        record->kind = g_strdup(fields[3]);
+        record->title = g_strdup(fields[4]);
+        record->command = g_strdup(fields[5]);
+        g_queue_push_tail(&job_history, record);
+        while (job_history.length > JOB_HISTORY_SIZE) {
+            job_record_free(g_queue_pop_head(&job_history));
+        }
+    } else if (n == 9 && strcmp(fields[0], "end") == 0) {
+        JobRecord *record = job_history_find(atoi(fields[1]));
+        if (record) {
+            record->end_us = g_ascii_strtoll(fields[2], NULL, 10);
+            record->status = atoi(fields[3]);
+            record->user_us = g_ascii_strtoll(fields[4], NULL, 10);
+            record->sys_us = g_ascii_strtoll(fields[5], NULL, 10);
+            record->max_rss_kb = g_ascii_strtoll(fields[6], NULL, 10);
+            record->in_blocks = g_ascii_strtoll(fields[7], NULL, 10);
+            record->out_blocks = g_ascii_strtoll(fields[8], NULL, 10);
+            record->finished = TRUE;
+        }
+    }
+    g_strfreev(fields);
+}
+
+static gchar *format_job_status(const JobRecord *record) {
+    if (!record->finished) {
+        return g_strdup("running");
+    }
+    if (WIFSIGNALED(record->status)) {
+        return g_strdup_printf("signal %d", WTERMSIG(record->status));
+    }
+    return g_strdup_printf("exit %d", WEXITSTATUS(record->status));
+}
+
+// Newest first; rebuilt wholesale since the history is small.
+static void job_history_refresh(void) {
+    if (job_history_store == NULL) {
+        return;
+    }
+    gtk_list_store_clear(job_history_store);
+    for (GList *link = job_history.tail; link; link = link->prev) {
+        JobRecord *record = link->data;
+        GDateTime *when = g_date_time_new_from_unix_local(record->start_us / G_USEC_PER_SEC);
+        gchar *started = g_date_time_format(when, "%H:%M:%S");
+        gchar *status = format_job_status(record);
+        gchar *duration = record->finished ? g_strdup_printf("%.2f s", (record->end_us - record->start_us) / 1e6) : g_strdup("");
+        gchar *cpu = record->finished ? g_strdup_printf("%.2f / %.2f s", record->user_us / 1e6, record->sys_us / 1e6) : g_strdup("");
+        gchar *rss = record->finished ? g_strdup_printf("%.1f MiB", record->max_rss_kb / 1024.0) : g_strdup("");
+        gchar *io = record->finished ? g_strdup_printf("%" G_GINT64_FORMAT " / %" G_GINT64_FORMAT, record->in_blocks, record->out_blocks) : g_strdup("");
+        // The tooltip column is markup.
+        gchar *command = g_markup_escape_text(record->command, -1);
+
+        gtk_list_store_insert_with_values(job_history_store, NULL, -1,
+                                          JOB_COL_TITLE, record->title,
+                                          JOB_COL_KIND, record->kind,
+                                          JOB_COL_PID, record->pid,
+                                          JOB_COL_STARTED, started,
+                                          JOB_COL_DURATION, duration,
+                                          JOB_COL_STATUS, status,
+                                          JOB_COL_CPU, cpu,
+                                          JOB_COL_RSS, rss,
+                                          JOB_COL_IO, io,
+                                          JOB_COL_COMMAND, command,
+                                          -1);
+        g_free(command);
+        g_free(io);
+        g_free(rss);
+        g_free(cpu);
+        g_free(duration);
+        g_free(status);
+        g_free(started);
+        g_date_time_unref(when);
+    }
+}
+
+static gboolean on_job_fifo_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096];
+    ssize_t len;
+
+    while ((len = read(job_fifo_fd, buf, sizeof(buf))) > 0) {
+        g_string_append_len(job_fifo_buffer, buf, len);
+    }
+
+    gchar *start = job_fifo_buffer->str, *newline;
+    while ((newline = memchr(start, '\n', job_fifo_buffer->str + job_fifo_buffer->len - start)) != NULL) {
+        *newline = '\0';
+        job_history_apply(start);
+        start = newline + 1;
+    }
+    g_string_erase(job_fifo_buffer, 0, start - job_fifo_buffer->str);
+
+    job_history_refresh();
+    return G_SOURCE_CONTINUE;
+}
+
+// The FIFO is opened read-write so it never reports EOF between jobs.
+static void job_history_init(void) {
+    gchar *runtime_dir = g_build_filename(g_get_user_runtime_dir(), "codews", NULL);
+    g_mkdir_with_parents(runtime_dir, 0700);
+    gchar *path = g_strdup_printf("%s/jobs-%d.fifo", runtime_dir, (int)getpid());
+    g_free(runtime_dir);
+
+    unlink(path);
+    if (mkfifo(path, 0600) != 0 || (job_fifo_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        g_printerr("Job accounting disabled, cannot create %s: %s\n", path, strerror(errno));
+        unlink(path);
+        g_free(path);
+        return;
+    }
+    g_mutex_lock(&job_fifo_lock);
+    job_fifo_path = path;
+    g_mutex_unlock(&job_fifo_lock);
+    job_fifo_buffer = g_string_new(NULL);
+
+    GIOChannel *channel = g_io_channel_unix_new(job_fifo_fd);
+    g_io_add_watch(channel, G_IO_IN, on_job_fifo_event, NULL);
+    g_io_channel_unref(channel);
+}
+
+// Lines from the daemon's subscription: changes in the tree and lines from
+// its job FIFO. If the daemon goes away the window takes over both itself.
+static gboolean on_daemon_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096];
+    ssize_t len;
+    gboolean jobs_changed = FALSE, index_changed = FALSE;
+
+    while ((len = read(daemon_events_fd, buf, sizeof(buf))) > 0) {
+        g_string_append_len(daemon_events_buffer, buf, len);
+    }
+    gboolean lost = len == 0 || (errno != EAGAIN && errno != EINTR);
+
+    gchar *start = daemon_events_buffer->str, *newline;
+    while ((newline = memchr(start, '\n', daemon_events_buffer->str + daemon_events_buffer->len - start)) != NULL) {
+        *newline = '\0';
+        if (g_str_has_prefix(start, "job\t")) {
+            job_history_apply(start + strlen("job\t"));
+            jobs_changed = TRUE;
+        } else if (g_str_has_prefix(start, "event\t")) {
+            gchar **fields = g_strsplit(start, "\t", 4);
+            if (g_strv_length(fields) == 4) {
+                index_note_event(fields[2], fields[3], strtoul(fields[1], NULL, 10));
+            }
+            g_strfreev(fields);
+            index_changed = TRUE;
+        } else if (strcmp(start, "rescan") == 0) {
+            index_changed = TRUE;
+        }
+        start = newline + 1;
+    }
+    g_string_erase(daemon_events_buffer, 0, start - daemon_events_buffer->str);
+
+    if (jobs_changed) {
+        job_history_refresh();
+    }
+    if (index_changed) {
+        finder_refresh();
+    }
+    if (!lost) {
+        return G_SOURCE_CONTINUE;
+    }
+    daemon_events_watch = 0;
+    daemon_lost();
+    return G_SOURCE_REMOVE;
+}
+
+// Takes over the index and the job history once the daemon is gone.
+static void daemon_lost(void) {
+    g_printerr("Lost the codews daemon, indexing the workspace locally\n");
+    if (daemon_events_watch) {
+        g_source_remove(daemon_events_watch);
+        daemon_events_watch = 0;
+    }
+    close(daemon_events_fd);
+    daemon_events_fd = -1;
+    daemon_running = FALSE;
+    if (job_fifo_fd < 0) {
+        g_mutex_lock(&job_fifo_lock);
+        g_clear_pointer(&job_fifo_path, g_free);
+        g_mutex_unlock(&job_fifo_lock);
+        job_history_init();
+    }
+    index_init();
+}
+
+// With a daemon running, the window asks it for the file index, the finder,
+// listings and job accounting instead of keeping its own.
+static gboolean daemon_client_init(void) {
+    gchar *fifo_path = NULL;
+    daemon_events_fd = daemon_subscribe(&fifo_path);
+    if (daemon_events_fd < 0) {
+        return FALSE;
+    }
+    // Requests go out on each asking thread's own connection.
+    daemon_running = TRUE;
+    fcntl(daemon_events_fd, F_SETFL, fcntl(daemon_events_fd, F_GETFL) | O_NONBLOCK);
+    daemon_events_buffer = g_string_new(NULL);
+
+    GIOChannel *channel = g_io_channel_unix_new(daemon_events_fd);
+    daemon_events_watch = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR, on_daemon_event, NULL);
+    g_io_channel_unref(channel);
+
+    // Without its FIFO the daemon keeps no job history; keep one here.
+    g_mutex_lock(&job_fifo_lock);
+    job_fifo_path = fifo_path;
+    g_mutex_unlock(&job_fifo_lock);
+    return fifo_path != NULL;
+}
+
+static void show_job_history(void) {
+    if (job_history_window == NULL) {
+        job_history_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(job_history_window), "Job History");
+        gtk_window_set_transient_for(GTK_WINDOW(job_history_window), GTK_WINDOW(window));
+        gtk_window_set_default_size(GTK_WINDOW(job_history_window), 1000, 400);
+        g_signal_connect(job_history_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+        job_history_store = gtk_list_store_new(JOB_N_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_STRING,
+                                               G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+                                               G_TYPE_STRING, G_TYPE_STRING);
+        GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(job_history_store));
+        static const struct { const char *title; gint column; } columns[] = {
+            {"Job", JOB_COL_TITLE}, {"Kind", JOB_COL_KIND}, {"PID", JOB_COL_PID},
+            {"Started", JOB_COL_STARTED}, {"Wall", JOB_COL_DURATION}, {"Result", JOB_COL_STATUS},
+            {"CPU user / sys", JOB_COL_CPU}, {"Max RSS", JOB_COL_RSS}, {"Blocks in / out", JOB_COL_IO},
+        };
+        for (guint i = 0; i < G_N_ELEMENTS(columns); i++) {
+            gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, columns[i].title,
+                                                        gtk_cell_renderer_text_new(), "text", columns[i].column, NULL);
+        }
+        gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(view), JOB_COL_COMMAND);
+
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_container_add(GTK_CONTAINER(scrolled), view);
+        gtk_container_add(GTK_CONTAINER(job_history_window), scrolled);
+    }
+    job_history_refresh();
+    gtk_widget_show_all(job_history_window);
+    gtk_window_present(GTK_WINDOW(job_history_window));
+}
+
+static gchar *workspace_tree_full_path(const char *rel) {
+    return rel[0] ? g_build_filename(base_dir, rel, NULL) : g_strdup(base_dir);
+}
+
+// Directories first, then by name; the loader and the merge must agree.
+static gint workspace_tree_compare(gboolean a_dir, const char *a, gboolean b_dir, const char *b) {
+    if (a_dir != b_dir) {
+        return a_dir ? -1 : 1;
+    }
+    return strcmp(a, b);
+}
+
+static gint workspace_tree_compare_records(gconstpointer a, gconstpointer b, gpointer data) {
+    const EntryRecord *ra = a, *rb = b;
+    const GString *names = data;
+    return workspace_tree_compare(S_ISDIR(ra->mode), names->str + ra->name_offset,
+                                  S_ISDIR(rb->mode), names->str + rb->name_offset);
+}
+
+static gboolean workspace_tree_add_entry(const char *name, const EntryRecord *record, gpointer data) {
+    WorkspaceTreeLoad *load = data;
+    EntryRecord rec = *record;
+
+    rec.name_offset = load->names->len;
+    g_string_append_len(load->names, name, strlen(name) + 1);
+    g_array_append_val(load->records, rec);
+    return TRUE;
+}
+
+static void workspace_tree_load_free(WorkspaceTreeLoad *load) {
+    g_free(load->rel);
+    g_array_free(load->records, TRUE);
+    g_string_free(load->names, TRUE);
+    g_free(load);
+}
+
+static gboolean workspace_tree_load_done(gpointer data);
+
+static void workspace_tree_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    WorkspaceTreeLoad *load = data;
+    gchar *dir = workspace_tree_full_path(load->rel);
+
+    load->error = list_directory(dir, NULL, workspace_tree_add_entry, load);
+    g_array_sort_with_data(load->records, workspace_tree_compare_records, load->names);
+    g_free(dir);
+    g_idle_add(workspace_tree_load_done, load);
+}
+
+static void workspace_tree_load(const char *rel) {
+    WorkspaceTreeLoad *load = g_new0(WorkspaceTreeLoad, 1);
+    load->rel = g_strdup(rel);
+    load->records = g_array_new(FALSE, FALSE, sizeof(EntryRecord));
+    load->names = g_string_new(NULL);
+    g_thread_pool_push(workspace_tree_pool, load, NULL);
+}
+
+// Only directories that are loading or loaded can be looked up by path; the
+// rest are reached through their parent.
+static gboolean workspace_tree_lookup(const char *rel, GtkTreeIter *iter) {
+    GtkTreeRowReference *ref = g_hash_table_lookup(workspace_tree_rows, rel);
+    if (ref == NULL || !gtk_tree_row_reference_valid(ref)) {
+        return FALSE;
+    }
+    GtkTreePath *path = gtk_tree_row_reference_get_path(ref);
+    gboolean found = gtk_tree_model_get_iter(GTK_TREE_MODEL(workspace_tree_store), iter, path);
+    gtk_tree_path_free(path);
+    return found;
+}
+
+static WorkspaceTreeState workspace_tree_get_state(GtkTreeIter *iter) {
+    gint state = workspace_tree_root_state;
+    if (iter) {
+        gtk_tree_model_get(GTK_TREE_MODEL(workspace_tree_store), iter, WORKSPACE_TREE_COL_STATE, &state, -1);
+    }
+    return state;
+}
+
+static void workspace_tree_set_state(GtkTreeIter *iter, WorkspaceTreeState state) {
+    if (iter) {
+        gtk_tree_store_set(workspace_tree_store, iter, WORKSPACE_TREE_COL_STATE, state, -1);
+    } else {
+        workspace_tree_root_state = state;
+    }
+}
+
+static void workspace_tree_add_placeholder(GtkTreeIter *parent, gint position) {
+    GtkTreeIter child;
+    gtk_tree_store_insert_with_values(workspace_tree_store, &child, parent, position,
+                                      WORKSPACE_TREE_COL_NAME, "Loading...",
+                                      WORKSPACE_TREE_COL_STATE, WORKSPACE_TREE_PLACEHOLDER, -1);
+}
+
+static void workspace_tree_insert(GtkTreeIter *parent, GtkTreeIter *sibling, const char *parent_rel,
+                                  const char *name, gboolean is_dir) {
+    gchar *rel = parent_rel[0] ? g_strconcat(parent_rel, "/", name, NULL) : g_strdup(name);
+    GtkTreeIter iter;
+
+    gtk_tree_store_insert_before(workspace_tree_store, &iter, parent, sibling);
+    gtk_tree_store_set(workspace_tree_store, &iter, WORKSPACE_TREE_COL_NAME, name, WORKSPACE_TREE_COL_REL, rel,
+                       WORKSPACE_TREE_COL_STATE, is_dir ? WORKSPACE_TREE_UNLOADED : WORKSPACE_TREE_FILE,
+                       WORKSPACE_TREE_COL_COLLAPSED_AT, (gint64)0, -1);
+    if (is_dir) {
+        // Gives the row an expander without listing anything yet.
+        workspace_tree_add_placeholder(&iter, -1);
+    }
+    g_free(rel);
+}
+
+// Drops the lookup entries of a row and everything loaded below it.
+static void workspace_tree_forget(GtkTreeIter *iter) {
+    GtkTreeModel *model = GTK_TREE_MODEL(workspace_tree_store);
+    gchar *rel;
+    gint state;
+
+    gtk_tree_model_get(model, iter, WORKSPACE_TREE_COL_REL, &rel, WORKSPACE_TREE_COL_STATE, &state, -1);
+    if (state == WORKSPACE_TREE_LOADING || state == WORKSPACE_TREE_LOADED) {
+        GtkTreeIter child;
+        if (gtk_tree_model_iter_children(model, &child, iter)) {
+            do {
+                workspace_tree_forget(&child);
+            } while (gtk_tree_model_iter_next(model, &child));
+        }
+        g_hash_table_remove(workspace_tree_rows, rel);
+    }
+    g_free(rel);
+}
+
+// Both sides are sorted the same way, so one pass inserts new entries and
+// removes vanished ones while rows that stayed keep their expansion.
+static void workspace_tree_merge(GtkTreeIter *parent, WorkspaceTreeLoad *load) {
+    GtkTreeModel *model = GTK_TREE_MODEL(workspace_tree_store);
+    GtkTreeIter child, placeholder;
+    gboolean valid = gtk_tree_model_iter_children(model, &child, parent);
+    gboolean has_placeholder = FALSE;
+    guint i = 0;
+
+    // The placeholder goes last: a row left without children collapses.
+    if (valid && workspace_tree_get_state(&child) == WORKSPACE_TREE_PLACEHOLDER) {
+        placeholder = child;
+        has_placeholder = TRUE;
+        valid = gtk_tree_model_iter_next(model, &child);
+    }
+
+    while (valid || i < load->records->len) {
+        const EntryRecord *rec = i < load->records->len ? &g_array_index(load->records, EntryRecord, i) : NULL;
+        const char *name = rec ? load->names->str + rec->name_offset : NULL;
+        gint cmp = 1;
+
+        if (valid) {
+            gchar *child_name;
+            gint state;
+            gtk_tree_model_get(model, &child, WORKSPACE_TREE_COL_NAME, &child_name, WORKSPACE_TREE_COL_STATE, &state, -1);
+            cmp = rec ? workspace_tree_compare(state != WORKSPACE_TREE_FILE, child_name, S_ISDIR(rec->mode), name) : -1;
+            g_free(child_name);
+        }
+
+        if (cmp < 0) {
+            workspace_tree_forget(&child);
+            valid = gtk_tree_store_remove(workspace_tree_store, &child);
+        } else if (cmp > 0) {
+            workspace_tree_insert(parent, valid ? &child : NULL, load->rel, name, S_ISDIR(rec->mode));
+            i++;
+        } else {
+            valid = gtk_tree_model_iter_next(model, &child);
+            i++;
+        }
+    }
+
+    if (has_placeholder) {
+        gtk_tree_store_remove(workspace_tree_store, &placeholder);
+    }
+}
+
+// Re-expands the children that were open when the workshop last closed.
+static void workspace_tree_restore_children(GtkTreeIter *parent) {
+    GtkTreeModel *model = GTK_TREE_MODEL(workspace_tree_store);
+    GtkTreeIter child;
+
+    if (g_hash_table_size(workspace_tree_restore) == 0 || !gtk_tree_model_iter_children(model, &child, parent)) {
+        return;
+    }
+    do {
+        gchar *rel;
+        gint state;
+        gtk_tree_model_get(model, &child, WORKSPACE_TREE_COL_REL, &rel, WORKSPACE_TREE_COL_STATE, &state, -1);
+        if (state == WORKSPACE_TREE_UNLOADED && g_hash_table_remove(workspace_tree_restore, rel)) {
+            GtkTreePath *path = gtk_tree_model_get_path(model, &child);
+            gtk_tree_view_expand_row(GTK_TREE_VIEW(workspace_tree_view), path, FALSE);
+            gtk_tree_path_free(path);
+        }
+        g_free(rel);
+    } while (gtk_tree_model_iter_next(model, &child));
+}
+
+static gboolean workspace_tree_load_done(gpointer data) {
+    WorkspaceTreeLoad *load = data;
+    GtkTreeIter iter, *parent = NULL;
+
+    // The row may have been released or deleted while the listing ran.
+    if (load->rel[0] == '\0' || workspace_tree_lookup(load->rel, &iter)) {
+        parent = load->rel[0] ? &iter : NULL;
+        if (workspace_tree_get_state(parent) == WORKSPACE_TREE_LOADING) {
+            TRACE_START(trace_start);
+            if (load->error) {
+                g_printerr("Failed to list %s: %s\n", load->rel[0] ? load->rel : base_dir, strerror(load->error));
+            }
+            workspace_tree_merge(parent, load);
+            workspace_tree_set_state(parent, WORKSPACE_TREE_LOADED);
+            workspace_tree_restore_children(parent);
+            TRACE_ENDF(trace_start, "model", "tree children", "%s: %u entries", load->rel, load->records->len);
+        }
+    }
+    workspace_tree_load_free(load);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_workspace_tree_expanded(GtkTreeView *view __attribute__((unused)), GtkTreeIter *iter,
+                                       GtkTreePath *path, gpointer data __attribute__((unused))) {
+    gtk_tree_store_set(workspace_tree_store, iter, WORKSPACE_TREE_COL_COLLAPSED_AT, (gint64)0, -1);
+    if (workspace_tree_get_state(iter) != WORKSPACE_TREE_UNLOADED) {
+        return;
+    }
+
+    gchar *rel;
+    gtk_tree_model_get(GTK_TREE_MODEL(workspace_tree_store), iter, WORKSPACE_TREE_COL_REL, &rel, -1);
+    g_hash_table_replace(workspace_tree_rows, g_strdup(rel),
+                         gtk_tree_row_reference_new(GTK_TREE_MODEL(workspace_tree_store), path));
+    workspace_tree_set_state(iter, WORKSPACE_TREE_LOADING);
+    workspace_tree_load(rel);
+    g_free(rel);
+}
+
+static void on_workspace_tree_collapsed(GtkTreeView *view __attribute__((unused)), GtkTreeIter *iter,
+                                        GtkTreePath *path __attribute__((unused)), gpointer data __attribute__((unused))) {
+    gtk_tree_store_set(workspace_tree_store, iter, WORKSPACE_TREE_COL_COLLAPSED_AT, g_get_monotonic_time(), -1);
+}
+
+// Puts a loaded directory back to a single placeholder child.
+static void workspace_tree_release(GtkTreeIter *iter) {
+    GtkTreeModel *model = GTK_TREE_MODEL(workspace_tree_store);
+    GtkTreeIter child;
+
+    workspace_tree_forget(iter);
+    workspace_tree_add_placeholder(iter, 0);
+    while (gtk_tree_model_iter_nth_child(model, &child, iter, 1)) {
+        gtk_tree_store_remove(workspace_tree_store, &child);
+    }
+    gtk_tree_store_set(workspace_tree_store, iter, WORKSPACE_TREE_COL_STATE, WORKSPACE_TREE_UNLOADED,
+                       WORKSPACE_TREE_COL_COLLAPSED_AT, (gint64)0, -1);
+}
+
+static gboolean workspace_tree_release_collapsed(gpointer data __attribute__((unused))) {
+    GtkTreeModel *model = GTK_TREE_MODEL(workspace_tree_store);
+    gint64 now = g_get_monotonic_time();
+    GPtrArray *expired = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter it;
+    gpointer key;
+
+    g_hash_table_iter_init(&it, workspace_tree_rows);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        GtkTreeIter iter;
+        if (!workspace_tree_lookup(key, &iter) || workspace_tree_get_state(&iter) != WORKSPACE_TREE_LOADED) {
+            continue;
+        }
+        GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+        gboolean expanded = gtk_tree_view_row_expanded(GTK_TREE_VIEW(workspace_tree_view), path);
+        gtk_tree_path_free(path);
+        if (expanded) {
+            continue;
+        }
+
+        // Rows folded away with their parent never see row-collapsed; their
+        // clock starts here.
+        gint64 collapsed_at;
+        gtk_tree_model_get(model, &iter, WORKSPACE_TREE_COL_COLLAPSED_AT, &collapsed_at, -1);
+        if (collapsed_at == 0) {
+            gtk_tree_store_set(workspace_tree_store, &iter, WORKSPACE_TREE_COL_COLLAPSED_AT, now, -1);
+        } else if (now - collapsed_at >= WORKSPACE_TREE_RELEASE_S * G_USEC_PER_SEC) {
+            g_ptr_array_add(expired, g_strdup(key));
+        }
+    }
+
+    for (guint i = 0; i < expired->len; i++) {
+        GtkTreeIter iter;
+        // Gone already if an expired ancestor was released first.
+        if (workspace_tree_lookup(g_ptr_array_index(expired, i), &iter)) {
+            workspace_tree_release(&iter);
+        }
+    }
+    g_ptr_array_free(expired, TRUE);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean workspace_tree_flush_reloads(gpointer data __attribute__((unused))) {
+    GHashTableIter it;
+    gpointer key;
+
+    g_hash_table_iter_init(&it, workspace_tree_reloads);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        const char *rel = key;
+        GtkTreeIter iter, *parent = NULL;
+        if (rel[0]) {
+            if (!workspace_tree_lookup(rel, &iter)) {
+                g_hash_table_iter_remove(&it);
+                continue;
+            }
+            parent = &iter;
+        }
+        WorkspaceTreeState state = workspace_tree_get_state(parent);
+        if (state == WORKSPACE_TREE_LOADING) {
+            // The listing in flight may predate the change; retry after it lands.
+            continue;
+        }
+        if (state == WORKSPACE_TREE_LOADED) {
+            workspace_tree_set_state(parent, WORKSPACE_TREE_LOADING);
+            workspace_tree_load(rel);
+        }
+        g_hash_table_iter_remove(&it);
+    }
+
+    if (g_hash_table_size(workspace_tree_reloads) > 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    workspace_tree_reload_id = 0;
+    return G_SOURCE_REMOVE;
 }
-*/
 
-static void open_file_with_appropriate_application(const char *filepath) {
-    struct stat path_stat;
-    if (stat(filepath, &path_stat) != 0 || S_ISDIR(path_stat.st_mode)) {
-        g_print("Attempted to open a directory or invalid path: %s\n", filepath);
+// Fed from the file index's watches, which cover the whole workspace. A
+// burst of changes in one directory turns into a single relisting of it.
+static void workspace_tree_note_change(const char *dir) {
+    if (workspace_tree_rows == NULL || (dir[0] && !g_hash_table_contains(workspace_tree_rows, dir))) {
         return;
     }
+    g_hash_table_add(workspace_tree_reloads, g_strdup(dir));
+    if (workspace_tree_reload_id == 0) {
+        workspace_tree_reload_id = g_timeout_add(WORKSPACE_TREE_RELOAD_MS, workspace_tree_flush_reloads, NULL);
+    }
+}
 
-    gchar *command = NULL;
-
-    if (has_extension(filepath, "jpg") || has_extension(filepath, "png")) {
-        command = g_strdup_printf("feh \"%s\"", filepath);
-    } else if (has_extension(filepath, "pdf")) {
-        command = g_strdup_printf("zathura \"%s\"", filepath);
-    } else {
-        command = g_strdup_printf("nvim \"%s\"", filepath);
+static void on_workspace_tree_activated(GtkTreeView *view __attribute__((unused)), GtkTreePath *path,
+                                        GtkTreeViewColumn *col __attribute__((unused)), gpointer data __attribute__((unused))) {
+    GtkTreeIter iter;
+    if (!gtk_tree_model_get_iter(GTK_TREE_MODEL(workspace_tree_store), &iter, path)) {
+        return;
     }
 
-    gchar *argv[] = {"/bin/sh", "-c", command, NULL};
+    gchar *rel;
+    gint state;
+    gtk_tree_model_get(GTK_TREE_MODEL(workspace_tree_store), &iter, WORKSPACE_TREE_COL_REL, &rel,
+                       WORKSPACE_TREE_COL_STATE, &state, -1);
+    if (state == WORKSPACE_TREE_FILE) {
+        gchar *full_path = workspace_tree_full_path(rel);
+        open_file_with_appropriate_application(full_path);
+        g_free(full_path);
+    } else if (state != WORKSPACE_TREE_PLACEHOLDER) {
+        g_free(current_dir);
+        current_dir = workspace_tree_full_path(rel);
+        display_directory(current_dir);
+    }
+    g_free(rel);
+}
 
-    vte_terminal_spawn_async(
-        VTE_TERMINAL(terminal),
-        VTE_PTY_DEFAULT,
-        NULL,
-        argv,
-        NULL,
-        G_SPAWN_DEFAULT,
-        NULL, NULL,
-        NULL,
-        -1,
-        NULL, NULL,
-        NULL);
+static void render_workspace_tree_name(GtkTreeViewColumn *column __attribute__((unused)), GtkCellRenderer *renderer,
+                                       GtkTreeModel *model, GtkTreeIter *iter, gpointer data __attribute__((unused))) {
+    gchar *name;
+    gint state;
+    const char *colour = NULL;
 
-    g_free(command);
+    gtk_tree_model_get(model, iter, WORKSPACE_TREE_COL_NAME, &name, WORKSPACE_TREE_COL_STATE, &state, -1);
+    if (state == WORKSPACE_TREE_PLACEHOLDER) {
+        colour = "gray";
+    } else if (state != WORKSPACE_TREE_FILE) {
+        colour = "blue";
+    }
+    g_object_set(renderer, "text", name, "foreground", colour, NULL);
+    g_free(name);
 }
 
-static void display_directory(const char *dir) {
-    DIR *d;
-    struct dirent *entry;
+static void workspace_tree_save_row(GtkTreeView *view __attribute__((unused)), GtkTreePath *path, gpointer data) {
+    GString *out = data;
     GtkTreeIter iter;
-    struct stat statbuf;
-    gboolean readme_found = FALSE;
-    char *readme_path = NULL;
 
-    if ((d = opendir(dir)) == NULL) {
-        fprintf(stderr, "Failed to open directory: %s\n", strerror(errno));
+    if (gtk_tree_model_get_iter(GTK_TREE_MODEL(workspace_tree_store), &iter, path)) {
+        gchar *rel;
+        gtk_tree_model_get(GTK_TREE_MODEL(workspace_tree_store), &iter, WORKSPACE_TREE_COL_REL, &rel, -1);
+        g_string_append_printf(out, "%s\n", rel);
+        g_free(rel);
+    }
+}
+
+// One expanded directory per line, relative to the workspace root.
+static void workspace_tree_save_state(void) {
+    if (workspace_tree_view == NULL) {
         return;
     }
 
-    gtk_list_store_clear(store);
+    GString *out = g_string_new(NULL);
+    gtk_tree_view_map_expanded_rows(GTK_TREE_VIEW(workspace_tree_view), workspace_tree_save_row, out);
+    // Directories whose parents never finished loading stay expanded for next time.
+    GHashTableIter it;
+    gpointer key;
+    g_hash_table_iter_init(&it, workspace_tree_restore);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        g_string_append_printf(out, "%s\n", (const char *)key);
+    }
 
-    while ((entry = readdir(d)) != NULL) {
-        char *full_path = g_strdup_printf("%s/%s", dir, entry->d_name);
-        if (stat(full_path, &statbuf) == -1) {
-            g_free(full_path);
-            continue;
+    gchar *dir = g_path_get_dirname(workspace_tree_state_path);
+    g_mkdir_with_parents(dir, 0700);
+    GError *error = NULL;
+    if (!g_file_set_contents(workspace_tree_state_path, out->str, out->len, &error)) {
+        g_printerr("Failed to save %s: %s\n", workspace_tree_state_path, error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+    g_string_free(out, TRUE);
+}
+
+static void workspace_tree_load_state(void) {
+    gchar *contents;
+    if (!g_file_get_contents(workspace_tree_state_path, &contents, NULL, NULL)) {
+        return;
+    }
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for (gchar **line = lines; *line; line++) {
+        if (**line) {
+            g_hash_table_add(workspace_tree_restore, g_strdup(*line));
         }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+}
 
-        gchar *display_name;
-        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && strcmp(entry->d_name, "codeWS") != 0) {
-            if (S_ISDIR(statbuf.st_mode)) {
-                display_name = g_markup_printf_escaped("<span foreground='blue'>%s</span>", entry->d_name);
-            } else if (statbuf.st_mode & S_IXUSR) {
-                display_name = g_markup_printf_escaped("<span foreground='red'>%s</span>", entry->d_name);
-            } else {
-                display_name = g_strdup(entry->d_name);
-            }
+static GtkWidget *create_workspace_tree(void) {
+    workspace_tree_store = gtk_tree_store_new(WORKSPACE_TREE_N_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_INT64);
+    workspace_tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(workspace_tree_store));
+    workspace_tree_rows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)gtk_tree_row_reference_free);
+    workspace_tree_restore = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    workspace_tree_reloads = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    workspace_tree_pool = g_thread_pool_new(workspace_tree_worker, NULL, 2, FALSE, NULL);
+    workspace_tree_state_path = g_build_filename(g_get_user_cache_dir(), "codews", "tree-expanded", NULL);
+    workspace_tree_load_state();
+
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_title(column, "Workspace");
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(column, renderer, render_workspace_tree_name, NULL, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 260);
+    gtk_tree_view_column_set_resizable(column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(workspace_tree_view), column);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(workspace_tree_view), TRUE);
+
+    g_signal_connect(workspace_tree_view, "row-expanded", G_CALLBACK(on_workspace_tree_expanded), NULL);
+    g_signal_connect(workspace_tree_view, "row-collapsed", G_CALLBACK(on_workspace_tree_collapsed), NULL);
+    g_signal_connect(workspace_tree_view, "row-activated", G_CALLBACK(on_workspace_tree_activated), NULL);
+    g_timeout_add_seconds(WORKSPACE_TREE_RELEASE_CHECK_S, workspace_tree_release_collapsed, NULL);
+
+    workspace_tree_root_state = WORKSPACE_TREE_LOADING;
+    workspace_tree_load("");
+    return workspace_tree_view;
+}
+
+static const char *dir_size_rel(const char *path) {
+    gsize length = strlen(base_dir);
+    if (strncmp(path, base_dir, length) != 0 || (path[length] != '/' && path[length] != '\0')) {
+        return NULL;
+    }
+    return path[length] == '/' ? path + length + 1 : path + length;
+}
+
+static gchar *dir_size_child_rel(const char *parent, const char *name) {
+    return parent[0] ? g_strconcat(parent, "/", name, NULL) : g_strdup(name);
+}
 
-            gtk_list_store_append(store, &iter);
-            gtk_list_store_set(store, &iter, 0, display_name, 1, entry->d_name, -1);
-            g_free(display_name);
+static gchar *dir_size_parent_rel(const char *rel) {
+    const char *slash = strrchr(rel, '/');
+    return slash ? g_strndup(rel, slash - rel) : g_strdup("");
+}
 
-            if (g_ascii_strcasecmp(entry->d_name, "readme.md") == 0) {
-                readme_found = TRUE;
-                readme_path = g_strdup_printf("%s/%s", dir, entry->d_name);
+// Whether rel is, or holds below it, a directory whose changes never reach
+// dir_size_note_change(): one the index skips, or any once a watch failed.
+static gboolean dir_size_unwatched(const char *rel) {
+    const char *slash = strrchr(rel, '/');
+    if ((rel[0] && index_skip_dir(slash ? slash + 1 : rel)) || (path_index && path_index->watch_failed)) {
+        return TRUE;
+    }
+    GHashTable *children = g_hash_table_lookup(dir_size_children, rel);
+    if (children) {
+        GHashTableIter it;
+        gpointer child;
+        g_hash_table_iter_init(&it, children);
+        while (g_hash_table_iter_next(&it, &child, NULL)) {
+            DirSize *size = g_hash_table_lookup(dir_sizes, child);
+            if (size && size->unwatched) {
+                return TRUE;
             }
         }
-        g_free(full_path);
     }
-    closedir(d);
+    return FALSE;
+}
+
+static DirSize *dir_size_lookup_child(const char *name) {
+    const char *parent = dir_size_rel(current_dir);
+    if (parent == NULL) {
+        return NULL;
+    }
+    gchar *rel = dir_size_child_rel(parent, name);
+    DirSize *size = g_hash_table_lookup(dir_sizes, rel);
+    g_free(rel);
+    return size;
+}
 
-    if (readme_found && readme_path) {
-        open_file_with_appropriate_application(readme_path);
-        g_free(readme_path);
+// Directory rows carry their subtree total as their size while sizes are on.
+// A directory's size is its total, or -1 while that isn't known, so sorting
+// by size puts such directories after everything with a size.
+static void dir_size_fill(const char *name, EntryRecord *rec) {
+    if (S_ISDIR(rec->mode)) {
+        DirSize *size = settings.listing_dir_sizes ? dir_size_lookup_child(name) : NULL;
+        rec->size = size ? (gint64)size->total : -1;
     }
 }
 
-static void navigate_up_directory() {
-    if (strcmp(current_dir, base_dir) == 0) {
+// Repaints the listing row for rel if it is a child of the listed directory.
+static void dir_size_show(const char *rel) {
+    const char *current = dir_size_rel(current_dir);
+    const char *slash = strrchr(rel, '/');
+    gsize parent_length = slash ? (gsize)(slash - rel) : 0;
+
+    if (scan_clear_pending || current == NULL || rel[0] == '\0' || strlen(current) != parent_length ||
+        strncmp(current, rel, parent_length) != 0) {
         return;
     }
+    const char *name = slash ? slash + 1 : rel;
+    const EntryRecord *found = dir_model_lookup(dir_model, name);
+    if (found && S_ISDIR(found->mode)) {
+        EntryRecord rec = *found;
+        dir_size_fill(name, &rec);
+        dir_model_upsert(dir_model, name, NULL, &rec);
+    }
+}
+
+// Records a directory's new total. With propagate, the difference is carried
+// up to every cached ancestor, which is how a change deep in the tree reaches
+// the top without walking anything else.
+static void dir_size_set(const char *rel, const struct stat *st, guint64 own, guint64 total, gboolean propagate) {
+    DirSize *size = g_hash_table_lookup(dir_sizes, rel);
+    gint64 delta = (gint64)total - (gint64)(size ? size->total : 0);
+
+    if (size == NULL) {
+        size = g_new0(DirSize, 1);
+        g_hash_table_insert(dir_sizes, g_strdup(rel), size);
+        if (rel[0]) {
+            gchar *parent = dir_size_parent_rel(rel);
+            GHashTable *siblings = g_hash_table_lookup(dir_size_children, parent);
+            if (siblings == NULL) {
+                siblings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+                g_hash_table_insert(dir_size_children, g_strdup(parent), siblings);
+            }
+            g_hash_table_add(siblings, g_strdup(rel));
+            g_free(parent);
+        }
+    }
+    size->dev = st->st_dev;
+    size->ino = st->st_ino;
+    size->mtime = st->st_mtim;
+    size->own = own;
+    size->total = total;
+    size->unwatched = dir_size_unwatched(rel);
+    dir_size_show(rel);
 
-    char *last_slash = strrchr(current_dir, '/');
-    if (last_slash != NULL) {
-        *last_slash = '\0';
-        if (strcmp(current_dir, base_dir) >= 0) {
-            display_directory(current_dir);
-        } else {
-            strcpy(current_dir, base_dir);
-            display_directory(current_dir);
+    if (propagate && (delta != 0 || size->unwatched)) {
+        gchar *ancestor = g_strdup(rel);
+        while (*ancestor) {
+            char *slash = strrchr(ancestor, '/');
+            *(slash ? slash : ancestor) = '\0';
+            DirSize *up = g_hash_table_lookup(dir_sizes, ancestor);
+            if (up) {
+                up->total += delta;
+                up->unwatched |= size->unwatched;
+                dir_size_show(ancestor);
+            }
         }
+        g_free(ancestor);
     }
 }
 
-static char *strip_html_markup(const char *input) {
-    if (input == NULL) return NULL;
+// Drops rel and everything cached below it, and the hard links they count.
+static void dir_size_forget(const char *rel) {
+    gpointer key, children;
+    if (g_hash_table_lookup_extended(dir_size_children, rel, &key, &children)) {
+        g_hash_table_steal(dir_size_children, rel);
+        GHashTableIter it;
+        gpointer child;
+        g_hash_table_iter_init(&it, children);
+        while (g_hash_table_iter_next(&it, &child, NULL)) {
+            dir_size_forget(child);
+        }
+        g_hash_table_destroy(children);
+        g_free(key);
+    }
+    if (!g_hash_table_remove(dir_sizes, rel)) {
+        return;
+    }
 
-    GError *error = NULL;
-    GRegex *regex = g_regex_new("<[^>]*>", 0, 0, &error);
-    if (error != NULL) {
-        g_print("Regex error: %s\n", error->message);
-        g_error_free(error);
-        return NULL;
+    gchar *path = rel[0] ? g_build_filename(base_dir, rel, NULL) : g_strdup(base_dir);
+    du_links_release(dir_size_links, path);
+    g_free(path);
+    if (rel[0]) {
+        gchar *parent = dir_size_parent_rel(rel);
+        GHashTable *siblings = g_hash_table_lookup(dir_size_children, parent);
+        if (siblings && g_hash_table_remove(siblings, rel) && g_hash_table_size(siblings) == 0) {
+            g_hash_table_remove(dir_size_children, parent);
+        }
+        g_free(parent);
     }
+}
 
-    gchar *stripped = g_regex_replace_literal(regex, input, -1, 0, "", 0, NULL);
-    g_regex_unref(regex);
+static gboolean dir_size_walk_covers(const char *rel) {
+    gchar *ancestor = g_strdup(rel);
+    gboolean covered = g_hash_table_contains(dir_size_walking, ancestor);
+    while (!covered && *ancestor) {
+        char *slash = strrchr(ancestor, '/');
+        *(slash ? slash : ancestor) = '\0';
+        covered = g_hash_table_contains(dir_size_walking, ancestor);
+    }
+    g_free(ancestor);
+    return covered;
+}
 
-    return stripped;
+static void dir_size_result_free(gpointer data) {
+    DirSizeResult *result = data;
+    g_free(result->rel);
+    g_free(result);
 }
 
-gboolean is_executable(const char *path) {
-    struct stat st;
-    if (stat(path, &st) == 0) {
-        return st.st_mode & S_IXUSR;
+static gboolean dir_size_apply_results(gpointer data __attribute__((unused))) {
+    TRACE_START(trace_start);
+    g_mutex_lock(&dir_size_results_lock);
+    GPtrArray *results = dir_size_results;
+    dir_size_results = g_ptr_array_new_with_free_func(dir_size_result_free);
+    dir_size_results_id = 0;
+    g_mutex_unlock(&dir_size_results_lock);
+
+    for (guint i = 0; i < results->len; i++) {
+        const DirSizeResult *result = g_ptr_array_index(results, i);
+        // Inside a walk every parent arrives after its children and already
+        // counts them; only a root's total is news to the directories above.
+        dir_size_set(result->rel, &result->st, result->own, result->total, result->root);
+        if (result->root) {
+            g_hash_table_remove(dir_size_walking, result->rel);
+        }
     }
-    return FALSE;
+    dir_model_sort_pending(dir_model);
+    TRACE_ENDF(trace_start, "model", "apply dir sizes", "%u directories", results->len);
+    g_ptr_array_unref(results);
+    return G_SOURCE_REMOVE;
 }
 
-static gboolean on_key_press(GtkWidget *widget __attribute__((unused)), GdkEventKey *event, gpointer userdata __attribute__((unused))) {
-    if (event->keyval == GDK_KEY_BackSpace && !vte_terminal_get_has_selection(VTE_TERMINAL(terminal))) {
-        navigate_up_directory();
-        return TRUE;
+static void on_dir_size_done(DuJob *job __attribute__((unused)), const char *path, const struct stat *st,
+                             guint64 own, guint64 total, gboolean root) {
+    const char *rel = dir_size_rel(path);
+    if (rel == NULL) {
+        return;
     }
-    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_n) {
-        show_new_directory_dialog();
-        return TRUE;
+    DirSizeResult *result = g_new(DirSizeResult, 1);
+    result->rel = g_strdup(rel);
+    result->st = *st;
+    result->own = own;
+    result->total = total;
+    result->root = root;
+
+    g_mutex_lock(&dir_size_results_lock);
+    g_ptr_array_add(dir_size_results, result);
+    if (dir_size_results_id == 0) {
+        dir_size_results_id = g_idle_add(dir_size_apply_results, NULL);
     }
-    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_d) {
-        show_deletion_dialog();
-        return TRUE;
+    g_mutex_unlock(&dir_size_results_lock);
+}
+
+static void dir_size_scan_free(DirSizeScan *scan) {
+    g_free(scan->rel);
+    g_ptr_array_unref(scan->subdirs);
+    g_free(scan);
+}
+
+// A rescan lists one directory. Its files give the new own size, and its
+// subdirectories are taken from the cache where their (dev, inode, mtime)
+// still match; anything new or changed is walked and added once it resolves.
+// Changes below an unwatched directory never arrive, so on a revisit those
+// are walked again, and cached subtrees holding one are rescanned in turn.
+static gboolean dir_size_rescan_done(gpointer data) {
+    DirSizeScan *scan = data;
+    if (scan->error) {
+        dir_size_forget(scan->rel);
+        dir_size_scan_free(scan);
+        return G_SOURCE_REMOVE;
     }
-    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_r) {
-        GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
-        GtkTreeModel *model;
-        GtkTreeIter iter;
-        gchar *filename;
 
-        if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-            gtk_tree_model_get(model, &iter, 0, &filename, -1);
-            char *clean_filename = strip_html_markup(filename);
-            char *path = g_strdup_printf("%s/%s", current_dir, clean_filename);
-            const char *language = get_language_from_path(path);
-            char *clean_path = strip_html_markup(path);
+    DirSize *previous = g_hash_table_lookup(dir_sizes, scan->rel);
+    gboolean entries_changed = previous == NULL || previous->mtime.tv_sec != scan->st.st_mtim.tv_sec ||
+                               previous->mtime.tv_nsec != scan->st.st_mtim.tv_nsec;
+    GHashTable *present = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    guint64 total = scan->own;
+    DuJob *job = NULL;
 
-            if (clean_path) {
-                g_print("Cleaned path: %s\n", clean_path);  // Debug print
-                compile_and_run(clean_path, language);
-                g_free(clean_path);
-            } else {
-                g_print("Failed to clean path: %s\n", path);  // Debug print
-            }
+    for (guint i = 0; i < scan->subdirs->len; i++) {
+        const DuSubdir *subdir = g_ptr_array_index(scan->subdirs, i);
+        gchar *child = dir_size_child_rel(scan->rel, subdir->name);
+        DirSize *size = g_hash_table_lookup(dir_sizes, child);
 
-            g_free(clean_filename);
-            g_free(filename);
+        gboolean stale = scan->revisit && size && size->unwatched &&
+                         (index_skip_dir(subdir->name) || (path_index && path_index->watch_failed));
+
+        if (size && !stale && size->dev == subdir->st.st_dev && size->ino == subdir->st.st_ino &&
+            size->mtime.tv_sec == subdir->st.st_mtim.tv_sec && size->mtime.tv_nsec == subdir->st.st_mtim.tv_nsec) {
+            total += size->total;
+            if (scan->revisit && size->unwatched) {
+                dir_size_rescan(child, TRUE);
+            }
+        } else if (!dir_size_walk_covers(child)) {
+            dir_size_forget(child);
+            if (job == NULL) {
+                job = du_job_new(dir_size_pool, dir_size_links, on_dir_size_done, du_job_free, NULL);
+            }
+            gchar *path = g_build_filename(base_dir, child, NULL);
+            du_job_add_path(job, path);
             g_free(path);
+            g_hash_table_add(dir_size_walking, g_strdup(child));
         }
-        return TRUE;
+        g_hash_table_add(present, child);
     }
-    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_e) {
-        GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
-        GtkTreeModel *model;
-        GtkTreeIter iter;
-        gchar *filename;
 
-        if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-            gtk_tree_model_get(model, &iter, 0, &filename, -1);
-            char *clean_filename = strip_html_markup(filename);
-            char *path = g_strdup_printf("%s/%s", current_dir, clean_filename);
-            make_file_executable(path);
-            display_directory(current_dir);
-            g_free(clean_filename);
-            g_free(filename);
-            g_free(path);
+    // Subdirectories only come and go when the directory's mtime moves.
+    GHashTable *children = g_hash_table_lookup(dir_size_children, scan->rel);
+    if (entries_changed && children) {
+        GPtrArray *gone = g_ptr_array_new_with_free_func(g_free);
+        GHashTableIter it;
+        gpointer key;
+        g_hash_table_iter_init(&it, children);
+        while (g_hash_table_iter_next(&it, &key, NULL)) {
+            if (!g_hash_table_contains(present, key)) {
+                g_ptr_array_add(gone, g_strdup(key));
+            }
         }
-        return TRUE;
+        for (guint i = 0; i < gone->len; i++) {
+            dir_size_forget(g_ptr_array_index(gone, i));
+        }
+        g_ptr_array_free(gone, TRUE);
     }
-    if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_f) {
-        show_new_file_dialog();
-        return TRUE;
+
+    dir_size_set(scan->rel, &scan->st, scan->own, total, TRUE);
+    dir_model_sort_pending(dir_model);
+    if (job && g_atomic_int_dec_and_test(&job->roots_pending)) {
+        du_job_free(job);
     }
-    return FALSE;
+    g_hash_table_destroy(present);
+    dir_size_scan_free(scan);
+    return G_SOURCE_REMOVE;
 }
 
-static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer userdata __attribute__((unused))) {
-    if (event->type == GDK_BUTTON_PRESS && event->button == 3) {
-        GtkTreePath *path;
-        GtkTreeView *tree_view = GTK_TREE_VIEW(widget);
-
-        if (gtk_tree_view_get_path_at_pos(tree_view, (gint)event->x, (gint)event->y, &path, NULL, NULL, NULL)) {
-            GtkTreeModel *model = gtk_tree_view_get_model(tree_view);
-            GtkTreeIter iter;
-            if (gtk_tree_model_get_iter(model, &iter, path)) {
-                gchar *file_name;
-                gtk_tree_model_get(model, &iter, 1, &file_name, -1);
-                
-                // Construct the full path
-                gchar *file_path = g_strdup_printf("%s/%s", current_dir, file_name);
+static void dir_size_rescan_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    DirSizeScan *scan = data;
+    gchar *path = scan->rel[0] ? g_build_filename(base_dir, scan->rel, NULL) : g_strdup(base_dir);
 
-                struct stat path_stat;
-                if (stat(file_path, &path_stat) == 0 && !S_ISDIR(path_stat.st_mode)) {  // Check if not a directory
-                    GtkWidget *menu = gtk_menu_new();
+    scan->error = du_scan_dir(path, dir_size_links, &scan->st, &scan->own, scan->subdirs);
+    g_free(path);
+    g_idle_add(dir_size_rescan_done, scan);
+}
 
-                    // Create and add "Make File Executable" item
-                    GtkWidget *make_exec_item = gtk_menu_item_new_with_label("Make File Executable");
-                    g_signal_connect(make_exec_item, "activate", G_CALLBACK(make_file_executable_menu), g_strdup(file_path));
-                    gtk_menu_shell_append(GTK_MENU_SHELL(menu), make_exec_item);
+static void dir_size_rescan(const char *rel, gboolean revisit) {
+    if (rel == NULL || !settings.listing_dir_sizes) {
+        return;
+    }
+    DirSizeScan *scan = g_new0(DirSizeScan, 1);
+    scan->rel = g_strdup(rel);
+    scan->revisit = revisit;
+    scan->subdirs = g_ptr_array_new_with_free_func(du_subdir_free);
+    g_thread_pool_push(dir_size_scan_pool, scan, NULL);
+}
 
-                    // Create and add "Make File Not Executable" item
-                    GtkWidget *make_not_exec_item = gtk_menu_item_new_with_label("Make File Not Executable");
-                    g_signal_connect(make_not_exec_item, "activate", G_CALLBACK(make_file_not_executable_menu), g_strdup(file_path));
-                    gtk_menu_shell_append(GTK_MENU_SHELL(menu), make_not_exec_item);
+static gboolean dir_size_flush_rescans(gpointer data __attribute__((unused))) {
+    GHashTableIter it;
+    gpointer key;
 
-                    // Create and add "Run" item if the file is executable
-                    if (is_executable(file_path)) {
-                        GtkWidget *run_item = gtk_menu_item_new_with_label("Run");
-                        g_signal_connect(run_item, "activate", G_CALLBACK(run_executable), g_strdup(file_path));
-                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), run_item);
-                    }
+    g_hash_table_iter_init(&it, dir_size_rescans);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        dir_size_rescan(key, FALSE);
+    }
+    g_hash_table_remove_all(dir_size_rescans);
+    dir_size_rescan_id = 0;
+    return G_SOURCE_REMOVE;
+}
 
-                    gtk_widget_show_all(menu);
-                    gtk_menu_popup_at_pointer(GTK_MENU(menu), (GdkEvent *)event);
-                } else {
-                    g_print("Right-clicked on a directory or invalid path: %s\n", file_path);
-                }
+// Fed from the file index's watches. Only directories already measured are
+// rescanned, each one on its own; the totals above follow by delta.
+static void dir_size_note_change(const char *dir) {
+    if (!settings.listing_dir_sizes || !g_hash_table_contains(dir_sizes, dir)) {
+        return;
+    }
+    g_hash_table_add(dir_size_rescans, g_strdup(dir));
+    if (dir_size_rescan_id == 0) {
+        dir_size_rescan_id = g_timeout_add(DIR_SIZE_RESCAN_MS, dir_size_flush_rescans, NULL);
+    }
+}
 
-                g_free(file_path);
-                g_free(file_name);
-            }
-            gtk_tree_path_free(path);
+static void dir_size_refresh_rows(void) {
+    for (guint32 record = 0; record < dir_model->records->len; record++) {
+        EntryRecord rec = *dir_model_record(dir_model, record);
+        if (rec.name_offset == DIR_MODEL_FREE_RECORD || !S_ISDIR(rec.mode)) {
+            continue;
         }
-        return TRUE;
+        const char *name = dir_model_record_name(dir_model, record);
+        dir_size_fill(name, &rec);
+        dir_model_upsert(dir_model, name, NULL, &rec);
     }
-    return FALSE;
+    dir_model_sort_pending(dir_model);
 }
 
-void run_executable(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
-    const char *file_path = (const char *)user_data;
-    gchar *clean_path = g_strdup(file_path); // Duplicate the file path
-    gchar *command = g_strdup_printf("clear && '%s'", clean_path); // Use single quotes to handle spaces in paths
-    gchar *argv[] = {"bash", "-c", command, NULL};
-
-    g_print("Running executable: %s\n", clean_path); // Debug print
-    g_print("Command: %s\n", command); // Print the command for debugging
-
-    vte_terminal_spawn_async(
-        VTE_TERMINAL(terminal),
-        VTE_PTY_DEFAULT,
-        current_dir,  // Set the working directory
-        argv,
-        NULL,
-        G_SPAWN_DEFAULT,
-        NULL, NULL, NULL, -1,
-        NULL, NULL, NULL);
+static void on_listing_sizes_toggled(GtkToggleButton *button, gpointer data __attribute__((unused))) {
+    gboolean watching_writes = settings.speculative_builds || settings.listing_dir_sizes;
 
-    g_free(command);
-    g_free(clean_path);
-    g_free((char *)file_path);  // Free the strdup-ed file path
+    settings.listing_dir_sizes = gtk_toggle_button_get_active(button);
+    gtk_tree_view_column_set_visible(size_column, settings.listing_dir_sizes);
+    dir_size_refresh_rows();
+    if (settings.listing_dir_sizes) {
+        // File writes only reach the index watches once IN_CLOSE_WRITE is in
+        // their mask, which takes a fresh walk.
+        if (!watching_writes && index_pool) {
+            index_start_walk(NULL, FALSE);
+        }
+        dir_size_rescan(dir_size_rel(current_dir), TRUE);
+    }
 }
 
-void make_file_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
-    const char *file_path = (const char *)user_data;
-    make_file_executable(file_path);
-    display_directory(current_dir);  // Update the directory view immediately
-    g_free((char *)file_path);  // Free the strdup-ed file path
+static void dir_size_init(void) {
+    dir_sizes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    dir_size_children = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+    dir_size_walking = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    dir_size_rescans = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    dir_size_links = du_links_new();
+    dir_size_results = g_ptr_array_new_with_free_func(dir_size_result_free);
+    dir_size_pool = g_thread_pool_new(du_worker, NULL, g_get_num_processors(), FALSE, NULL);
+    dir_size_scan_pool = g_thread_pool_new(dir_size_rescan_worker, NULL, 1, FALSE, NULL);
 }
 
-void make_file_not_executable_menu(GtkMenuItem *menu_item __attribute__((unused)), gpointer user_data) {
-    const char *file_path = (const char *)user_data;
-    make_file_not_executable(file_path);
-    display_directory(current_dir);  // Update the directory view immediately
-    g_free((char *)file_path);  // Free the strdup-ed file path
-}
+static GitRepo *git_repo_new(const char *root) {
+    GitRepo *repo = g_new0(GitRepo, 1);
+    repo->root = g_strdup(root);
+    repo->paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    repo->dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    repo->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(git_repos, repo->root, repo);
 
-static void on_row_activated(GtkTreeView *treeview, GtkTreePath *path, GtkTreeViewColumn *col __attribute__((unused)), gpointer userdata __attribute__((unused))) {
-    GtkTreeModel *model = gtk_tree_view_get_model(treeview);
-    GtkTreeIter iter;
-    gchar *actual_name;
+    // Commits, checkouts and staging only show up as writes inside .git,
+    // which the index never watches. A .git file (worktrees, submodules)
+    // gets no watch; such repositories refresh when they are revisited.
+    gchar *git_dir = g_build_filename(root, ".git", NULL);
+    int wd = git_inotify_fd >= 0 && g_file_test(git_dir, G_FILE_TEST_IS_DIR)
+                 ? inotify_add_watch(git_inotify_fd, git_dir, IN_CLOSE_WRITE | IN_MOVED_TO)
+                 : -1;
+    if (wd >= 0) {
+        g_hash_table_insert(git_repo_watches, GINT_TO_POINTER(wd), repo);
+    }
+    g_free(git_dir);
+    return repo;
+}
 
-    if (gtk_tree_model_get_iter(model, &iter, path)) {
-        gtk_tree_model_get(model, &iter, 1, &actual_name, -1);
+// The innermost work tree holding dir. Answers are cached per directory, so
+// the index's events cost a hash lookup once each directory has been seen.
+static GitRepo *git_repo_for_dir(const char *dir) {
+    gpointer repo;
+    if (g_hash_table_lookup_extended(git_repo_dirs, dir, NULL, &repo)) {
+        return repo;
+    }
 
-        char *new_path = g_strdup_printf("%s/%s", current_dir, actual_name);
-        struct stat path_stat;
-        if (stat(new_path, &path_stat) == 0) {
-            if (S_ISDIR(path_stat.st_mode)) {
-                g_free(current_dir);
-                current_dir = new_path;
-                display_directory(current_dir);
-            } else {
-                open_file_with_appropriate_application(new_path);
-                g_free(new_path);
-            }
-        } else {
-            g_printerr("Failed to access %s: %s\n", new_path, strerror(errno));
-            g_free(new_path);
+    gchar *marker = g_build_filename(dir, ".git", NULL);
+    repo = NULL;
+    if (g_file_test(marker, G_FILE_TEST_EXISTS)) {
+        repo = g_hash_table_lookup(git_repos, dir);
+        if (repo == NULL) {
+            repo = git_repo_new(dir);
         }
-        g_free(actual_name);
+    } else if (strcmp(dir, "/") != 0) {
+        gchar *parent = g_path_get_dirname(dir);
+        repo = git_repo_for_dir(parent);
+        g_free(parent);
     }
+    g_free(marker);
+    g_hash_table_insert(git_repo_dirs, g_strdup(dir), repo);
+    return repo;
 }
 
-static GtkWidget* create_tree_view() {
-    tree_view = gtk_tree_view_new();
-    store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_STRING);
-    gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(store));
+static const char *git_repo_rel(GitRepo *repo, const char *path) {
+    gsize length = strlen(repo->root);
+    return path[length] == '/' ? path + length + 1 : path + length;
+}
 
-    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
-    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes("Entries", renderer, "markup", 0, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+static void git_status_job_free(GitStatusJob *job) {
+    if (job->pathspecs) {
+        g_ptr_array_unref(job->pathspecs);
+    }
+    g_free(job->output);
+    g_free(job);
+}
 
-    g_signal_connect(tree_view, "row-activated", G_CALLBACK(on_row_activated), NULL);
-    g_signal_connect(tree_view, "key-press-event", G_CALLBACK(on_key_press), NULL);
-    g_signal_connect(tree_view, "button-press-event", G_CALLBACK(on_button_press), NULL);
+static gboolean git_status_install(gpointer data);
 
-    return tree_view;
+// Optional locks are off so that our status never rewrites the index, which
+// would both race the user's own git commands and wake the .git watch again.
+static void git_status_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    GitStatusJob *job = data;
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    const char *base_argv[] = {"git", "-c", "core.quotePath=false", "status", "--porcelain=v1",
+                               "--ignored", "--untracked-files=normal", "--no-renames", NULL};
+    for (int i = 0; base_argv[i]; i++) {
+        g_ptr_array_add(argv, g_strdup(base_argv[i]));
+    }
+    if (job->pathspecs) {
+        g_ptr_array_add(argv, g_strdup("--"));
+        for (guint i = 0; i < job->pathspecs->len; i++) {
+            g_ptr_array_add(argv, g_strconcat(":(literal)", (char *)g_ptr_array_index(job->pathspecs, i), NULL));
+        }
+    }
+    g_ptr_array_add(argv, NULL);
+    gchar **envp = g_environ_setenv(g_get_environ(), "GIT_OPTIONAL_LOCKS", "0", TRUE);
+    gint status;
+    TRACE_START(trace_start);
+
+    job->ok = g_spawn_sync(job->repo->root, (gchar **)argv->pdata, envp,
+                           G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &job->output, NULL,
+                           &status, NULL) &&
+              g_spawn_check_exit_status(status, NULL);
+    TRACE_ENDF(trace_start, "spawn", "git status", "%s, %u paths", job->repo->root,
+               job->pathspecs ? job->pathspecs->len : 0);
+    g_strfreev(envp);
+    g_ptr_array_unref(argv);
+    g_idle_add(git_status_install, job);
 }
 
-static void on_window_destroy(GtkWidget *widget __attribute__((unused)), gpointer data __attribute__((unused))) {
-    close(inotify_fd);
-    g_free(base_dir);
-    g_free(current_dir);
-    gtk_main_quit();
+// Starts whatever the repository has queued, unless git is already running
+// there; git_status_install() calls back once it is done.
+static void git_repo_refresh(GitRepo *repo) {
+    if (repo->running || repo->failed) {
+        return;
+    }
+    GitStatusJob *job = g_new0(GitStatusJob, 1);
+    job->repo = repo;
+
+    if (!repo->loaded || repo->full_pending || g_hash_table_size(repo->changed) > GIT_STATUS_MAX_PATHSPECS) {
+        repo->full_pending = FALSE;
+    } else if (g_hash_table_size(repo->changed) > 0) {
+        job->pathspecs = g_ptr_array_new_with_free_func(g_free);
+        GHashTableIter it;
+        gpointer key;
+        g_hash_table_iter_init(&it, repo->changed);
+        while (g_hash_table_iter_next(&it, &key, NULL)) {
+            g_hash_table_iter_steal(&it);
+            g_ptr_array_add(job->pathspecs, key);
+        }
+    } else {
+        g_free(job);
+        return;
+    }
+    g_hash_table_remove_all(repo->changed);
+    repo->running = TRUE;
+    g_thread_pool_push(git_status_pool, job, NULL);
 }
 
-/*
-static int get_directory_depth(const char *dir) {
-    const char *base = base_dir;
-    const char *tmp = dir;
+// Drops what is known about path and everything below it, so a recheck
+// that reports nothing leaves the path clean.
+static void git_repo_forget(GitRepo *repo, const char *path) {
+    gsize length = strlen(path);
+    GHashTableIter it;
+    gpointer key;
 
-    while (*base != '\0' && *tmp == *base) {
-        base++;
-        tmp++;
+    g_hash_table_iter_init(&it, repo->paths);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        const char *known = key;
+        if (strncmp(known, path, length) == 0 && (known[length] == '\0' || known[length] == '/')) {
+            g_hash_table_iter_remove(&it);
+        }
     }
+}
 
-    int depth = 0;
-    while (*tmp != '\0') {
-        if (*tmp == '/') {
-            depth++;
+static void git_repo_parse(GitRepo *repo, const gchar *output) {
+    gchar **lines = g_strsplit(output, "\n", -1);
+    for (gchar **line = lines; *line; line++) {
+        if (strlen(*line) < 4) {
+            continue;
         }
-        tmp++;
+        GitStatus status = strncmp(*line, "!!", 2) == 0   ? GIT_STATUS_IGNORED
+                           : strncmp(*line, "??", 2) == 0 ? GIT_STATUS_UNTRACKED
+                                                          : GIT_STATUS_MODIFIED;
+        char *path = *line + 3;
+        gchar *unquoted = NULL;
+        gsize length = strlen(path);
+        if (path[0] == '"' && length > 1 && path[length - 1] == '"') {
+            path[length - 1] = '\0';
+            path = unquoted = g_strcompress(path + 1);
+        }
+        gpointer previous = g_hash_table_lookup(repo->paths, path);
+        if (GPOINTER_TO_INT(previous) < (gint)status) {
+            g_hash_table_insert(repo->paths, g_strdup(path), GINT_TO_POINTER(status));
+        }
+        g_free(unquoted);
     }
-
-    return depth;
+    g_strfreev(lines);
 }
-*/
-
-static char *extract_first_directory(const char *path) {
-    if (!path) return NULL;
-    path += strlen(base_dir);
-    if (*path == '/') path++;
 
-    const char *end = strchr(path, '/');
-    if (!end) end = path + strlen(path);
+// Every modified or untracked path marks the directories above it.
+static void git_repo_rebuild_dirs(GitRepo *repo) {
+    GHashTableIter it;
+    gpointer key, value;
 
-    size_t len = end - path;
-    char *dir = malloc(len + 1);
-    if (dir) {
-        strncpy(dir, path, len);
-        dir[len] = '\0';
+    g_hash_table_remove_all(repo->dirs);
+    g_hash_table_iter_init(&it, repo->paths);
+    while (g_hash_table_iter_next(&it, &key, &value)) {
+        if (GPOINTER_TO_INT(value) < GIT_STATUS_UNTRACKED) {
+            continue;
+        }
+        gchar *dir = g_strdup(key);
+        gsize length = strlen(dir);
+        if (length && dir[length - 1] == '/') {
+            dir[length - 1] = '\0';
+        }
+        for (char *slash = strrchr(dir, '/'); slash; slash = strrchr(dir, '/')) {
+            *slash = '\0';
+            if (GPOINTER_TO_INT(g_hash_table_lookup(repo->dirs, dir)) < GPOINTER_TO_INT(value)) {
+                g_hash_table_insert(repo->dirs, g_strdup(dir), value);
+            }
+        }
+        g_free(dir);
     }
-    return dir;
 }
 
-static const char *get_language_from_path(const char *path) {
-    if (!path) {
-        printf("Error: Path is NULL\n");
-        return NULL;
+// An untracked or ignored directory is reported once, collapsed; whatever is
+// listed below it inherits that state.
+static void git_status_repaint(void) {
+    listing_git_inherited = GIT_STATUS_CLEAN;
+    if (listing_git_repo == NULL) {
+        return;
     }
-
-    char *language_dir = extract_first_directory(path);
-    if (!language_dir) {
-        printf("No language directory found or error in path processing.\n");
-        return NULL;
+    for (char *slash = strchr(listing_git_prefix, '/'); slash; slash = strchr(slash + 1, '/')) {
+        gchar *dir = g_strndup(listing_git_prefix, slash - listing_git_prefix + 1);
+        GitStatus status = GPOINTER_TO_INT(g_hash_table_lookup(listing_git_repo->paths, dir));
+        if (status == GIT_STATUS_UNTRACKED || status == GIT_STATUS_IGNORED) {
+            listing_git_inherited = status;
+        }
+        g_free(dir);
     }
-
-    const char *language = NULL;
-    if (strcmp(language_dir, "C") == 0) {
-        language = "C";
-    } else if (strcmp(language_dir, "Python3") == 0) {
-        language = "Python3";
-    } else if (strcmp(language_dir, "Asm") == 0) {
-        language = "Assembly";
+    if (tree_view) {
+        gtk_widget_queue_draw(tree_view);
     }
+}
 
-    if (language) {
-        printf("Detected language: %s\n", language);
+static gboolean git_status_install(gpointer data) {
+    GitStatusJob *job = data;
+    GitRepo *repo = job->repo;
+    TRACE_START(trace_start);
+
+    repo->running = FALSE;
+    if (!job->ok) {
+        // A recheck can lose a race with the user's own git; a failed full
+        // run means there is no usable git here at all.
+        repo->failed = job->pathspecs == NULL;
     } else {
-        printf("No recognized language found in the directory name.\n");
+        if (job->pathspecs == NULL) {
+            g_hash_table_remove_all(repo->paths);
+            repo->loaded = TRUE;
+        } else {
+            for (guint i = 0; i < job->pathspecs->len; i++) {
+                git_repo_forget(repo, g_ptr_array_index(job->pathspecs, i));
+            }
+        }
+        git_repo_parse(repo, job->output);
+        git_repo_rebuild_dirs(repo);
+        if (repo == listing_git_repo) {
+            git_status_repaint();
+        }
     }
+    TRACE_ENDF(trace_start, "model", "install git status", "%u paths", g_hash_table_size(repo->paths));
+    git_status_job_free(job);
+    git_repo_refresh(repo);
+    return G_SOURCE_REMOVE;
+}
 
-    free(language_dir);
-    return language;
+static gboolean git_status_flush(gpointer data __attribute__((unused))) {
+    GHashTableIter it;
+    gpointer repo;
+
+    git_status_refresh_id = 0;
+    g_hash_table_iter_init(&it, git_repos);
+    while (g_hash_table_iter_next(&it, NULL, &repo)) {
+        git_repo_refresh(repo);
+    }
+    return G_SOURCE_REMOVE;
 }
 
-static void compile_and_run(const char *path, const char *language) {
-    if (path == NULL) {
-        g_print("Error: Path is NULL\n");
-        return;
+static void git_status_schedule(void) {
+    if (git_status_refresh_id == 0) {
+        git_status_refresh_id = g_timeout_add(GIT_STATUS_REFRESH_MS, git_status_flush, NULL);
     }
+}
 
-    char *clean_path = strip_html_markup(path);
-    if (clean_path == NULL) {
-        g_print("Failed to clean path from HTML markup.\n");
+// Fed from the file index's watches with the directory relative to base_dir.
+// Only repositories already loaded (or loading) care; the rest load in full
+// when they are first listed.
+static void git_status_note_change(const char *dir, const char *name) {
+    if (!settings.listing_git_status) {
+        return;
+    }
+    if (strcmp(name, ".git") == 0) {
+        // A repository appeared or went away under a cached answer.
+        g_hash_table_remove_all(git_repo_dirs);
         return;
     }
+    gchar *abs_dir = dir[0] ? g_build_filename(base_dir, dir, NULL) : g_strdup(base_dir);
+    GitRepo *repo = git_repo_for_dir(abs_dir);
 
-    gchar *compile_cmd = NULL;
-    gchar *cmd = g_strdup_printf("Are you sure you want to compile and run this %s program?", language);
-    if (show_confirmation_dialog(cmd)) {
-        gchar *dir_path = g_path_get_dirname(clean_path);
-        if (dir_path == NULL) {
-            g_print("Error: Unable to determine directory from path: %s\n", clean_path);
-            g_free(cmd);
-            g_free(clean_path);
-            return;
+    if (repo && (repo->loaded || repo->running)) {
+        if (strcmp(name, ".gitignore") == 0) {
+            repo->full_pending = TRUE;
+        } else {
+            const char *rel = git_repo_rel(repo, abs_dir);
+            g_hash_table_add(repo->changed, rel[0] ? g_strconcat(rel, "/", name, NULL) : g_strdup(name));
         }
+        git_status_schedule();
+    }
+    g_free(abs_dir);
+}
 
-        if (strcasecmp(language, "C") == 0) {
-            compile_cmd = g_strdup_printf("clear && cd '%s' && make clean && make", dir_path);
-        } else if (strcasecmp(language, "Python3") == 0) {
-            compile_cmd = g_strdup_printf("clear && cd %s && python3 %s\n", dir_path, clean_path);
-        } else if (strcasecmp(language, "Assembly") == 0) {
-            compile_cmd = g_strdup_printf("clear && cd %s && nasm -f elf64 %s -o %s.o && ld %s.o -o %s && ./%s\n", dir_path, clean_path, clean_path, clean_path, clean_path, clean_path);
-        }
+static gboolean on_git_inotify_event(GIOChannel *source __attribute__((unused)), GIOCondition condition __attribute__((unused)), gpointer data __attribute__((unused))) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
 
-        g_free(dir_path);
+    while ((len = read(git_inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
 
-        if (compile_cmd) {
-            g_print("Compile command: %s\n", compile_cmd);
-            vte_terminal_spawn_async(
-                VTE_TERMINAL(terminal),
-                VTE_PTY_DEFAULT,
-                NULL,
-                (char *[]){ "bash", "-c", compile_cmd, NULL },
-                NULL,
-                G_SPAWN_DEFAULT,
-                NULL, NULL, NULL, -1,
-                NULL, NULL, NULL);
-            g_free(compile_cmd);
-        } else {
-            g_print("Unsupported language: %s\n", language);
+            GitRepo *repo = g_hash_table_lookup(git_repo_watches, GINT_TO_POINTER(event->wd));
+            if (repo && repo->loaded && event->len > 0 &&
+                (strcmp(event->name, "index") == 0 || strcmp(event->name, "HEAD") == 0)) {
+                repo->full_pending = TRUE;
+                git_status_schedule();
+            }
         }
     }
-    g_free(cmd);
-    g_free(clean_path);
+    return G_SOURCE_CONTINUE;
 }
 
-static void make_file_executable(const char *path) {
-    if (path == NULL) return;
-    gchar *command = g_strdup_printf("chmod +x \"%s\"", path);
-    gchar *argv[] = {"bash", "-c", command, NULL};
-    VteTerminal *vte_terminal = VTE_TERMINAL(terminal);
-
-    vte_terminal_spawn_async(
-        vte_terminal,
-        VTE_PTY_DEFAULT,
-        current_dir,
-        argv,
-        NULL,
-        G_SPAWN_DEFAULT,
-        NULL, NULL, NULL, -1,
-        NULL, NULL, NULL);
+static void git_status_show(const char *dir) {
+    listing_git_repo = settings.listing_git_status ? git_repo_for_dir(dir) : NULL;
+    g_clear_pointer(&listing_git_prefix, g_free);
+    if (listing_git_repo) {
+        const char *rel = git_repo_rel(listing_git_repo, dir);
+        listing_git_prefix = rel[0] ? g_strconcat(rel, "/", NULL) : g_strdup("");
+        git_repo_refresh(listing_git_repo);
+    }
+    git_status_repaint();
+}
 
-    g_free(command);
+static GitStatus git_status_lookup(const char *name, gboolean is_dir) {
+    if (listing_git_repo == NULL || listing_git_inherited != GIT_STATUS_CLEAN) {
+        return listing_git_inherited;
+    }
+    gchar *rel = g_strconcat(listing_git_prefix, name, is_dir ? "/" : NULL, NULL);
+    gint status = GPOINTER_TO_INT(g_hash_table_lookup(listing_git_repo->paths, rel));
+    if (is_dir) {
+        rel[strlen(rel) - 1] = '\0';
+        status = MAX(status, GPOINTER_TO_INT(g_hash_table_lookup(listing_git_repo->paths, rel)));
+        status = MAX(status, GPOINTER_TO_INT(g_hash_table_lookup(listing_git_repo->dirs, rel)));
+    }
+    g_free(rel);
+    return (GitStatus)status;
 }
 
-static void make_file_not_executable(const char *path) {
-    if (path == NULL) return;
-    gchar *command = g_strdup_printf("chmod -x \"%s\"", path);
-    gchar *argv[] = {"bash", "-c", command, NULL};
-    VteTerminal *vte_terminal = VTE_TERMINAL(terminal);
+static void git_status_init(void) {
+    git_repos = g_hash_table_new(g_str_hash, g_str_equal);
+    git_repo_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    git_repo_watches = g_hash_table_new(g_direct_hash, g_direct_equal);
+    git_status_pool = g_thread_pool_new(git_status_worker, NULL, 2, FALSE, NULL);
 
-    vte_terminal_spawn_async(
-        vte_terminal,
-        VTE_PTY_DEFAULT,
-        current_dir,
-        argv,
-        NULL,
-        G_SPAWN_DEFAULT,
-        NULL, NULL, NULL, -1,
-        NULL, NULL, NULL);
+    git_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (git_inotify_fd >= 0) {
+        GIOChannel *channel = g_io_channel_unix_new(git_inotify_fd);
+        g_io_add_watch(channel, G_IO_IN, on_git_inotify_event, NULL);
+        g_io_channel_unref(channel);
+    }
+}
 
-    g_free(command);
+static void session_append(GString *strings, const char *str) {
+    g_string_append_len(strings, str, strlen(str) + 1);
 }
 
-static void create_new_file(const char *file_name) {
-    if (file_name == NULL) return;
+// Only a finished listing is worth painting next time. It keeps the
+// timestamps of its scan, so a directory that changed afterwards, even
+// through the live updates, fails the check at startup and gets rescanned.
+static void session_save(void) {
+    SessionHeader header = {0};
+    GString *records = g_string_new(NULL);
+    GString *names = g_string_new(NULL);
+    GString *strings = g_string_new(NULL);
+    memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
 
-    gchar *full_path = g_strdup_printf("%s/%s", current_dir, file_name);
-    FILE *file = fopen(full_path, "w");
-    if (file) {
-        fclose(file);
+    if (scan_listing_done && scan_dir_stat_valid) {
+        header.dev = scan_dir_stat.st_dev;
+        header.ino = scan_dir_stat.st_ino;
+        header.mtime_sec = scan_dir_stat.st_mtim.tv_sec;
+        header.mtime_nsec = scan_dir_stat.st_mtim.tv_nsec;
+        header.ctime_sec = scan_dir_stat.st_ctim.tv_sec;
+        header.ctime_nsec = scan_dir_stat.st_ctim.tv_nsec;
+        for (guint32 record = 0; record < dir_model->records->len; record++) {
+            EntryRecord rec = *dir_model_record(dir_model, record);
+            if (rec.name_offset == DIR_MODEL_FREE_RECORD) {
+                continue;
+            }
+            const char *name = dir_model_record_name(dir_model, record);
+            rec.name_offset = names->len;
+            g_string_append_len(names, name, entry_arena_length(name));
+            g_string_append_len(records, (const char *)&rec, sizeof(rec));
+            header.record_count++;
+        }
+    }
+
+    session_append(strings, current_dir);
+    GtkTreePath *top;
+    GtkTreeIter iter;
+    if (gtk_tree_view_get_visible_range(GTK_TREE_VIEW(tree_view), &top, NULL)) {
+        session_append(strings, gtk_tree_model_get_iter(GTK_TREE_MODEL(dir_model), &iter, top)
+                                    ? dir_model_iter_name(dir_model, &iter)
+                                    : "");
+        gtk_tree_path_free(top);
     } else {
-        g_print("Error creating file: %s\n", strerror(errno));
+        session_append(strings, "");
     }
-    g_free(full_path);
-}
 
-static void show_new_file_dialog() {
-    GtkWidget *dialog, *content_area, *entry;
-    dialog = gtk_dialog_new_with_buttons("New File", GTK_WINDOW(window),
-                                         GTK_DIALOG_MODAL,
-                                         "_OK", GTK_RESPONSE_OK,
-                                         "_Cancel", GTK_RESPONSE_CANCEL,
-                                         NULL);
-    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    entry = gtk_entry_new();
-    gtk_container_add(GTK_CONTAINER(content_area), entry);
-    gtk_widget_show_all(dialog);
+    GPtrArray *selected = get_selected_names();
+    for (guint i = 0; i < selected->len; i++) {
+        session_append(strings, g_ptr_array_index(selected, i));
+    }
+    header.selected_count = selected->len;
+    g_ptr_array_unref(selected);
 
-    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
-    if (response == GTK_RESPONSE_OK) {
-        const char *file_name = gtk_entry_get_text(GTK_ENTRY(entry));
-        create_new_file(file_name);
-        display_directory(current_dir);
+    gint n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(terminal_notebook));
+    for (gint i = 0; i < n_pages; i++) {
+        GtkWidget *page = gtk_notebook_get_nth_page(GTK_NOTEBOOK(terminal_notebook), i);
+        TerminalTab *tab = g_object_get_data(G_OBJECT(page), "codews-tab");
+        if (tab == NULL || tab->kind == NULL) {
+            continue;
+        }
+        gchar *link = g_strdup_printf("/proc/%d/cwd", (int)tab->shell_pid);
+        gchar *cwd = tab->shell_pid > 0 ? g_file_read_link(link, NULL) : NULL;
+        session_append(strings, tab->kind);
+        session_append(strings, gtk_label_get_text(GTK_LABEL(tab->label)));
+        session_append(strings, cwd ? cwd : "");
+        header.tab_count++;
+        g_free(cwd);
+        g_free(link);
     }
-    gtk_widget_destroy(dialog);
-}
+    header.names_length = names->len;
+    header.strings_length = strings->len;
 
-static void show_new_directory_dialog() {
-    GtkWidget *dialog, *content_area, *entry;
-    dialog = gtk_dialog_new_with_buttons("New Directory", GTK_WINDOW(window),
-                                         GTK_DIALOG_MODAL,
-                                         "_OK", GTK_RESPONSE_OK,
-                                         "_Cancel", GTK_RESPONSE_CANCEL,
-                                         NULL);
-    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    entry = gtk_entry_new();
-    gtk_container_add(GTK_CONTAINER(content_area), entry);
-    gtk_widget_show_all(dialog);
+    GString *data = g_string_sized_new(sizeof(header) + records->len + names->len + strings->len);
+    g_string_append_len(data, (const char *)&header, sizeof(header));
+    g_string_append_len(data, records->str, records->len);
+    g_string_append_len(data, names->str, names->len);
+    g_string_append_len(data, strings->str, strings->len);
 
-    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
-    if (response == GTK_RESPONSE_OK) {
-        const char *dir_name = gtk_entry_get_text(GTK_ENTRY(entry));
-        create_new_directory(dir_name);
-        display_directory(current_dir);
+    gchar *dir = g_path_get_dirname(session_path);
+    GError *error = NULL;
+    g_mkdir_with_parents(dir, 0700);
+    if (!g_file_set_contents(session_path, data->str, data->len, &error)) {
+        g_printerr("Failed to write session state: %s\n", error->message);
+        g_error_free(error);
     }
-    gtk_widget_destroy(dialog);
+    g_free(dir);
+    g_string_free(data, TRUE);
+    g_string_free(strings, TRUE);
+    g_string_free(names, TRUE);
+    g_string_free(records, TRUE);
 }
 
-static void create_new_directory(const char *dir_name) {
-    if (dir_name == NULL) return;
+static const char *session_next(const char *str) {
+    return str + strlen(str) + 1;
+}
 
-    gchar *full_path = g_strdup_printf("%s/%s", current_dir, dir_name);
-    if (mkdir(full_path, 0755) == -1) {
-        g_print("Error creating directory: %s\n", strerror(errno));
-    } else {
-        display_directory(current_dir);
+// Maps the last session's state. Anything that doesn't add up, or a
+// directory outside base_dir, discards the whole file. The map stays until
+// session_paint() has copied what it needs.
+static gboolean session_open(void) {
+    int fd = open(session_path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (fstat(fd, &statbuf) != 0 || (gsize)statbuf.st_size < sizeof(SessionHeader)) {
+        close(fd);
+        return FALSE;
+    }
+    const char *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return FALSE;
     }
-    g_free(full_path);
-}
 
-/*
-static int get_directory_depth(const char *dir) {
-    const char *base = base_dir;
-    const char *tmp = dir;
+    const SessionHeader *header = (const SessionHeader *)map;
+    gsize length = statbuf.st_size;
+    gsize records_length = (gsize)header->record_count * sizeof(EntryRecord);
+    gboolean valid = memcmp(header->magic, SESSION_MAGIC, sizeof(header->magic)) == 0 &&
+                     sizeof(*header) + records_length + header->names_length + header->strings_length == length &&
+                     header->strings_length > 0 && map[length - 1] == '\0' &&
+                     (header->names_length == 0 || map[sizeof(*header) + records_length + header->names_length - 1] == '\0');
 
-    while (*base != '\0' && *tmp == *base) {
-        base++;
-        tmp++;
-    }
+    session.header = header;
+    session.length = length;
+    session.records = (const EntryRecord *)(map + sizeof(*header));
+    session.names = map + sizeof(*header) + records_length;
+    session.dir = session.names + header->names_length;
 
-    int depth = 0;
-    while (*tmp != '\0') {
-        if (*tmp == '/') {
-            depth++;
-        }
-        tmp++;
+    // Every record needs its name and collation key inside the arena.
+    for (guint32 i = 0; valid && i < header->record_count; i++) {
+        guint32 offset = session.records[i].name_offset;
+        valid = offset < header->names_length &&
+                offset + strlen(session.names + offset) + 1 < header->names_length;
+    }
+    guint strings = 0;
+    for (const char *p = session.dir; valid && p < map + length; p++) {
+        strings += *p == '\0';
+    }
+    gsize base_length = strlen(base_dir);
+    valid = valid && strings >= 2 + header->selected_count + 3 * header->tab_count &&
+            strncmp(session.dir, base_dir, base_length) == 0 &&
+            (session.dir[base_length] == '\0' || session.dir[base_length] == '/');
+    if (!valid) {
+        munmap((void *)map, length);
+        session.header = NULL;
+        return FALSE;
     }
 
-    return depth;
+    session.top = session_next(session.dir);
+    session.selected = session_next(session.top);
+    session.tabs = session.selected;
+    for (guint32 i = 0; i < header->selected_count; i++) {
+        session.tabs = session_next(session.tabs);
+    }
+    return TRUE;
 }
-*/
 
-static gboolean recursive_delete(const char *path) {
-    DIR *d = opendir(path);
-    if (d == NULL) {
-        g_printerr("Failed to open directory for deletion: %s\n", strerror(errno));
-        return FALSE;
+// Reopens the last session's tabs as fresh shells in the directories they
+// were left in. Whatever they were running is not started again.
+static void session_restore_tabs(void) {
+    const char *p = session.tabs;
+    for (guint32 i = 0; i < session.header->tab_count; i++) {
+        const char *kind = p;
+        const char *title = session_next(kind);
+        const char *cwd = session_next(title);
+        p = session_next(cwd);
+        open_terminal_tab(kind, title, cwd[0] && g_file_test(cwd, G_FILE_TEST_IS_DIR) ? cwd : NULL);
     }
+    gtk_notebook_set_current_page(GTK_NOTEBOOK(terminal_notebook), 0);
+}
 
-    struct dirent *entry;
-    gboolean result = TRUE;
-
-    while ((entry = readdir(d)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, "codeWS") == 0) {
-            continue;
-        }
+static gboolean session_reconciled(gpointer data) {
+    SessionCheck *check = data;
 
-        char *full_path = g_strdup_printf("%s/%s", path, entry->d_name);
-        if (entry->d_type == DT_DIR) {
-            if (!recursive_delete(full_path)) {
-                result = FALSE;
-                g_free(full_path);
-                break;
-            }
+    // Navigating away in the meantime already replaced the snapshot.
+    if (check->generation == scan_generation) {
+        gboolean current = check->ok && check->header.dev != 0 && check->header.dev == (guint64)check->st.st_dev &&
+                           check->header.ino == (guint64)check->st.st_ino &&
+                           check->header.mtime_sec == check->st.st_mtim.tv_sec &&
+                           check->header.mtime_nsec == check->st.st_mtim.tv_nsec &&
+                           check->header.ctime_sec == check->st.st_ctim.tv_sec &&
+                           check->header.ctime_nsec == check->st.st_ctim.tv_nsec;
+        if (current) {
+            scan_dir_stat = check->st;
+            scan_dir_stat_valid = TRUE;
+            listing_cache_store(current_dir, &scan_dir_stat);
         } else {
-            if (remove(full_path) != 0) {
-                g_printerr("Failed to delete file: %s\n", strerror(errno));
-                result = FALSE;
-                g_free(full_path);
-                break;
+            if (!check->ok) {
+                g_free(current_dir);
+                current_dir = g_strdup(base_dir);
             }
+            display_directory(current_dir);
         }
-        g_free(full_path);
     }
+    TRACE_END(check->trace_started, "startup", "reconcile session", current_dir);
+    g_free(check->dir);
+    g_free(check);
+    return G_SOURCE_REMOVE;
+}
 
-    closedir(d);
+static gpointer session_check_thread(gpointer data) {
+    SessionCheck *check = data;
+    check->ok = stat(check->dir, &check->st) == 0;
+    g_idle_add(session_reconciled, check);
+    return NULL;
+}
 
-    if (result) {
-        if (rmdir(path) != 0) {
-            g_printerr("Failed to delete directory: %s\n", strerror(errno));
-            result = FALSE;
-        }
+// Runs once the snapshot is on screen. The watch goes in before the stat, so
+// a change is either caught by the stat or reported by the watch.
+static gboolean session_reconcile(gpointer data) {
+    SessionCheck *check = data;
+    if (check->generation != scan_generation) {
+        g_free(check->dir);
+        g_free(check);
+        return G_SOURCE_REMOVE;
     }
-
-    return result;
+    watch_directory(current_dir);
+    git_status_show(current_dir);
+    g_thread_unref(g_thread_new("session-check", session_check_thread, check));
+    return G_SOURCE_REMOVE;
 }
 
-static void show_deletion_dialog() {
-    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window),
-                                               GTK_DIALOG_MODAL,
-                                               GTK_MESSAGE_WARNING,
-                                               GTK_BUTTONS_OK_CANCEL,
-                                               "Are you sure you want to delete the selected item?");
-    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
+// Paints the last session's listing, selection and scroll position straight
+// from the mapped file without touching the directory, then unmaps it.
+static void session_paint(void) {
+    TRACE_START(trace_start);
+    scan_generation++;
+    scan_clear_pending = TRUE;
+    scan_listing_done = FALSE;
+    scan_dir_stat_valid = FALSE;
 
-    if (response == GTK_RESPONSE_OK) {
-        delete_selected_item();
-    }
-}
+    EntryBatch batch = {
+        .generation = scan_generation,
+        .records = g_array_sized_new(FALSE, FALSE, sizeof(EntryRecord), session.header->record_count),
+        .names = g_string_new_len(session.names, session.header->names_length),
+        .done = TRUE,
+        .from_cache = TRUE,
+    };
+    g_array_append_vals(batch.records, session.records, session.header->record_count);
+    show_entry_batch(&batch);
+    g_array_free(batch.records, TRUE);
+    g_string_free(batch.names, TRUE);
 
-static void delete_selected_item() {
-    GtkTreeModel *model;
     GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
-    GtkTreeIter iter;
-    gchar *actual_name;
+    const char *name = session.selected;
+    for (guint32 i = 0; i < session.header->selected_count; i++, name = session_next(name)) {
+        gint row = dir_model_lookup_row(dir_model, name);
+        if (row >= 0) {
+            GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+            gtk_tree_selection_select_path(selection, path);
+            gtk_tree_path_free(path);
+        }
+    }
+    gint top = session.top[0] ? dir_model_lookup_row(dir_model, session.top) : -1;
+    if (top >= 0) {
+        GtkTreePath *path = gtk_tree_path_new_from_indices(top, -1);
+        gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(tree_view), path, NULL, TRUE, 0.0, 0.0);
+        gtk_tree_path_free(path);
+    }
 
-    if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-        gtk_tree_model_get(model, &iter, 1, &actual_name, -1);
-        char *full_path = g_strdup_printf("%s/%s", current_dir, actual_name);
+    SessionCheck *check = g_new0(SessionCheck, 1);
+    check->generation = scan_generation;
+    check->dir = g_strdup(current_dir);
+    check->header = *session.header;
+    check->trace_started = trace_start;
+    TRACE_ENDF(trace_start, "startup", "paint session", "%u entries", session.header->record_count);
 
-        if (g_file_test(full_path, G_FILE_TEST_IS_DIR)) {
-            if (!recursive_delete(full_path)) {
-                g_printerr("Failed to delete directory: %s\n", strerror(errno));
-            }
+    munmap((void *)session.header, session.length);
+    session.header = NULL;
+    g_idle_add(session_reconcile, check);
+}
+
+// Takes --trace[=FILE] out of argv before GTK sees it. CODEWS_TRACE=FILE
+// does the same; without a file name the trace goes to
+// codews-trace-PID.json in the current directory.
+static void start_tracing(int *argc, char *argv[]) {
+    const char *target = g_getenv("CODEWS_TRACE");
+    int kept = 1;
+    for (int i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            target = "";
+        } else if (g_str_has_prefix(argv[i], "--trace=")) {
+            target = argv[i] + strlen("--trace=");
         } else {
-            if (remove(full_path) != 0) {
-                g_printerr("Failed to delete file: %s\n", strerror(errno));
-            }
+            argv[kept++] = argv[i];
         }
+    }
+    *argc = kept;
+    argv[kept] = NULL;
 
-        g_free(full_path);
-        g_free(actual_name);
-        display_directory(current_dir);
+    if (target) {
+        gchar *path = target[0] && strcmp(target, "1") != 0 ? g_strdup(target)
+                                                             : g_strdup_printf("codews-trace-%d.json", (int)getpid());
+        if (trace_open(path)) {
+            trace_startup_start = g_get_monotonic_time();
+        }
+        g_free(path);
+    }
+}
+
+// `codews --daemon` serves the workspace a window would open, with the same
+// settings.
+static int daemon_run(void) {
+    load_settings();
+    char *home_dir = getenv("HOME");
+    if (home_dir == NULL) {
+        fprintf(stderr, "Environment variable HOME is not set.\n");
+        return EXIT_FAILURE;
     }
+
+    gchar *root = g_strdup_printf("%s/codeWS", home_dir);
+    gchar *cache_path = g_build_filename(g_get_user_cache_dir(), "codews", "index.bin", NULL);
+    gchar *exe = g_file_read_link("/proc/self/exe", NULL);
+    DaemonOptions options = {
+        .root = root,
+        .ignore_dirs = settings.ignore_dirs,
+        .index_cache_path = cache_path,
+        .self_exe = exe,
+        .listing_cache_bytes = (gsize)settings.listing_cache_mb * 1024 * 1024,
+    };
+    int status = daemon_main(&options);
+
+    g_free(exe);
+    g_free(cache_path);
+    g_free(root);
+    return status;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--cache-store") == 0) {
+        return build_cache_store_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--job") == 0) {
+        return job_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+        return daemon_run();
+    }
+    if (argc > 1 && strcmp(argv[1], "--query") == 0) {
+        return daemon_query_main(argc, argv);
+    }
+
+    start_tracing(&argc, argv);
+    TRACE_START(trace_start);
     gtk_init(&argc, &argv);
+    TRACE_END(trace_start, "startup", "gtk_init", NULL);
+
+    TRACE_START(settings_start);
+    load_settings();
+    self_exe_path = g_file_read_link("/proc/self/exe", NULL);
+
+    file_umask = umask(0);
+    umask(file_umask);
+
+    if (settings.editor_server) {
+        gchar *runtime_dir = g_build_filename(g_get_user_runtime_dir(), "codews", NULL);
+        g_mkdir_with_parents(runtime_dir, 0700);
+        editor_socket_path = g_strdup_printf("%s/nvim-%d.sock", runtime_dir, (int)getpid());
+        if (strlen(editor_socket_path) >= sizeof(((struct sockaddr_un *)NULL)->sun_path)) {
+            g_printerr("Editor socket path too long, opening files without the editor server\n");
+            g_clear_pointer(&editor_socket_path, g_free);
+        }
+        g_free(runtime_dir);
+    }
+    if (!daemon_client_init()) {
+        job_history_init();
+    }
+    TRACE_END(settings_start, "startup", "settings", NULL);
 
     char *home_dir = getenv("HOME");
     if (home_dir == NULL) {
@@ -750,16 +7353,54 @@ int main(int argc, char *argv[]) {
     }
 
     base_dir = g_strdup_printf("%s/codeWS", home_dir);
-    current_dir = strdup(base_dir);
+    session_path = g_build_filename(g_get_user_cache_dir(), "codews", "session.bin", NULL);
+    gboolean restoring = session_open();
+    current_dir = strdup(restoring ? session.dir : base_dir);
 
-    inotify_fd = inotify_init();
+    TRACE_START(services_start);
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     if (inotify_fd < 0) {
         perror("inotify_init");
         return EXIT_FAILURE;
     }
 
-    inotify_add_watch(inotify_fd, current_dir, IN_CREATE | IN_DELETE | IN_MODIFY);
+    GIOChannel *inotify_channel = g_io_channel_unix_new(inotify_fd);
+    g_io_add_watch(inotify_channel, G_IO_IN, on_inotify_event, NULL);
+    g_io_channel_unref(inotify_channel);
 
+    pending_changes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    speculative_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    speculative_builds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    listing_cache = g_hash_table_new_full(listing_cache_hash, listing_cache_equal, NULL, listing_cache_entry_free);
+    listing_cache_watches = g_hash_table_new(NULL, NULL);
+    listing_cache_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (listing_cache_inotify_fd >= 0) {
+        GIOChannel *cache_channel = g_io_channel_unix_new(listing_cache_inotify_fd);
+        g_io_add_watch(cache_channel, G_IO_IN, on_listing_cache_event, NULL);
+        g_io_channel_unref(cache_channel);
+    }
+
+    scan_pool = g_thread_pool_new(scan_worker, NULL, 2, FALSE, NULL);
+    delete_pool = g_thread_pool_new(delete_worker, NULL, g_get_num_processors(), FALSE, NULL);
+    build_all_pool = g_thread_pool_new(build_all_worker, NULL, g_get_num_processors(), FALSE, NULL);
+    build_plan_pool = g_thread_pool_new(build_plan_worker, NULL, 1, FALSE, NULL);
+    g_thread_pool_set_sort_function(delete_pool, delete_compare_depth, NULL);
+    dir_size_init();
+    git_status_init();
+
+    purge_queue = g_async_queue_new();
+    g_thread_unref(g_thread_new("trash-purge", purge_thread, NULL));
+    purge_leftover_trash();
+    g_timeout_add_seconds(TRASH_CHECK_INTERVAL_S, purge_expired_trash, NULL);
+
+    if (!daemon_running) {
+        index_init();
+    }
+    search_pool = g_thread_pool_new(search_worker, NULL, g_get_num_processors(), FALSE, NULL);
+    finder_pool = g_thread_pool_new(finder_worker, NULL, 1, FALSE, NULL);
+    TRACE_END(services_start, "startup", "watchers and pools", NULL);
+
+    TRACE_START(window_start);
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     g_signal_connect(window, "destroy", G_CALLBACK(on_window_destroy), NULL);
     gtk_window_set_title(GTK_WINDOW(window), "Code Workshop");
@@ -768,16 +7409,56 @@ int main(int argc, char *argv[]) {
     GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
     gtk_container_add(GTK_CONTAINER(window), hbox);
 
-    GtkWidget *view = create_tree_view();
-    gtk_box_pack_start(GTK_BOX(hbox), view, FALSE, FALSE, 5);
+    GtkWidget *left_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_box_pack_start(GTK_BOX(hbox), left_box, FALSE, FALSE, 5);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_size_request(scrolled, 280, -1);
+    gtk_container_add(GTK_CONTAINER(scrolled), create_tree_view());
+
+    GtkWidget *tree_scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(tree_scrolled), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_size_request(tree_scrolled, 280, 160);
+    gtk_container_add(GTK_CONTAINER(tree_scrolled), create_workspace_tree());
 
-    terminal = VTE_TERMINAL(vte_terminal_new());
-    gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(terminal), TRUE, TRUE, 5);
+    GtkWidget *left_paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+    gtk_paned_pack1(GTK_PANED(left_paned), tree_scrolled, TRUE, FALSE);
+    GtkWidget *listing_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_box_pack_start(GTK_BOX(listing_box), create_listing_controls(), FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(listing_box), scrolled, TRUE, TRUE, 0);
+    gtk_paned_pack2(GTK_PANED(left_paned), listing_box, TRUE, FALSE);
+    gtk_box_pack_start(GTK_BOX(left_box), left_paned, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(left_box), create_delete_progress_box(), FALSE, FALSE, 0);
 
-    display_directory(current_dir);
+    terminal_notebook = gtk_notebook_new();
+    gtk_notebook_set_scrollable(GTK_NOTEBOOK(terminal_notebook), TRUE);
+    gtk_box_pack_start(GTK_BOX(hbox), terminal_notebook, TRUE, TRUE, 5);
+    TRACE_END(window_start, "startup", "window", NULL);
+
+    terminal_shell = vte_get_user_shell();
+    if (terminal_shell == NULL) {
+        terminal_shell = g_strdup("/bin/sh");
+    }
+    if (restoring && session.header->tab_count > 0) {
+        session_restore_tabs();
+    } else {
+        run_in_tab("shell", "Shell", NULL, NULL);
+    }
+
+    TRACE_START(display_start);
+    if (restoring) {
+        session_paint();
+    } else {
+        display_directory(current_dir);
+    }
+    TRACE_END(display_start, "startup", "display_directory", current_dir);
 
+    TRACE_START(show_start);
     gtk_widget_show_all(window);
+    TRACE_END(show_start, "startup", "show window", NULL);
     gtk_main();
 
+    trace_close();
     return 0;
 }
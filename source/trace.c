@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdarg.h>
+
+gboolean trace_enabled;
+
+static FILE *trace_file;
+static GMutex trace_lock;
+
+static void trace_append_escaped(GString *out, const char *text) {
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *p);
+        } else if (*p < 0x20) {
+            g_string_append_printf(out, "\\u%04x", *p);
+        } else {
+            g_string_append_c(out, *p);
+        }
+    }
+}
+
+// Events are appended as they finish, one per line, so a trace cut short by
+// a crash only lacks the closing bracket, which the viewers tolerate.
+gboolean trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        g_printerr("Failed to open trace file %s: %s\n", path, strerror(errno));
+        return FALSE;
+    }
+    fprintf(trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"codews\"}}",
+            (int)getpid());
+    trace_enabled = TRUE;
+    g_print("Writing trace to %s\n", path);
+    return TRUE;
+}
+
+void trace_close(void) {
+    if (trace_file == NULL) {
+        return;
+    }
+    g_mutex_lock(&trace_lock);
+    trace_enabled = FALSE;
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+    g_mutex_unlock(&trace_lock);
+}
+
+// Records a complete ("X") event from start_us until now on the calling thread.
+void trace_span(const char *category, const char *name, gint64 start_us, const char *detail) {
+    gint64 end_us = g_get_monotonic_time();
+    GString *event = g_string_sized_new(160);
+
+    g_string_append(event, ",\n{\"name\":\"");
+    trace_append_escaped(event, name);
+    g_string_append(event, "\",\"cat\":\"");
+    trace_append_escaped(event, category);
+    g_string_append_printf(event, "\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT
+                           ",\"pid\":%d,\"tid\":%ld", start_us, end_us - start_us, (int)getpid(), syscall(SYS_gettid));
+    if (detail) {
+        g_string_append(event, ",\"args\":{\"detail\":\"");
+        trace_append_escaped(event, detail);
+        g_string_append(event, "\"}");
+    }
+    g_string_append_c(event, '}');
+
+    g_mutex_lock(&trace_lock);
+    if (trace_file) {
+        fwrite(event->str, 1, event->len, trace_file);
+    }
+    g_mutex_unlock(&trace_lock);
+    g_string_free(event, TRUE);
+}
+
+void trace_spanf(const char *category, const char *name, gint64 start_us, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    gchar *detail = g_strdup_vprintf(format, args);
+    va_end(args);
+    trace_span(category, name, start_us, detail);
+    g_free(detail);
+}
@@ -0,0 +1,34 @@
+#ifndef CODEWS_TRACE_H
+#define CODEWS_TRACE_H
+
+#include <glib.h>
+
+// Timestamped spans written as Chrome trace-event JSON, for chrome://tracing
+// or Perfetto. Tracing is switched on with --trace[=FILE] or CODEWS_TRACE;
+// while it is off a span costs one branch on trace_enabled.
+
+extern gboolean trace_enabled;
+
+gboolean trace_open(const char *path);
+void trace_close(void);
+void trace_span(const char *category, const char *name, gint64 start_us, const char *detail);
+void trace_spanf(const char *category, const char *name, gint64 start_us, const char *format, ...) G_GNUC_PRINTF(4, 5);
+
+#define TRACE_START(var) gint64 var = G_UNLIKELY(trace_enabled) ? g_get_monotonic_time() : 0
+
+// detail is only evaluated while tracing.
+#define TRACE_END(var, category, name, detail)                \
+    do {                                                      \
+        if (G_UNLIKELY(trace_enabled)) {                      \
+            trace_span(category, name, var, detail);          \
+        }                                                     \
+    } while (0)
+
+#define TRACE_ENDF(var, category, name, ...)                  \
+    do {                                                      \
+        if (G_UNLIKELY(trace_enabled)) {                      \
+            trace_spanf(category, name, var, __VA_ARGS__);    \
+        }                                                     \
+    } while (0)
+
+#endif
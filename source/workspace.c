@@ -0,0 +1,928 @@
+#define _GNU_SOURCE
+#include "workspace.h"
+#include "trace.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <fcntl.h>
+
+// Layout of the records returned by getdents64(2).
+struct linux_dirent64 {
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A directory being emptied. pending counts the directory's own scan plus
+// every subdirectory that hasn't been removed yet; whoever drops it to zero
+// removes the directory and reports to the parent.
+struct DeleteDir {
+    DeleteJob *job;
+    struct DeleteDir *parent;
+    int fd;
+    int parent_fd;  // only used for the job's root directories
+    gchar *name;
+    gchar *path;
+    guint depth;
+    gint pending;
+    gint failed;
+};
+
+// A directory being measured. pending counts its own scan plus every
+// subdirectory still being summed; whoever drops it to zero reports it and
+// adds its total to the parent.
+struct DuDir {
+    DuJob *job;
+    struct DuDir *parent;
+    gchar *path;
+    struct stat st;
+    guint64 own;
+    guint64 total;
+    gint pending;
+};
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} DuInode;
+
+typedef struct {
+    char magic[8];
+    guint32 root_length;
+    guint32 count;
+} IndexCacheHeader;
+
+gboolean is_hidden_entry(const char *name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, "codeWS") == 0 ||
+           strcmp(name, TRASH_DIR_NAME) == 0 || strcmp(name, BUILD_CACHE_DIR_NAME) == 0;
+}
+
+gboolean workspace_skip_dir(const char *name, gchar **ignore_dirs) {
+    return is_hidden_entry(name) || (ignore_dirs && g_strv_contains((const gchar *const *)ignore_dirs, name));
+}
+
+// Lists dir with getdents64(2), skipping hidden entries. Every entry is
+// stat'ed, directories included, since the listing sorts on their mtime.
+// Returns 0 or the errno from opening the directory.
+int list_directory(const char *dir, GCancellable *cancellable, EntryFunc func, gpointer user_data) {
+    TRACE_START(trace_start);
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return errno;
+    }
+
+    char *buf = g_malloc(SCAN_BUFFER_SIZE);
+    gboolean keep_going = TRUE;
+    long nread;
+
+    while (keep_going && !(cancellable && g_cancellable_is_cancelled(cancellable)) &&
+           (nread = syscall(SYS_getdents64, dir_fd, buf, SCAN_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; keep_going && pos < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            if (is_hidden_entry(d->d_name)) {
+                continue;
+            }
+
+            struct stat statbuf;
+            if (fstatat(dir_fd, d->d_name, &statbuf, 0) == -1) {
+                continue;
+            }
+            EntryRecord rec = {
+                .mode = statbuf.st_mode,
+                .size = statbuf.st_size,
+                .mtime = statbuf.st_mtime,
+                .type = d->d_type,
+            };
+            keep_going = func(d->d_name, &rec, user_data);
+        }
+    }
+
+    g_free(buf);
+    close(dir_fd);
+    TRACE_END(trace_start, "scan", "list_directory", dir);
+    return 0;
+}
+
+static char *extract_first_directory(const char *root, const char *path) {
+    if (!path) return NULL;
+    path += strlen(root);
+    if (*path == '/') path++;
+
+    const char *end = strchr(path, '/');
+    if (!end) end = path + strlen(path);
+
+    size_t len = end - path;
+    char *dir = malloc(len + 1);
+    if (dir) {
+        strncpy(dir, path, len);
+        dir[len] = '\0';
+    }
+    return dir;
+}
+
+// Projects live in one directory per language directly under the workspace
+// root; returns NULL outside of those.
+const char *language_for_path(const char *root, const char *path) {
+    char *language_dir = extract_first_directory(root, path);
+    if (!language_dir) {
+        return NULL;
+    }
+
+    const char *language = NULL;
+    if (strcmp(language_dir, "C") == 0) {
+        language = "C";
+    } else if (strcmp(language_dir, "Python3") == 0) {
+        language = "Python3";
+    } else if (strcmp(language_dir, "Asm") == 0) {
+        language = "Assembly";
+    }
+
+    free(language_dir);
+    return language;
+}
+
+// Case-insensitive literal search. memchr does the scanning for whichever
+// case of the first byte comes next, the rest is compared in place.
+const char *find_caseless(const char *start, const char *end, const char *needle, gsize len) {
+    char lower = g_ascii_tolower(needle[0]), upper = g_ascii_toupper(needle[0]);
+    while ((gsize)(end - start) >= len) {
+        const char *a = memchr(start, lower, end - start - len + 1);
+        const char *b = lower == upper ? NULL : memchr(start, upper, (a ? a : end - len + 1) - start);
+        const char *p = b ? b : a;
+        if (p == NULL) {
+            return NULL;
+        }
+        if (g_ascii_strncasecmp(p, needle, len) == 0) {
+            return p;
+        }
+        start = p + 1;
+    }
+    return NULL;
+}
+
+// Reads a non-empty regular file of at most max_size bytes into buffer,
+// which keeps a NUL past the contents. Searches use this rather than mmap: a
+// file truncated while it is read comes up short instead of raising SIGBUS.
+gboolean read_regular_file(const char *path, gsize max_size, GByteArray *buffer) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    gboolean ok = FALSE;
+
+    g_byte_array_set_size(buffer, 0);
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && statbuf.st_size > 0 &&
+        (gsize)statbuf.st_size <= max_size) {
+        g_byte_array_set_size(buffer, statbuf.st_size + 1);
+        gsize filled = 0;
+        while (filled < (gsize)statbuf.st_size) {
+            ssize_t n = read(fd, buffer->data + filled, statbuf.st_size - filled);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            filled += n;
+        }
+        buffer->data[filled] = '\0';
+        g_byte_array_set_size(buffer, filled);
+        ok = filled > 0;
+    }
+    close(fd);
+    return ok;
+}
+
+static void delete_record_error(DeleteJob *job, const char *path, const char *name, int err) {
+    gchar *message = name ? g_strdup_printf("%s/%s: %s", path, name, strerror(err))
+                          : g_strdup_printf("%s: %s", path, strerror(err));
+    g_mutex_lock(&job->errors_lock);
+    g_ptr_array_add(job->errors, message);
+    g_mutex_unlock(&job->errors_lock);
+}
+
+static DeleteDir *delete_dir_new(DeleteJob *job, DeleteDir *parent, const char *name, int fd) {
+    DeleteDir *dir = g_new0(DeleteDir, 1);
+    dir->job = job;
+    dir->parent = parent;
+    dir->fd = fd;
+    dir->parent_fd = -1;
+    dir->name = g_strdup(name);
+    dir->depth = parent ? parent->depth + 1 : 0;
+    dir->pending = 1;
+    g_atomic_int_inc(&job->open_dirs);
+    return dir;
+}
+
+// Called once for the directory's own scan and once per finished child.
+static void delete_dir_release(DeleteDir *dir) {
+    DeleteJob *job = dir->job;
+
+    while (dir && g_atomic_int_dec_and_test(&dir->pending)) {
+        DeleteDir *parent = dir->parent;
+        int dir_fd = parent ? parent->fd : dir->parent_fd;
+        const char *path = parent ? parent->path : NULL;
+
+        close(dir->fd);
+        g_atomic_int_add(&job->open_dirs, -1);
+
+        if (g_atomic_int_get(&dir->failed) || g_cancellable_is_cancelled(job->cancellable)) {
+            if (parent) {
+                g_atomic_int_set(&parent->failed, TRUE);
+            }
+        } else if (unlinkat(dir_fd, dir->name, AT_REMOVEDIR) == 0) {
+            __atomic_fetch_add(&job->entries, 1, __ATOMIC_RELAXED);
+        } else {
+            if (path) {
+                delete_record_error(job, path, dir->name, errno);
+            } else {
+                delete_record_error(job, dir->path, NULL, errno);
+            }
+            if (parent) {
+                g_atomic_int_set(&parent->failed, TRUE);
+            }
+        }
+
+        if (parent == NULL) {
+            close(dir->parent_fd);
+            if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+                job->done(job);
+            }
+        }
+
+        g_free(dir->name);
+        g_free(dir->path);
+        g_free(dir);
+        dir = parent;
+    }
+}
+
+// Unlinks everything inside dir. Subdirectories go to the pool while the fd
+// budget allows and are otherwise emptied depth-first on this thread.
+static void delete_dir_contents(DeleteDir *dir) {
+    DeleteJob *job = dir->job;
+    char *buf = g_malloc(SCAN_BUFFER_SIZE);
+    long nread;
+
+    while (!g_cancellable_is_cancelled(job->cancellable) &&
+           (nread = syscall(SYS_getdents64, dir->fd, buf, SCAN_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; pos < nread && !g_cancellable_is_cancelled(job->cancellable);) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            // Everything else goes, dotfiles and codews' own directories
+            // included, or the directory can't be removed.
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+
+            struct stat statbuf;
+            gboolean have_stat = FALSE;
+            if (d->d_type == DT_UNKNOWN || d->d_type == DT_REG) {
+                have_stat = fstatat(dir->fd, d->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+            }
+            gboolean is_dir = d->d_type == DT_DIR || (have_stat && S_ISDIR(statbuf.st_mode));
+
+            if (is_dir) {
+                int child_fd = openat(dir->fd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (child_fd < 0) {
+                    delete_record_error(job, dir->path, d->d_name, errno);
+                    g_atomic_int_set(&dir->failed, TRUE);
+                    continue;
+                }
+
+                DeleteDir *child = delete_dir_new(job, dir, d->d_name, child_fd);
+                child->path = g_strdup_printf("%s/%s", dir->path, d->d_name);
+                g_atomic_int_inc(&dir->pending);
+
+                if (!job->background && g_atomic_int_get(&job->open_dirs) < DELETE_MAX_OPEN_DIRS) {
+                    g_thread_pool_push(job->pool, child, NULL);
+                } else {
+                    delete_dir_contents(child);
+                }
+            } else if (unlinkat(dir->fd, d->d_name, 0) == 0) {
+                __atomic_fetch_add(&job->entries, 1, __ATOMIC_RELAXED);
+                if (have_stat) {
+                    __atomic_fetch_add(&job->bytes, (guint64)statbuf.st_size, __ATOMIC_RELAXED);
+                }
+            } else {
+                delete_record_error(job, dir->path, d->d_name, errno);
+                g_atomic_int_set(&dir->failed, TRUE);
+            }
+        }
+    }
+
+    if (nread < 0) {
+        delete_record_error(job, dir->path, NULL, errno);
+        g_atomic_int_set(&dir->failed, TRUE);
+    }
+
+    g_free(buf);
+    delete_dir_release(dir);
+}
+
+void delete_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    delete_dir_contents(data);
+}
+
+// Deeper directories first keeps the tree narrow and the number of open fds low.
+gint delete_compare_depth(gconstpointer a, gconstpointer b, gpointer user_data __attribute__((unused))) {
+    const DeleteDir *x = a, *y = b;
+    return (gint)y->depth - (gint)x->depth;
+}
+
+void delete_job_free(DeleteJob *job) {
+    g_object_unref(job->cancellable);
+    g_ptr_array_unref(job->errors);
+    g_mutex_clear(&job->errors_lock);
+    g_free(job);
+}
+
+DeleteJob *delete_job_new(GThreadPool *pool, gboolean background, DeleteDoneFunc done, gpointer user_data) {
+    DeleteJob *job = g_new0(DeleteJob, 1);
+    job->background = background;
+    job->pool = pool;
+    job->done = done;
+    job->user_data = user_data;
+    job->cancellable = g_cancellable_new();
+    job->errors = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_init(&job->errors_lock);
+    job->roots_pending = 1;  // held until every root has been added
+    return job;
+}
+
+// Unlinks path right away unless it is a directory, in which case it becomes a
+// root of the job: queued on the pool, or emptied here for background jobs.
+void delete_job_add_path(DeleteJob *job, const char *path) {
+    gchar *parent_path = g_path_get_dirname(path);
+    gchar *name = g_path_get_basename(path);
+    int parent_fd = open(parent_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int dir_fd = parent_fd < 0 ? -1 : openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    if (parent_fd < 0) {
+        delete_record_error(job, parent_path, name, errno);
+    } else if (dir_fd < 0) {
+        if (unlinkat(parent_fd, name, 0) == 0) {
+            __atomic_fetch_add(&job->entries, 1, __ATOMIC_RELAXED);
+        } else {
+            delete_record_error(job, parent_path, name, errno);
+        }
+        close(parent_fd);
+    } else {
+        DeleteDir *root = delete_dir_new(job, NULL, name, dir_fd);
+        root->parent_fd = parent_fd;
+        root->path = g_strdup(path);
+        g_atomic_int_inc(&job->roots_pending);
+        if (job->background) {
+            delete_dir_contents(root);
+        } else {
+            g_thread_pool_push(job->pool, root, NULL);
+        }
+    }
+
+    g_free(parent_path);
+    g_free(name);
+}
+
+static guint du_inode_hash(gconstpointer key) {
+    const DuInode *inode = key;
+    return (guint)(inode->ino ^ (inode->ino >> 32) ^ (inode->dev * 2654435761u));
+}
+
+static gboolean du_inode_equal(gconstpointer a, gconstpointer b) {
+    const DuInode *x = a, *y = b;
+    return x->dev == y->dev && x->ino == y->ino;
+}
+
+static void du_claims_free(gpointer data) {
+    g_array_unref(data);
+}
+
+DuLinks *du_links_new(void) {
+    DuLinks *links = g_new0(DuLinks, 1);
+    g_mutex_init(&links->lock);
+    links->owners = g_hash_table_new_full(du_inode_hash, du_inode_equal, g_free, NULL);
+    links->claims = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, du_claims_free);
+    return links;
+}
+
+void du_links_free(DuLinks *links) {
+    g_hash_table_destroy(links->owners);
+    g_hash_table_destroy(links->claims);
+    g_mutex_clear(&links->lock);
+    g_free(links);
+}
+
+// Forgets the links dir counts, so the table only holds directories that
+// are still measured. Every scan of dir starts here and claims them again.
+void du_links_release(DuLinks *links, const char *dir) {
+    g_mutex_lock(&links->lock);
+    GArray *claims = g_hash_table_lookup(links->claims, dir);
+    if (claims) {
+        for (guint i = 0; i < claims->len; i++) {
+            g_hash_table_remove(links->owners, &g_array_index(claims, DuInode, i));
+        }
+        g_hash_table_remove(links->claims, dir);
+    }
+    g_mutex_unlock(&links->lock);
+}
+
+// A link is counted once, by the first directory to claim it; a second
+// link in the same directory doesn't count again. Rescans release their
+// claims first, so they count what they still hold.
+static gboolean du_claim_link(DuLinks *links, const struct stat *st, const char *dir) {
+    DuInode key = { .dev = st->st_dev, .ino = st->st_ino };
+
+    g_mutex_lock(&links->lock);
+    const char *owner = g_hash_table_lookup(links->owners, &key);
+    gboolean counts = owner == NULL;
+    if (owner == NULL) {
+        gchar *stored_dir;
+        GArray *claims;
+        if (!g_hash_table_lookup_extended(links->claims, dir, (gpointer *)&stored_dir, (gpointer *)&claims)) {
+            stored_dir = g_strdup(dir);
+            claims = g_array_new(FALSE, FALSE, sizeof(DuInode));
+            g_hash_table_insert(links->claims, stored_dir, claims);
+        }
+        g_array_append_val(claims, key);
+        DuInode *stored = g_new(DuInode, 1);
+        *stored = key;
+        g_hash_table_insert(links->owners, stored, stored_dir);
+    }
+    g_mutex_unlock(&links->lock);
+    return counts;
+}
+
+void du_subdir_free(gpointer data) {
+    DuSubdir *subdir = data;
+    g_free(subdir->name);
+    g_free(subdir);
+}
+
+// Measures the entries directly inside dir: own gets the size of the
+// directory and its non-directory entries, and subdirectories on the same
+// filesystem are appended to subdirs for the caller. Returns 0 or an errno.
+int du_scan_dir(const char *dir, DuLinks *links, struct stat *dir_stat, guint64 *own, GPtrArray *subdirs) {
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return errno;
+    }
+    if (fstat(dir_fd, dir_stat) != 0) {
+        int err = errno;
+        close(dir_fd);
+        return err;
+    }
+    *own = (guint64)dir_stat->st_size;
+    du_links_release(links, dir);
+
+    char *buf = g_malloc(SCAN_BUFFER_SIZE);
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dir_fd, buf, SCAN_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; pos < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            struct stat st;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 ||
+                fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                if (st.st_dev == dir_stat->st_dev) {
+                    DuSubdir *subdir = g_new(DuSubdir, 1);
+                    subdir->name = g_strdup(d->d_name);
+                    subdir->st = st;
+                    g_ptr_array_add(subdirs, subdir);
+                }
+            } else if (st.st_nlink <= 1 || du_claim_link(links, &st, dir)) {
+                *own += (guint64)st.st_size;
+            }
+        }
+    }
+
+    g_free(buf);
+    close(dir_fd);
+    return 0;
+}
+
+static DuDir *du_dir_new(DuJob *job, DuDir *parent, gchar *path) {
+    DuDir *dir = g_new0(DuDir, 1);
+    dir->job = job;
+    dir->parent = parent;
+    dir->path = path;
+    dir->pending = 1;
+    return dir;
+}
+
+// Called once for the directory's own scan and once per finished child.
+static void du_dir_release(DuDir *dir) {
+    DuJob *job = dir->job;
+
+    while (dir && g_atomic_int_dec_and_test(&dir->pending)) {
+        DuDir *parent = dir->parent;
+        guint64 total = __atomic_load_n(&dir->total, __ATOMIC_RELAXED);
+
+        job->dir_done(job, dir->path, &dir->st, dir->own, total, parent == NULL);
+        if (parent) {
+            __atomic_fetch_add(&parent->total, total, __ATOMIC_RELAXED);
+        } else if (g_atomic_int_dec_and_test(&job->roots_pending)) {
+            job->done(job);
+        }
+
+        g_free(dir->path);
+        g_free(dir);
+        dir = parent;
+    }
+}
+
+void du_worker(gpointer data, gpointer user_data __attribute__((unused))) {
+    DuDir *dir = data;
+    DuJob *job = dir->job;
+    GPtrArray *subdirs = g_ptr_array_new_with_free_func(du_subdir_free);
+
+    if (du_scan_dir(dir->path, job->links, &dir->st, &dir->own, subdirs) == 0) {
+        __atomic_fetch_add(&dir->total, dir->own, __ATOMIC_RELAXED);
+        for (guint i = 0; i < subdirs->len; i++) {
+            const DuSubdir *subdir = g_ptr_array_index(subdirs, i);
+            DuDir *child = du_dir_new(job, dir, g_build_filename(dir->path, subdir->name, NULL));
+            g_atomic_int_inc(&dir->pending);
+            g_thread_pool_push(job->pool, child, NULL);
+        }
+    }
+
+    g_ptr_array_unref(subdirs);
+    du_dir_release(dir);
+}
+
+void du_job_free(DuJob *job) {
+    g_free(job);
+}
+
+DuJob *du_job_new(GThreadPool *pool, DuLinks *links, DuDirFunc dir_done, DuDoneFunc done, gpointer user_data) {
+    DuJob *job = g_new0(DuJob, 1);
+    job->pool = pool;
+    job->links = links;
+    job->dir_done = dir_done;
+    job->done = done;
+    job->user_data = user_data;
+    job->roots_pending = 1;  // held until every root has been added
+    return job;
+}
+
+void du_job_add_path(DuJob *job, const char *path) {
+    g_atomic_int_inc(&job->roots_pending);
+    g_thread_pool_push(job->pool, du_dir_new(job, NULL, g_strdup(path)), NULL);
+}
+
+// Case-folded character classes: letters, digits and the usual path
+// punctuation get their own bit, everything else shares the top one.
+static guint64 path_index_char_bit(unsigned char c) {
+    c = g_ascii_tolower(c);
+    if (c >= 'a' && c <= 'z') {
+        return G_GUINT64_CONSTANT(1) << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return G_GUINT64_CONSTANT(1) << (26 + c - '0');
+    }
+    switch (c) {
+    case '.': return G_GUINT64_CONSTANT(1) << 36;
+    case '_': return G_GUINT64_CONSTANT(1) << 37;
+    case '-': return G_GUINT64_CONSTANT(1) << 38;
+    case '/': return G_GUINT64_CONSTANT(1) << 39;
+    default: return G_GUINT64_CONSTANT(1) << 63;
+    }
+}
+
+guint64 path_index_mask(const char *path) {
+    guint64 mask = 0;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        mask |= path_index_char_bit(*p);
+    }
+    return mask;
+}
+
+PathIndex *path_index_new(void) {
+    PathIndex *index = g_new0(PathIndex, 1);
+    index->entries = g_array_new(FALSE, FALSE, sizeof(IndexEntry));
+    index->paths = g_string_new(NULL);
+    index->table_size = INDEX_MIN_TABLE;
+    index->table = g_new0(guint32, index->table_size);
+    index->dirs = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    return index;
+}
+
+void path_index_free(PathIndex *index) {
+    g_array_free(index->entries, TRUE);
+    g_string_free(index->paths, TRUE);
+    g_free(index->table);
+    g_hash_table_destroy(index->dirs);
+    g_free(index);
+}
+
+static guint path_index_probe(PathIndex *index, const char *path) {
+    guint mask = index->table_size - 1;
+    for (guint slot = g_str_hash(path) & mask;; slot = (slot + 1) & mask) {
+        guint32 value = index->table[slot];
+        if (value == 0 || strcmp(path_index_path(index, value - 1), path) == 0) {
+            return slot;
+        }
+    }
+}
+
+static void path_index_resize(PathIndex *index, guint size) {
+    g_free(index->table);
+    index->table = g_new0(guint32, size);
+    index->table_size = size;
+    for (guint32 i = 0; i < index->entries->len; i++) {
+        if (g_array_index(index->entries, IndexEntry, i).length != 0) {
+            index->table[path_index_probe(index, path_index_path(index, i))] = i + 1;
+        }
+    }
+}
+
+// Drops removed entries and their bytes once they make up half the index.
+static void path_index_compact(PathIndex *index) {
+    GArray *entries = g_array_sized_new(FALSE, FALSE, sizeof(IndexEntry), index->live);
+    GString *paths = g_string_sized_new(index->paths->len);
+    for (guint32 i = 0; i < index->entries->len; i++) {
+        IndexEntry entry = g_array_index(index->entries, IndexEntry, i);
+        if (entry.length != 0) {
+            g_string_append_len(paths, index->paths->str + entry.offset, entry.length + 1);
+            entry.offset = paths->len - entry.length - 1;
+            g_array_append_val(entries, entry);
+        }
+    }
+    g_array_free(index->entries, TRUE);
+    g_string_free(index->paths, TRUE);
+    index->entries = entries;
+    index->paths = paths;
+    index->dead = 0;
+    path_index_resize(index, index->table_size);
+}
+
+void path_index_add(PathIndex *index, const char *path, gsize length) {
+    if ((index->live + 1) * 4 >= index->table_size * 3) {
+        path_index_resize(index, index->table_size * 2);
+    }
+    guint slot = path_index_probe(index, path);
+    if (index->table[slot] != 0) {
+        return;
+    }
+
+    IndexEntry entry = { .offset = index->paths->len, .length = length, .mask = path_index_mask(path) };
+    g_string_append_len(index->paths, path, length + 1);
+    g_array_append_val(index->entries, entry);
+    index->table[slot] = index->entries->len;
+    index->live++;
+}
+
+// Same backward-shift delete as the listing's name index.
+static void path_index_remove_slot(PathIndex *index, guint hole) {
+    guint mask = index->table_size - 1;
+    IndexEntry *entry = &g_array_index(index->entries, IndexEntry, index->table[hole] - 1);
+    entry->length = 0;
+    index->live--;
+    index->dead++;
+
+    index->table[hole] = 0;
+    for (guint slot = (hole + 1) & mask; index->table[slot] != 0; slot = (slot + 1) & mask) {
+        guint home = g_str_hash(path_index_path(index, index->table[slot] - 1)) & mask;
+        gboolean stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+        if (!stays) {
+            index->table[hole] = index->table[slot];
+            index->table[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+void path_index_remove(PathIndex *index, const char *path) {
+    guint slot = path_index_probe(index, path);
+    if (index->table[slot] != 0) {
+        path_index_remove_slot(index, slot);
+    }
+}
+
+// Removes every path under dir, which must end in '/'.
+void path_index_remove_tree(PathIndex *index, const char *dir) {
+    gsize dir_len = strlen(dir);
+    for (guint32 i = 0; i < index->entries->len; i++) {
+        const IndexEntry *entry = &g_array_index(index->entries, IndexEntry, i);
+        if (entry->length > dir_len && strncmp(index->paths->str + entry->offset, dir, dir_len) == 0) {
+            path_index_remove(index, index->paths->str + entry->offset);
+        }
+    }
+    if (index->dead > index->live) {
+        path_index_compact(index);
+    }
+}
+
+// The cache file is a small header, the workspace root, then every live path
+// NUL-terminated. Masks and the lookup table are rebuilt on load.
+void path_index_save(PathIndex *index, const char *root, const char *cache_path) {
+    GString *data = g_string_sized_new(sizeof(IndexCacheHeader) + strlen(root) + index->paths->len);
+    IndexCacheHeader header = {
+        .root_length = strlen(root),
+        .count = index->live,
+    };
+    memcpy(header.magic, INDEX_CACHE_MAGIC, sizeof(header.magic));
+    g_string_append_len(data, (const char *)&header, sizeof(header));
+    g_string_append_len(data, root, header.root_length);
+    for (guint32 i = 0; i < index->entries->len; i++) {
+        const IndexEntry *entry = &g_array_index(index->entries, IndexEntry, i);
+        if (entry->length != 0) {
+            g_string_append_len(data, index->paths->str + entry->offset, entry->length + 1);
+        }
+    }
+
+    gchar *dir = g_path_get_dirname(cache_path);
+    GError *error = NULL;
+    g_mkdir_with_parents(dir, 0700);
+    if (!g_file_set_contents(cache_path, data->str, data->len, &error)) {
+        g_printerr("Failed to write file index cache: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+    g_string_free(data, TRUE);
+}
+
+PathIndex *path_index_load(const char *root, const char *cache_path) {
+    gchar *data;
+    gsize length;
+    if (!g_file_get_contents(cache_path, &data, &length, NULL)) {
+        return NULL;
+    }
+
+    IndexCacheHeader header;
+    PathIndex *index = NULL;
+    if (length >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+    }
+    if (length >= sizeof(header) && memcmp(header.magic, INDEX_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.root_length == strlen(root) && sizeof(header) + header.root_length <= length &&
+        memcmp(data + sizeof(header), root, header.root_length) == 0 && data[length - 1] == '\0') {
+        index = path_index_new();
+        guint size = INDEX_MIN_TABLE;
+        while (size < MIN(header.count, length) * 2) {
+            size *= 2;
+        }
+        path_index_resize(index, size);
+        for (const char *p = data + sizeof(header) + header.root_length; p < data + length;) {
+            gsize path_len = strlen(p);
+            path_index_add(index, p, path_len);
+            p += path_len + 1;
+        }
+    }
+
+    g_free(data);
+    return index;
+}
+
+// Adds every file under prefix (relative to root, "" for all of it) to the
+// index. With an inotify fd, every directory on the way is watched with
+// watch_mask so the index can follow changes afterwards.
+void path_index_walk(PathIndex *index, const char *root, const char *prefix, gchar **ignore_dirs,
+                     int inotify_fd, guint32 watch_mask) {
+    TRACE_START(trace_start);
+    GPtrArray *stack = g_ptr_array_new();
+    GString *path = g_string_new(NULL);
+    char *buf = g_malloc(SCAN_BUFFER_SIZE);
+
+    g_ptr_array_add(stack, g_strdup(prefix));
+    while (stack->len > 0) {
+        gchar *rel = g_ptr_array_remove_index_fast(stack, stack->len - 1);
+        gchar *dir_path = rel[0] ? g_build_filename(root, rel, NULL) : g_strdup(root);
+
+        int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            int wd = inotify_fd < 0 ? -1 : inotify_add_watch(inotify_fd, dir_path, watch_mask);
+            if (wd >= 0) {
+                g_hash_table_insert(index->dirs, GINT_TO_POINTER(wd), g_strdup(rel));
+            } else if (inotify_fd >= 0 && !index->watch_failed) {
+                g_printerr("Failed to watch %s for the file index: %s\n", dir_path, strerror(errno));
+                index->watch_failed = TRUE;
+            }
+
+            long nread;
+            while ((nread = syscall(SYS_getdents64, dir_fd, buf, SCAN_BUFFER_SIZE)) > 0) {
+                for (long pos = 0; pos < nread;) {
+                    struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+                    pos += d->d_reclen;
+
+                    gboolean is_dir = d->d_type == DT_DIR;
+                    if (d->d_type == DT_UNKNOWN) {
+                        struct stat statbuf;
+                        if (fstatat(dir_fd, d->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+                            continue;
+                        }
+                        is_dir = S_ISDIR(statbuf.st_mode);
+                    }
+                    if (is_dir ? workspace_skip_dir(d->d_name, ignore_dirs) : is_hidden_entry(d->d_name)) {
+                        continue;
+                    }
+
+                    g_string_truncate(path, 0);
+                    if (rel[0]) {
+                        g_string_append(path, rel);
+                        g_string_append_c(path, '/');
+                    }
+                    g_string_append(path, d->d_name);
+
+                    if (is_dir) {
+                        g_ptr_array_add(stack, g_strdup(path->str));
+                    } else {
+                        path_index_add(index, path->str, path->len);
+                    }
+                }
+            }
+            close(dir_fd);
+        }
+
+        g_free(dir_path);
+        g_free(rel);
+    }
+
+    g_free(buf);
+    g_string_free(path, TRUE);
+    g_ptr_array_free(stack, TRUE);
+    TRACE_ENDF(trace_start, "scan", "index walk", "%s: %u paths", prefix[0] ? prefix : root, index->live);
+}
+
+// Greedy subsequence match, scored in favour of word starts, runs of
+// consecutive characters and hits inside the file name. Returns -1 when the
+// query doesn't match.
+static gint path_index_score(const char *path, guint32 length, const char *query) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    gint score = 0;
+    const char *last = NULL;
+    const char *p = path;
+    for (const char *q = query; *q; q++) {
+        while (*p && g_ascii_tolower(*p) != *q) {
+            p++;
+        }
+        if (*p == '\0') {
+            return -1;
+        }
+        if (p == path || strchr("/_-. ", p[-1])) {
+            score += 8;
+        }
+        if (last && p == last + 1) {
+            score += 5;
+        }
+        if (p >= base) {
+            score += 3;
+        }
+        last = p++;
+    }
+    return score * 16 - (gint)MIN(length, 255u);
+}
+
+// Scores every live entry against query, or only the entries listed in
+// candidates when it is non-NULL, and keeps the best max_hits in hits sorted
+// by score. Every matching entry is appended to matches so a longer query
+// can start from them.
+void path_index_query(PathIndex *index, const char *query, GArray *candidates, GArray *matches,
+                      FinderHit *hits, guint max_hits, guint *n_hits) {
+    guint64 mask = path_index_mask(query);
+    gsize query_len = strlen(query);
+    guint count = candidates ? candidates->len : index->entries->len;
+    *n_hits = 0;
+
+    for (guint i = 0; i < count; i++) {
+        guint32 e = candidates ? g_array_index(candidates, guint32, i) : i;
+        const IndexEntry *entry = &g_array_index(index->entries, IndexEntry, e);
+        if (entry->length == 0 || entry->length < query_len || (entry->mask & mask) != mask) {
+            continue;
+        }
+        gint score = path_index_score(index->paths->str + entry->offset, entry->length, query);
+        if (score < 0) {
+            continue;
+        }
+        g_array_append_val(matches, e);
+
+        // Keep the best max_hits sorted by insertion.
+        if (*n_hits == max_hits && score <= hits[*n_hits - 1].score) {
+            continue;
+        }
+        guint pos = *n_hits < max_hits ? (*n_hits)++ : *n_hits - 1;
+        while (pos > 0 && hits[pos - 1].score < score) {
+            hits[pos] = hits[pos - 1];
+            pos--;
+        }
+        hits[pos].entry = e;
+        hits[pos].score = score;
+    }
+}
@@ -0,0 +1,161 @@
+#ifndef CODEWS_WORKSPACE_H
+#define CODEWS_WORKSPACE_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// The filesystem core of the workshop: directory listing, recursive
+// deletion, disk usage, the path index behind the finder and language
+// detection. None of it touches GTK, so it runs on worker threads and in
+// codews-bench alike.
+
+#define SCAN_BUFFER_SIZE 65536
+
+// Deletions fan out over a thread pool, one task per directory. Past this
+// many open directory fds a worker descends depth-first instead of queueing.
+#define DELETE_MAX_OPEN_DIRS 512
+
+// Directories of the workshop's own that never show up in listings.
+#define TRASH_DIR_NAME ".codews-trash"
+#define BUILD_CACHE_DIR_NAME ".codews-cache"
+
+#define INDEX_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define INDEX_MIN_TABLE 1024
+#define INDEX_CACHE_MAGIC "CWSIDX01"
+
+// One directory entry as produced by a scan. The name is stored in the
+// owning batch's string arena at name_offset.
+typedef struct {
+    guint32 name_offset;
+    guint32 mode;
+    gint64 size;
+    gint64 mtime;
+    guint8 type;
+} EntryRecord;
+
+// Called once per listed entry; name_offset is left at 0 for the caller to
+// fill in. Returning FALSE stops the listing.
+typedef gboolean (*EntryFunc)(const char *name, const EntryRecord *record, gpointer user_data);
+
+typedef struct DeleteJob DeleteJob;
+typedef struct DeleteDir DeleteDir;
+
+// Runs on whichever thread finished the last root, so it must not touch GTK.
+typedef void (*DeleteDoneFunc)(DeleteJob *job);
+
+struct DeleteJob {
+    gboolean background;  // run serially on the calling thread, report errors quietly
+    GThreadPool *pool;    // runs delete_worker(); unused for background jobs
+    DeleteDoneFunc done;
+    gpointer user_data;
+    GCancellable *cancellable;
+    gint roots_pending;
+    gint open_dirs;
+    guint64 entries;
+    guint64 bytes;
+    GMutex errors_lock;
+    GPtrArray *errors;
+};
+
+typedef struct {
+    guint32 offset;
+    guint32 length;  // 0 once the path has been removed
+    guint64 mask;
+} IndexEntry;
+
+typedef struct {
+    GArray *entries;
+    GString *paths;
+    guint32 *table;  // open addressing, entry + 1
+    guint table_size;
+    guint live;
+    guint dead;
+    GHashTable *dirs;  // inotify wd -> directory relative to the root
+    gboolean watch_failed;  // some directory went unwatched, e.g. past max_user_watches
+} PathIndex;
+
+typedef struct {
+    guint32 entry;
+    gint score;
+} FinderHit;
+
+typedef struct DuJob DuJob;
+typedef struct DuDir DuDir;
+typedef struct DuLinks DuLinks;
+
+// Both run on the worker that finished the directory, so they must not touch
+// GTK. root is set for the directories passed to du_job_add_path().
+typedef void (*DuDirFunc)(DuJob *job, const char *path, const struct stat *st, guint64 own, guint64 total,
+                          gboolean root);
+typedef void (*DuDoneFunc)(DuJob *job);
+
+// Disk usage in bytes of file size, as du --apparent-size counts it, so the
+// totals compare with the sizes a listing shows for files. Every directory
+// is one pool task and is reported once its whole subtree is summed. Walks
+// stay on the root's filesystem. A file with several links counts once, in
+// the directory that claims it first in the shared links table.
+struct DuJob {
+    GThreadPool *pool;  // runs du_worker()
+    DuDirFunc dir_done;
+    DuDoneFunc done;
+    gpointer user_data;
+    gint roots_pending;
+    DuLinks *links;
+};
+
+// Multiply linked inode -> directory that counts it, and the reverse, so a
+// directory's claims can be dropped when it is rescanned or forgotten.
+struct DuLinks {
+    GMutex lock;
+    GHashTable *owners;  // DuInode -> path, shared with claims' key
+    GHashTable *claims;  // directory path -> GArray of DuInode
+};
+
+typedef struct {
+    gchar *name;
+    struct stat st;
+} DuSubdir;
+
+gboolean is_hidden_entry(const char *name);
+gboolean workspace_skip_dir(const char *name, gchar **ignore_dirs);
+int list_directory(const char *dir, GCancellable *cancellable, EntryFunc func, gpointer user_data);
+const char *language_for_path(const char *root, const char *path);
+const char *find_caseless(const char *start, const char *end, const char *needle, gsize len);
+gboolean read_regular_file(const char *path, gsize max_size, GByteArray *buffer);
+
+DeleteJob *delete_job_new(GThreadPool *pool, gboolean background, DeleteDoneFunc done, gpointer user_data);
+void delete_job_add_path(DeleteJob *job, const char *path);
+void delete_job_free(DeleteJob *job);
+void delete_worker(gpointer data, gpointer user_data);
+gint delete_compare_depth(gconstpointer a, gconstpointer b, gpointer user_data);
+
+DuLinks *du_links_new(void);
+void du_links_free(DuLinks *links);
+void du_links_release(DuLinks *links, const char *dir);
+int du_scan_dir(const char *dir, DuLinks *links, struct stat *dir_stat, guint64 *own, GPtrArray *subdirs);
+void du_subdir_free(gpointer data);
+DuJob *du_job_new(GThreadPool *pool, DuLinks *links, DuDirFunc dir_done, DuDoneFunc done, gpointer user_data);
+void du_job_add_path(DuJob *job, const char *path);
+void du_job_free(DuJob *job);
+void du_worker(gpointer data, gpointer user_data);
+
+static inline const char *path_index_path(PathIndex *index, guint32 entry) {
+    return index->paths->str + g_array_index(index->entries, IndexEntry, entry).offset;
+}
+
+guint64 path_index_mask(const char *path);
+PathIndex *path_index_new(void);
+void path_index_free(PathIndex *index);
+void path_index_add(PathIndex *index, const char *path, gsize length);
+void path_index_remove(PathIndex *index, const char *path);
+void path_index_remove_tree(PathIndex *index, const char *dir);
+void path_index_save(PathIndex *index, const char *root, const char *cache_path);
+PathIndex *path_index_load(const char *root, const char *cache_path);
+void path_index_walk(PathIndex *index, const char *root, const char *prefix, gchar **ignore_dirs,
+                     int inotify_fd, guint32 watch_mask);
+void path_index_query(PathIndex *index, const char *query, GArray *candidates, GArray *matches,
+                      FinderHit *hits, guint max_hits, guint *n_hits);
+
+#endif